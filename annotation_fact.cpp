@@ -111,9 +111,7 @@ bool fact_annotatable::has_been_predeleted() const {
   return predeleted;
 }
 
-void fact_annotatable::predelete() {
-  assert(!predeleted);
-  predeleted = true;
+void fact_annotatable::unjustify_observations() const {
   vector<const annotation_fact*>positive_accumulator;
   vector<const negative_annotation_fact*>negative_accumulator;
   for (auto&i : annotations) {
@@ -143,6 +141,19 @@ void fact_annotatable::predelete() {
   }
 }
 
+void fact_annotatable::predelete() {
+  assert(!predeleted);
+  predeleted = true;
+  unjustify_observations();
+}
+
+void fact_annotatable::retract() const {
+  assert(!predeleted);
+  unjustify_observations();
+  annotations.clear();
+  justified_negative_annotation_facts.clear();
+}
+
 ostream&fact_annotatable::dump(ostream&out) const {
   for (auto&i : annotations) {
     for (const annotation_wrapper&j : i.second) {
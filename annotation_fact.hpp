@@ -67,8 +67,16 @@ public:
   virtual void add_annotation(const ::annotation&annotation) const override;
   virtual void remove_annotation(const ::annotation&annotation) const override;
 
+protected:
+  void unjustify_observations() const;
+
+public:
   bool has_been_predeleted() const;
   virtual void predelete();
+  // Unjustifies the observations, like predelete, and then drops whatever
+  // annotations remain, but leaves the annotatable open to new observations,
+  // as when what they were made about changes in place.
+  void retract() const;
 
   virtual std::ostream&dump(std::ostream&out) const;
 };
@@ -0,0 +1,869 @@
+// Microbenchmarks for the highlighter's hot paths.
+//
+// Build with optimization, e.g., `make OFLAGS=-O2 i7-benchmark`, and then run
+// `./i7-benchmark` to run every benchmark or `./i7-benchmark NAME...` to run
+// only the named ones.
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "codepoint_reader.hpp"
+#include "lexer.hpp"
+#include "lexical_highlights.hpp"
+#include "monoid_sequence.hpp"
+#include "parallel_lexer.hpp"
+#include "protocol.hpp"
+#include "reference_lexer.hpp"
+#include "utf8.hpp"
+
+using namespace std;
+
+static const char*SAMPLE_TEXT_FILE_NAME = "6G60.i7x";
+static const char*HIGHLIGHTER_FILE_NAME = "./i7-highlighter";
+
+class stopwatch {
+protected:
+  chrono::steady_clock::time_point beginning;
+
+public:
+  stopwatch() :
+    beginning{chrono::steady_clock::now()} {}
+
+  double seconds() const {
+    return chrono::duration<double>(chrono::steady_clock::now() - beginning).count();
+  }
+};
+
+static void report(const char*benchmark_name, const char*variant, double bytes, double seconds) {
+  printf("%-12s %-28s %10.1f MB/s\n", benchmark_name, variant, bytes / seconds / 1e6);
+}
+
+// Returns the sample source text, assumed to be Latin-1 or ASCII, repeated
+// until it is at least the given number of codepoints long.
+static i7_string get_sample_text(size_t minimum_length) {
+  FILE*file = fopen(SAMPLE_TEXT_FILE_NAME, "rb");
+  if (!file) {
+    fprintf(stderr, "Cannot open %s; run the benchmarks from the source directory.\n", SAMPLE_TEXT_FILE_NAME);
+    exit(1);
+  }
+  i7_string sample;
+  for (int byte; (byte = fgetc(file)) != EOF;) {
+    sample.push_back(static_cast<i7_codepoint>(byte));
+  }
+  fclose(file);
+  i7_string result;
+  while (result.size() < minimum_length) {
+    result += sample;
+  }
+  return result;
+}
+
+namespace {
+  enum wire_format {
+    BIG_ENDIAN_UCS_4,
+    LITTLE_ENDIAN_UCS_4,
+    UTF_8
+  };
+}
+
+static void append_word(string&bytes, uint32_t word, wire_format format) {
+  if (format == UTF_8) {
+    encode_varint(word, bytes);
+    return;
+  }
+  for (unsigned i = 0; i < 4; ++i) {
+    unsigned shift = (format == BIG_ENDIAN_UCS_4) ? 24 - 8 * i : 8 * i;
+    bytes.push_back(static_cast<char>((word >> shift) & 0xFF));
+  }
+}
+
+// Measures how fast the command loop's reader decodes a stream of
+// CLIENT_ADD_CODEPOINTS messages, each carrying one line of source text, from a
+// temporary file.
+static void benchmark_decode() {
+  i7_string text = get_sample_text(1 << 23);
+  for (wire_format format : {BIG_ENDIAN_UCS_4, LITTLE_ENDIAN_UCS_4, UTF_8}) {
+    string bytes;
+    append_word(bytes, CLIENT_BEGIN_SESSION, format);
+    size_t line_beginning = 0;
+    while (line_beginning < text.size()) {
+      size_t line_end = text.find(U'\n', line_beginning);
+      line_end = (line_end == i7_string::npos) ? text.size() : line_end + 1;
+      append_word(bytes, CLIENT_ADD_CODEPOINTS, format);
+      append_word(bytes, 0, format);
+      append_word(bytes, static_cast<uint32_t>(line_beginning), format);
+      if (format == UTF_8) {
+	encode_utf8(text.data() + line_beginning, text.data() + line_end, bytes);
+	bytes.push_back(0);
+      } else {
+	for (size_t i = line_beginning; i < line_end; ++i) {
+	  append_word(bytes, text[i], format);
+	}
+	append_word(bytes, 0, format);
+      }
+      line_beginning = line_end;
+    }
+    append_word(bytes, CLIENT_END_SESSION, format);
+    FILE*file = tmpfile();
+    if (!file || fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size() || fflush(file)) {
+      fprintf(stderr, "Cannot write a temporary file for the decode benchmark.\n");
+      exit(1);
+    }
+    size_t codepoints_seen = 0;
+    double seconds = 0;
+    for (unsigned trial = 0; trial < 5; ++trial) {
+      lseek(fileno(file), 0, SEEK_SET);
+      codepoint_reader reader{fileno(file)};
+      if (format == UTF_8) {
+	reader.set_encoding(WIRE_ENCODING_UTF_8);
+      }
+      codepoints_seen = 0;
+      stopwatch timer;
+      for (uint32_t command; (command = reader.read_codepoint()) != CLIENT_END_SESSION;) {
+	if (command == CLIENT_ADD_CODEPOINTS) {
+	  reader.read_codepoint();
+	  reader.read_codepoint();
+	  codepoints_seen += reader.read_string().size();
+	}
+      }
+      double trial_seconds = timer.seconds();
+      if (!trial || trial_seconds < seconds) {
+	seconds = trial_seconds;
+      }
+    }
+    fclose(file);
+    if (codepoints_seen != text.size()) {
+      fprintf(stderr, "Decoded %zu codepoints, but sent %zu.\n", codepoints_seen, text.size());
+      exit(1);
+    }
+    static const char*const FORMAT_NAMES[] = {"big-endian UCS-4", "little-endian UCS-4", "UTF-8"};
+    report("decode", FORMAT_NAMES[format], static_cast<double>(bytes.size()), seconds);
+    printf("%-12s %-28s %10.1f Mcodepoints/s from %zu bytes\n", "", "", static_cast<double>(codepoints_seen) / seconds / 1e6, bytes.size());
+  }
+}
+
+static void write_all(int file_descriptor, const string&bytes) {
+  for (size_t written = 0; written < bytes.size();) {
+    ssize_t count = write(file_descriptor, bytes.data() + written, bytes.size() - written);
+    if (count <= 0) {
+      perror("write");
+      exit(1);
+    }
+    written += static_cast<size_t>(count);
+  }
+}
+
+// Returns the resident set size of a process in megabytes.
+static double get_resident_megabytes(pid_t process) {
+  string path = "/proc/" + to_string(process) + "/status";
+  FILE*file = fopen(path.c_str(), "r");
+  double result = 0;
+  if (file) {
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+      unsigned long kilobytes;
+      if (sscanf(line, "VmRSS: %lu kB", &kilobytes) == 1) {
+	result = kilobytes / 1024.0;
+      }
+    }
+    fclose(file);
+  }
+  return result;
+}
+
+static pid_t spawn_highlighter(const char*const*arguments, int*to_child, int*from_child) {
+  int input_pipe[2], output_pipe[2];
+  if (to_child && (pipe(input_pipe) || pipe(output_pipe))) {
+    perror("pipe");
+    exit(1);
+  }
+  pid_t result = fork();
+  if (result < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (!result) {
+    if (to_child) {
+      dup2(input_pipe[0], STDIN_FILENO);
+      dup2(output_pipe[1], STDOUT_FILENO);
+      close(input_pipe[1]);
+      close(output_pipe[0]);
+    }
+    execv(HIGHLIGHTER_FILE_NAME, const_cast<char*const*>(arguments));
+    _exit(127);
+  }
+  if (to_child) {
+    close(input_pipe[0]);
+    close(output_pipe[1]);
+    *to_child = input_pipe[1];
+    *from_child = output_pipe[0];
+  }
+  return result;
+}
+
+// Sends a short session opening to an editor connection and returns how long
+// the first reply byte took to come back.
+static double time_first_reply(int to_server, int from_server, const string&opening) {
+  stopwatch timer;
+  write_all(to_server, opening);
+  char byte;
+  if (read(from_server, &byte, 1) != 1) {
+    fprintf(stderr, "The highlighter did not reply.\n");
+    exit(1);
+  }
+  return timer.seconds();
+}
+
+// Compares serving several editors from one process per editor, as when each
+// Emacs runs its own highlighter, against serving them all from one process
+// listening on a socket, in both memory and the time until a new editor's first
+// highlights.  Requires a built highlighter in the current directory.
+static void benchmark_sessions() {
+  static const unsigned EDITOR_COUNT = 4;
+  string opening;
+  for (unsigned i = 0; i < ALL_HIGHLIGHT_CODE_COUNT; ++i) {
+    append_word(opening, CLIENT_SUPPORT_HIGHLIGHT_CODE, BIG_ENDIAN_UCS_4);
+    append_word(opening, ALL_HIGHLIGHT_CODES[i], BIG_ENDIAN_UCS_4);
+  }
+  for (uint32_t word : initializer_list<uint32_t>{CLIENT_BEGIN_SESSION, CLIENT_INTRODUCE_BUFFER, 0U, CLIENT_ADD_CODEPOINTS, 0U, 0U}) {
+    append_word(opening, word, BIG_ENDIAN_UCS_4);
+  }
+  for (const char*character = "Section 1 - \"Hello\" [greeting]\n"; *character; ++character) {
+    append_word(opening, static_cast<unsigned char>(*character), BIG_ENDIAN_UCS_4);
+  }
+  append_word(opening, 0, BIG_ENDIAN_UCS_4);
+  string ending;
+  append_word(ending, CLIENT_END_SESSION, BIG_ENDIAN_UCS_4);
+  signal(SIGPIPE, SIG_IGN);
+  // One process per editor.
+  {
+    const char*const arguments[] = {HIGHLIGHTER_FILE_NAME, nullptr};
+    double seconds = 0, megabytes = 0;
+    vector<pid_t>processes;
+    vector<int>to_children;
+    for (unsigned i = 0; i < EDITOR_COUNT; ++i) {
+      int to_child, from_child;
+      processes.push_back(spawn_highlighter(arguments, &to_child, &from_child));
+      seconds += time_first_reply(to_child, from_child, opening);
+      megabytes += get_resident_megabytes(processes.back());
+      to_children.push_back(to_child);
+      close(from_child);
+    }
+    for (unsigned i = 0; i < EDITOR_COUNT; ++i) {
+      write_all(to_children[i], ending);
+      close(to_children[i]);
+      waitpid(processes[i], nullptr, 0);
+    }
+    printf("%-12s %-28s %10.1f ms per editor, %.1f MB for %u editors\n", "sessions", "one process per editor", seconds / EDITOR_COUNT * 1e3, megabytes, EDITOR_COUNT);
+  }
+  // One process listening on a socket.
+  {
+    string socket_path = "/tmp/i7-benchmark-" + to_string(getpid()) + ".socket";
+    const char*const arguments[] = {HIGHLIGHTER_FILE_NAME, "--listen", socket_path.c_str(), nullptr};
+    stopwatch startup_timer;
+    pid_t server = spawn_highlighter(arguments, nullptr, nullptr);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    double seconds = 0;
+    vector<int>sockets;
+    for (unsigned i = 0; i < EDITOR_COUNT; ++i) {
+      int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+      // The first connection has to wait for the server to come up.
+      while (connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address))) {
+	if (startup_timer.seconds() > 60) {
+	  fprintf(stderr, "Cannot connect to %s.\n", socket_path.c_str());
+	  exit(1);
+	}
+	usleep(1000);
+      }
+      double reply_seconds = time_first_reply(connection, connection, opening);
+      if (i) {
+	seconds += reply_seconds;
+      } else {
+	printf("%-12s %-28s %10.1f ms until the first editor's first reply\n", "sessions", "one shared process", startup_timer.seconds() * 1e3);
+      }
+      sockets.push_back(connection);
+    }
+    double megabytes = get_resident_megabytes(server);
+    for (int connection : sockets) {
+      write_all(connection, ending);
+      close(connection);
+    }
+    kill(server, SIGTERM);
+    waitpid(server, nullptr, 0);
+    unlink(socket_path.c_str());
+    printf("%-12s %-28s %10.1f ms per later editor, %.1f MB for %u editors\n", "sessions", "one shared process", seconds / (EDITOR_COUNT - 1) * 1e3, megabytes, EDITOR_COUNT);
+  }
+}
+
+// Starts a highlighter, sends it the given messages, and returns how long it
+// took to get from starting the process to the first byte of highlights, which
+// must follow the given confirmation if that is not empty.  Then ends the
+// session and waits for the highlighter to exit.
+static double time_first_highlights(const string&messages, const string&confirmation, const string&ending) {
+  const char*const arguments[] = {HIGHLIGHTER_FILE_NAME, nullptr};
+  int to_child, from_child;
+  stopwatch timer;
+  pid_t process = spawn_highlighter(arguments, &to_child, &from_child);
+  write_all(to_child, messages);
+  string replies;
+  char block[1 << 16];
+  while (replies.size() <= confirmation.size()) {
+    ssize_t count = read(from_child, block, confirmation.size() + 1 - replies.size());
+    if (count <= 0) {
+      fprintf(stderr, "The highlighter did not reply.\n");
+      exit(1);
+    }
+    replies.append(block, static_cast<size_t>(count));
+  }
+  double seconds = timer.seconds();
+  if (replies.compare(0, confirmation.size(), confirmation)) {
+    fprintf(stderr, "The highlighter did not confirm loading the file.\n");
+    exit(1);
+  }
+  write_all(to_child, ending);
+  close(to_child);
+  while (read(from_child, block, sizeof(block)) > 0) {}
+  close(from_child);
+  waitpid(process, nullptr, 0);
+  return seconds;
+}
+
+// Compares introducing a large buffer by streaming its text in a
+// CLIENT_ADD_CODEPOINTS message against having the highlighter map the file
+// with CLIENT_LOAD_FILE, timing each from the highlighter's startup to its
+// first highlights.  That includes lexing the whole buffer, which is the same
+// either way, but not the editor's cost of encoding what it sends, which is
+// where streaming hurts most.
+// Requires a built highlighter in the current directory.
+static void benchmark_load() {
+  i7_string text = get_sample_text(1 << 20);
+  string encoded_text;
+  encode_utf8(text.data(), text.data() + text.size(), encoded_text);
+  char path[] = "/tmp/i7-benchmark-XXXXXX";
+  int file_descriptor = mkstemp(path);
+  if (file_descriptor < 0) {
+    fprintf(stderr, "Cannot write a temporary file for the load benchmark.\n");
+    exit(1);
+  }
+  write_all(file_descriptor, encoded_text);
+  close(file_descriptor);
+  string opening, ending;
+  for (unsigned i = 0; i < ALL_HIGHLIGHT_CODE_COUNT; ++i) {
+    append_word(opening, CLIENT_SUPPORT_HIGHLIGHT_CODE, BIG_ENDIAN_UCS_4);
+    append_word(opening, ALL_HIGHLIGHT_CODES[i], BIG_ENDIAN_UCS_4);
+  }
+  for (uint32_t word : initializer_list<uint32_t>{CLIENT_BEGIN_SESSION, CLIENT_INTRODUCE_BUFFER, 0U}) {
+    append_word(opening, word, BIG_ENDIAN_UCS_4);
+  }
+  append_word(ending, CLIENT_END_SESSION, BIG_ENDIAN_UCS_4);
+  string streaming = opening;
+  for (uint32_t word : initializer_list<uint32_t>{CLIENT_ADD_CODEPOINTS, 0U, 0U}) {
+    append_word(streaming, word, BIG_ENDIAN_UCS_4);
+  }
+  for (i7_codepoint codepoint : text) {
+    append_word(streaming, codepoint, BIG_ENDIAN_UCS_4);
+  }
+  append_word(streaming, 0, BIG_ENDIAN_UCS_4);
+  string loading = opening;
+  for (uint32_t word : initializer_list<uint32_t>{CLIENT_LOAD_FILE, 0U, 0U}) {
+    append_word(loading, word, BIG_ENDIAN_UCS_4);
+  }
+  for (const char*character = path; *character; ++character) {
+    append_word(loading, static_cast<unsigned char>(*character), BIG_ENDIAN_UCS_4);
+  }
+  append_word(loading, 0, BIG_ENDIAN_UCS_4);
+  string confirmation;
+  for (uint32_t word : initializer_list<uint32_t>{SERVER_FILE_LOADED, 0U, static_cast<uint32_t>(text.size()), checksum_codepoints(text)}) {
+    append_word(confirmation, word, BIG_ENDIAN_UCS_4);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  double seconds = time_first_highlights(streaming, "", ending);
+  printf("%-12s %-28s %10.1f ms until the first highlights, %zu bytes sent\n", "load", "CLIENT_ADD_CODEPOINTS", seconds * 1e3, streaming.size());
+  seconds = time_first_highlights(loading, confirmation, ending);
+  unlink(path);
+  printf("%-12s %-28s %10.1f ms until the first highlights, %zu bytes sent\n", "load", "CLIENT_LOAD_FILE", seconds * 1e3, loading.size());
+}
+
+// Lexes the sample text in chunks the size of a large edit, once with the
+// original state-function lexer and once with the table-driven one, and checks
+// that the two agree.  Because the sample is Latin-1, rates count one byte per
+// codepoint.
+static const size_t LEXING_CHUNK_SIZE = 1 << 16;
+
+template<typename L>static size_t lex_chunk(const i7_string&text, size_t beginning, vector<token>*results) {
+  L chunk_lexer;
+  size_t end = min(beginning + LEXING_CHUNK_SIZE, text.size());
+  for (size_t index = beginning; index < end; ++index) {
+    chunk_lexer << text[index];
+  }
+  chunk_lexer << TERMINATOR_CODEPOINT;
+  if (results) {
+    *results = chunk_lexer.get_results();
+  }
+  return chunk_lexer.get_results().size();
+}
+
+static size_t lex_chunk_as_span(lexer&chunk_lexer, const i7_string&text, size_t beginning) {
+  chunk_lexer.reset();
+  chunk_lexer << i7_string_view{text.data() + beginning, min(LEXING_CHUNK_SIZE, text.size() - beginning)};
+  chunk_lexer << TERMINATOR_CODEPOINT;
+  return chunk_lexer.get_results().size();
+}
+
+static bool lex_the_same(const token&expected, const token&actual) {
+  return
+    expected.get_text() == actual.get_text() &&
+    expected.get_line_count() == actual.get_line_count() &&
+    expected.is_only_whitespace() == actual.is_only_whitespace() &&
+    expected.get_lexical_effect() == actual.get_lexical_effect();
+}
+
+// The reference lexer records no resume states to compare with, so instead
+// resumes a lexer from the one that the token at index recorded and checks
+// that the next few tokens come out again as they did, resume states and all.
+static bool resumes_as_recorded(const vector<token>&tokens, size_t index) {
+  static const size_t RELEXED_TOKEN_COUNT = 8;
+  static lexer resumed_lexer;
+  lexer_resume_state resume_state = tokens[index].get_resume_state();
+  if (resume_state == UNKNOWN_LEXER_RESUME_STATE) {
+    return true;
+  }
+  size_t first_pending = index;
+  for (unsigned pending_codepoint_count = lexer::get_pending_codepoint_count(resume_state); pending_codepoint_count;) {
+    if (!first_pending || tokens[first_pending - 1].get_codepoint_count() > pending_codepoint_count) {
+      return false;
+    }
+    --first_pending;
+    pending_codepoint_count -= tokens[first_pending].get_codepoint_count();
+  }
+  i7_string pending_codepoints;
+  for (size_t i = first_pending; i < index; ++i) {
+    pending_codepoints += *tokens[i].get_text();
+  }
+  resumed_lexer.resume(resume_state, pending_codepoints, tokens[first_pending].get_resume_state());
+  for (size_t i = index; i < min(tokens.size(), index + RELEXED_TOKEN_COUNT); ++i) {
+    resumed_lexer << *tokens[i].get_text();
+  }
+  // Whatever the lexer has flushed is final, even though the input stops
+  // short.
+  const vector<token>&results = resumed_lexer.get_results();
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (first_pending + i >= tokens.size() || !lex_the_same(tokens[first_pending + i], results[i]) || tokens[first_pending + i].get_resume_state() != results[i].get_resume_state()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void benchmark_lex() {
+  i7_string text = get_sample_text(1 << 23);
+  for (size_t beginning = 0; beginning < text.size(); beginning += LEXING_CHUNK_SIZE) {
+    vector<token>expected, actual;
+    lex_chunk<reference_lexer>(text, beginning, &expected);
+    lex_chunk<lexer>(text, beginning, &actual);
+    bool same = (expected.size() == actual.size());
+    for (size_t i = 0; same && i < expected.size(); ++i) {
+      same = lex_the_same(expected[i], actual[i]) && resumes_as_recorded(actual, i);
+    }
+    if (!same) {
+      fprintf(stderr, "The lexers disagree on the chunk beginning at codepoint %zu.\n", beginning);
+      exit(1);
+    }
+  }
+  size_t token_count = 0;
+  stopwatch reference_timer;
+  for (size_t beginning = 0; beginning < text.size(); beginning += LEXING_CHUNK_SIZE) {
+    token_count += lex_chunk<reference_lexer>(text, beginning, nullptr);
+  }
+  report("lex", "state functions", static_cast<double>(text.size()), reference_timer.seconds());
+  stopwatch table_timer;
+  for (size_t beginning = 0; beginning < text.size(); beginning += LEXING_CHUNK_SIZE) {
+    token_count += lex_chunk<lexer>(text, beginning, nullptr);
+  }
+  report("lex", "table, by codepoint", static_cast<double>(text.size()), table_timer.seconds());
+  lexer reused_lexer;
+  stopwatch span_timer;
+  for (size_t beginning = 0; beginning < text.size(); beginning += LEXING_CHUNK_SIZE) {
+    token_count += lex_chunk_as_span(reused_lexer, text, beginning);
+  }
+  report("lex", "table, by span, reused", static_cast<double>(text.size()), span_timer.seconds());
+  printf("%-12s %-28s %10zu tokens per pass\n", "", "", token_count / 3);
+}
+
+// Lexes text made of nothing but near misses for documentation breaks, lines
+// of hyphens and breaks that fall through at every point, in the same way as
+// benchmark_lex.  The state-function lexer relexes every one of them, whereas
+// the table-driven one flushes them as worked out in advance.
+static void benchmark_hyphens() {
+  static const char*const NEAR_MISSES[] = {
+    "\n------------------------------------------------------------",
+    "\n---- DOCUMENTATION ---",
+    "\r\n---- DOCUMENTATION ----",
+    "\n---- DOCUMENT ----\n",
+    "\n--",
+  };
+  i7_string text;
+  while (text.size() < (1 << 22)) {
+    for (const char*near_miss : NEAR_MISSES) {
+      for (const char*character = near_miss; *character; ++character) {
+	text.push_back(static_cast<unsigned char>(*character));
+      }
+    }
+  }
+  for (size_t beginning = 0; beginning < text.size(); beginning += LEXING_CHUNK_SIZE) {
+    vector<token>expected, actual;
+    lex_chunk<reference_lexer>(text, beginning, &expected);
+    lex_chunk<lexer>(text, beginning, &actual);
+    bool same = (expected.size() == actual.size());
+    for (size_t i = 0; same && i < expected.size(); ++i) {
+      same = expected[i].get_text() == actual[i].get_text() && expected[i].get_line_count() == actual[i].get_line_count();
+    }
+    if (!same) {
+      fprintf(stderr, "The lexers disagree on the hyphens beginning at codepoint %zu.\n", beginning);
+      exit(1);
+    }
+  }
+  stopwatch reference_timer;
+  for (size_t beginning = 0; beginning < text.size(); beginning += LEXING_CHUNK_SIZE) {
+    lex_chunk<reference_lexer>(text, beginning, nullptr);
+  }
+  report("hyphens", "state functions", static_cast<double>(text.size()), reference_timer.seconds());
+  stopwatch table_timer;
+  for (size_t beginning = 0; beginning < text.size(); beginning += LEXING_CHUNK_SIZE) {
+    lex_chunk<lexer>(text, beginning, nullptr);
+  }
+  report("hyphens", "table, by codepoint", static_cast<double>(text.size()), table_timer.seconds());
+  lexer reused_lexer;
+  stopwatch span_timer;
+  for (size_t beginning = 0; beginning < text.size(); beginning += LEXING_CHUNK_SIZE) {
+    lex_chunk_as_span(reused_lexer, text, beginning);
+  }
+  report("hyphens", "table, by span, reused", static_cast<double>(text.size()), span_timer.seconds());
+}
+
+// Lexes the sample text as a word processor might have mangled it, with smart
+// quotes, a no-break space after every full stop, and dashes for hyphens, and
+// checks that the tokens come out the same as for the sample except for their
+// text, then times the two.
+static void benchmark_pasted() {
+  i7_string text = get_sample_text(1 << 23);
+  i7_string pasted = text;
+  bool in_quotation = false;
+  for (size_t index = 0; index < pasted.size(); ++index) {
+    switch (pasted[index]) {
+    case '"':
+      pasted[index] = in_quotation ? 0x201D : 0x201C;
+      in_quotation = !in_quotation;
+      break;
+    case '\'':
+      pasted[index] = 0x2019;
+      break;
+    case '-':
+      pasted[index] = 0x2013;
+      break;
+    case ' ':
+      if (index && pasted[index - 1] == '.') {
+	pasted[index] = 0xA0;
+      }
+      break;
+    }
+  }
+  lexer plain_lexer, pasted_lexer;
+  for (size_t beginning = 0; beginning < text.size(); beginning += LEXING_CHUNK_SIZE) {
+    lex_chunk_as_span(plain_lexer, text, beginning);
+    lex_chunk_as_span(pasted_lexer, pasted, beginning);
+    const vector<token>&expected = plain_lexer.get_results(), &actual = pasted_lexer.get_results();
+    bool same = (expected.size() == actual.size());
+    for (size_t i = 0; same && i < expected.size(); ++i) {
+      same = expected[i].get_codepoint_count() == actual[i].get_codepoint_count() && expected[i].get_line_count() == actual[i].get_line_count() && expected[i].get_lexical_effect()(INITIAL_LEXICAL_STATE) == actual[i].get_lexical_effect()(INITIAL_LEXICAL_STATE);
+    }
+    if (!same) {
+      fprintf(stderr, "The pasted text lexes differently in the chunk beginning at codepoint %zu.\n", beginning);
+      exit(1);
+    }
+  }
+  for (const i7_string*sample : {&text, &pasted}) {
+    stopwatch timer;
+    for (size_t beginning = 0; beginning < sample->size(); beginning += LEXING_CHUNK_SIZE) {
+      lex_chunk_as_span(plain_lexer, *sample, beginning);
+    }
+    report("pasted", sample == &text ? "plain sample" : "with smart punctuation", static_cast<double>(sample->size()), timer.seconds());
+  }
+}
+
+// The classification functions as they were before codepoints.cpp generated
+// its table, for comparison, but for the dashes and smart quotes that are now
+// classified as the punctuation that they normalize to.
+static bool switch_is_i7_whitespace(i7_codepoint codepoint) {
+  switch (codepoint) {
+  case 0x0009:
+  case 0x000A:
+  case 0x000B:
+  case 0x000C:
+  case 0x000D:
+  case 0x0020:
+  case 0x007C: // `|', an Inform 7 paragraph break.
+  case 0x0085:
+  case 0x00A0:
+  case 0x1680:
+  case 0x180E:
+  case 0x2000:
+  case 0x2001:
+  case 0x2002:
+  case 0x2003:
+  case 0x2004:
+  case 0x2005:
+  case 0x2006:
+  case 0x2007:
+  case 0x2008:
+  case 0x2009:
+  case 0x200A:
+  case 0x2028:
+  case 0x2029:
+  case 0x202F:
+  case 0x205F:
+  case 0x3000:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool switch_is_i7_punctuation(i7_codepoint codepoint) {
+  switch (codepoint) {
+  case 0x0021:
+  case 0x0022:
+  case 0x0027:
+  case 0x0028:
+  case 0x0029:
+  case 0x002A:
+  case 0x002B:
+  case 0x002D:
+  case 0x002E:
+  case 0x003A:
+  case 0x003B:
+  case 0x005B:
+  case 0x005C:
+  case 0x005D:
+  case 0x2010:
+  case 0x2011:
+  case 0x2012:
+  case 0x2013:
+  case 0x2014:
+  case 0x2018:
+  case 0x2019:
+  case 0x201C:
+  case 0x201D:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool switch_is_i7_letter(i7_codepoint codepoint) {
+  return !switch_is_i7_whitespace(codepoint) && !switch_is_i7_punctuation(codepoint) && codepoint != TERMINATOR_CODEPOINT;
+}
+
+template<typename W, typename P, typename L>static size_t count_classes(const i7_string&text, W is_whitespace, P is_punctuation, L is_letter) {
+  size_t count = 0;
+  for (i7_codepoint codepoint : text) {
+    count += is_whitespace(codepoint) + 2 * is_punctuation(codepoint) + 4 * is_letter(codepoint);
+  }
+  return count;
+}
+
+// Lexes a sample the size of a large file into a token sequence, once with one
+// lexer and one insertion per token, as for an edit, and once in chunks on
+// several threads with the sequence built in one piece, as when a file is
+// loaded, and checks that the two sequences agree.  At least four threads are
+// used so that the seams between chunks are exercised even on machines with
+// fewer cores, though there the chunked pass cannot be expected to be faster.
+static bool have_same_tokens(const monoid_sequence<token>&expected, const monoid_sequence<token>&actual) {
+  monoid_sequence<token>::iterator expected_position = expected.begin(), actual_position = actual.begin();
+  for (; expected_position.can_increment() && actual_position.can_increment(); ++expected_position, ++actual_position) {
+    if (expected_position->get_text() != actual_position->get_text() || expected_position->get_line_count() != actual_position->get_line_count() || expected_position->get_resume_state() != actual_position->get_resume_state()) {
+      return false;
+    }
+  }
+  if (expected_position.can_increment() || actual_position.can_increment()) {
+    return false;
+  }
+  token expected_sum = expected.sum_over_interval(expected.begin(), expected.end());
+  token actual_sum = actual.sum_over_interval(actual.begin(), actual.end());
+  return expected_sum.get_codepoint_count() == actual_sum.get_codepoint_count() && expected_sum.get_lexical_effect()(INITIAL_LEXICAL_STATE) == actual_sum.get_lexical_effect()(INITIAL_LEXICAL_STATE);
+}
+
+static void benchmark_chunks() {
+  i7_string text = get_sample_text(1 << 21);
+  unsigned thread_count = max(4U, thread::hardware_concurrency());
+  monoid_sequence<token>serial_sequence, chunked_sequence;
+  stopwatch serial_timer;
+  {
+    lexer serial_lexer;
+    serial_lexer << text;
+    serial_lexer << TERMINATOR_CODEPOINT;
+    for (const token&result : serial_lexer.get_results()) {
+      serial_sequence.insert(serial_sequence.end(), result);
+    }
+  }
+  report("chunks", "one thread", static_cast<double>(text.size()), serial_timer.seconds());
+  stopwatch chunked_timer;
+  {
+    parallel_lexer chunked_lexer;
+    chunked_lexer.lex(text, thread_count);
+    vector<reference_wrapper<const token>>results = chunked_lexer.get_results();
+    chunked_sequence.insert(chunked_sequence.end(), results.begin(), results.end());
+  }
+  report("chunks", (to_string(thread_count) + " threads").c_str(), static_cast<double>(text.size()), chunked_timer.seconds());
+  if (!have_same_tokens(serial_sequence, chunked_sequence)) {
+    fprintf(stderr, "Lexing in chunks disagrees with lexing in one piece.\n");
+    exit(1);
+  }
+}
+
+// Composes the lexical effects of the sample text's tokens, once left to right,
+// as the lexer's callers fold them, then again without the composition cache,
+// and once pairwise, as the token tree's vertices are summed, and checks that
+// they all agree.
+// Rates count one byte per codepoint of the sample.
+static bool have_same_images(const lexer_monoid&expected, const lexer_monoid&actual) {
+  static const lexer_monoid deepening{1};
+  for (lexical_state preimage = static_cast<lexical_superstate>(0); preimage.get_superstate() < LEXICAL_SUPERSTATE_COUNT; ++preimage) {
+    // Only the superstates that can take I7 comment levels are deepened.
+    unsigned comment_depth_limit = deepening(preimage).get_comment_depth() ? 4 : 1;
+    for (unsigned comment_depth = 0; comment_depth < comment_depth_limit; ++comment_depth) {
+      lexical_state deeper = {preimage.get_superstate(), comment_depth};
+      if (expected(deeper) != actual(deeper)) {
+	return false;
+      }
+    }
+  }
+  return true;
+}
+
+static void benchmark_compose() {
+  i7_string text = get_sample_text(1 << 21);
+  vector<lexer_monoid>effects;
+  {
+    lexer sample_lexer;
+    sample_lexer << text;
+    sample_lexer << TERMINATOR_CODEPOINT;
+    for (const token&result : sample_lexer.get_results()) {
+      effects.push_back(result.get_lexical_effect());
+    }
+  }
+  stopwatch fold_timer;
+  lexer_monoid folded{0};
+  for (const lexer_monoid&effect : effects) {
+    folded += effect;
+  }
+  report("compose", "left to right", static_cast<double>(text.size()), fold_timer.seconds());
+  // The same without the composition cache, as on a miss.
+  stopwatch function_timer;
+  lexer_monoid_function folded_function{0};
+  for (const lexer_monoid&effect : effects) {
+    folded_function = folded_function + effect.get_function();
+  }
+  report("compose", "uncached, left to right", static_cast<double>(text.size()), function_timer.seconds());
+  if (lexer_monoid{folded_function} != folded) {
+    fprintf(stderr, "Composing lexical effects without the cache disagrees with composing them with it.\n");
+    exit(1);
+  }
+  stopwatch pairwise_timer;
+  vector<lexer_monoid>level = effects;
+  while (level.size() > 1) {
+    vector<lexer_monoid>next_level;
+    next_level.reserve((level.size() + 1) / 2);
+    for (size_t index = 0; index < level.size(); index += 2) {
+      next_level.push_back(index + 1 < level.size() ? level[index] + level[index + 1] : level[index]);
+    }
+    level.swap(next_level);
+  }
+  report("compose", "pairwise", static_cast<double>(text.size()), pairwise_timer.seconds());
+  if (!have_same_images(folded, level.front())) {
+    fprintf(stderr, "Composing lexical effects pairwise disagrees with composing them in order.\n");
+    exit(1);
+  }
+  printf("%-12s %-28s %10zu compositions per pass\n", "", "", effects.size() - 1);
+  printf("%-12s %-28s %10zu bytes per token\n", "", "", sizeof(token));
+  printf("%-12s %-28s %10zu distinct lexical effects\n", "", "", lexer_monoid::get_function_count());
+}
+
+// Classifies every codepoint of the sample text, as the lexer does, and then
+// every codepoint in Unicode, with the switches and then with the table.  Rates
+// are in millions of codepoints per second.
+static void benchmark_classify() {
+  i7_string sample = get_sample_text(1 << 23);
+  i7_string everything;
+  for (i7_codepoint codepoint = 0; codepoint < I7_CODEPOINT_LIMIT; ++codepoint) {
+    everything.push_back(codepoint);
+    if (is_i7_whitespace(codepoint) != switch_is_i7_whitespace(codepoint) || is_i7_punctuation(codepoint) != switch_is_i7_punctuation(codepoint) || is_i7_letter(codepoint) != switch_is_i7_letter(codepoint)) {
+      fprintf(stderr, "The switches and the table disagree on U+%04X.\n", static_cast<unsigned>(codepoint));
+      exit(1);
+    }
+  }
+  for (const i7_string*text : {&sample, &everything}) {
+    const char*source = (text == &sample) ? "sample" : "all of Unicode";
+    stopwatch switch_timer;
+    size_t expected = count_classes(*text, switch_is_i7_whitespace, switch_is_i7_punctuation, switch_is_i7_letter);
+    double switch_seconds = switch_timer.seconds();
+    stopwatch table_timer;
+    size_t actual = count_classes(*text, is_i7_whitespace, is_i7_punctuation, is_i7_letter);
+    double table_seconds = table_timer.seconds();
+    // Also keeps the counts from being optimized away.
+    if (expected != actual) {
+      fprintf(stderr, "The switches and the table disagree on %s.\n", source);
+      exit(1);
+    }
+    report("classify", (string{source} + ", switches").c_str(), static_cast<double>(text->size()), switch_seconds);
+    report("classify", (string{source} + ", table").c_str(), static_cast<double>(text->size()), table_seconds);
+  }
+}
+
+namespace {
+  struct benchmark {
+    const char*name;
+    void (*run)();
+  };
+}
+
+static const benchmark BENCHMARKS[] = {
+  {"decode", benchmark_decode},
+  {"sessions", benchmark_sessions},
+  {"load", benchmark_load},
+  {"lex", benchmark_lex},
+  {"hyphens", benchmark_hyphens},
+  {"pasted", benchmark_pasted},
+  {"chunks", benchmark_chunks},
+  {"compose", benchmark_compose},
+  {"classify", benchmark_classify},
+};
+
+int main(int argc, char**argv) {
+  for (const benchmark&candidate : BENCHMARKS) {
+    bool selected = (argc < 2);
+    for (int i = 1; i < argc; ++i) {
+      selected |= !strcmp(argv[i], candidate.name);
+    }
+    if (selected) {
+      candidate.run();
+    }
+  }
+  return 0;
+}
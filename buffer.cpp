@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <limits>
+#include <utility>
 #include <vector>
 
 #include "buffer.hpp"
@@ -65,6 +68,28 @@ static token_iterator next_by_skipping_whitespace(token_iterator position) {
   return result;
 }
 
+// Unjustifies the links annotated on a token outside of a relexed range that
+// lead from it (or, if leading is false, to it) across the range.  Relexing
+// does not always erase the tokens on either side of an edit, and a link
+// between two surviving tokens would otherwise outlive the tokens that the edit
+// put between them.
+static void unlink_across(typename ::session&session, ::buffer*buffer, token_iterator position, bool leading) {
+  if (!position.can_increment()) {
+    return;
+  }
+  vector<const next_token*>links;
+  for (const annotation_wrapper&wrapper : position->get_annotations(typeid(next_token))) {
+    const next_token&link = dynamic_cast<const next_token&>(static_cast<const annotation&>(wrapper));
+    if ((leading ? link.get_self() : link.get_next()) == position) {
+      links.push_back(new next_token{session, buffer, link.get_self(), link.get_next()});
+    }
+  }
+  for (const next_token*link : links) {
+    link->unjustify();
+    delete link;
+  }
+}
+
 void buffer::parser_rehighlight_handler(lexical_state beginning_state, token_iterator beginning, token_iterator end) {
   // Step I: Make sure that negative and combined annotation facts are false.
   for (token_iterator i = beginning; i != end; ++i) {
@@ -100,9 +125,27 @@ void buffer::parser_rehighlight_handler(lexical_state beginning_state, token_ite
       end_of_sentence.unjustify();
     }
   }
+  {
+    token_iterator previous = previous_by_skipping_whitespace(beginning);
+    unlink_across(owner, this, previous, true);
+    token_iterator next = end;
+    if (next.can_increment() && next->is_only_whitespace()) {
+      next = next_by_skipping_whitespace(next);
+    }
+    unlink_across(owner, this, next, false);
+  }
   // Step IIIa: Make end-of-sentence observations true.  (We do these first for performance reasons.)
+  //
+  // Here and in Step IIIb, cancellation is checked between observations, each
+  // of which is propagated in full.  If it happens, every observation justified
+  // so far is annotated on a token that mark_dirty takes into the dirty range,
+  // and the tokens after the cancellation point have only been through Step I,
+  // which justifies nothing on them but their end-of-sentence negations.
   lexical_state state = beginning_state;
   for (monoid_sequence<token>::iterator i = beginning, j = i; i != end; i = j) {
+    if (owner.is_propagation_cancelled()) {
+      return;
+    }
     ++j;
     // end_of_sentence
     if (is_plain_i7_or_documentation(state)) {
@@ -118,6 +161,9 @@ void buffer::parser_rehighlight_handler(lexical_state beginning_state, token_ite
   token_iterator previous = previous_by_skipping_whitespace(beginning);
   bool previous_valid = (previous != beginning);
   for (monoid_sequence<token>::iterator i = beginning, j = i; i != end; i = j) {
+    if (owner.is_propagation_cancelled()) {
+      return;
+    }
     ++j;
     // token_available
     token_available available{owner, this, i};
@@ -132,7 +178,7 @@ void buffer::parser_rehighlight_handler(lexical_state beginning_state, token_ite
     }
     state = i->get_lexical_effect()(state);
   }
-  if (end.can_decrement() && previous_valid) {
+  if (end.can_decrement() && previous_valid && !owner.is_propagation_cancelled()) {
     token_iterator inclusive_end = end;
     --inclusive_end;
     token_iterator next = next_by_skipping_whitespace(inclusive_end);
@@ -144,22 +190,100 @@ void buffer::parser_rehighlight_handler(lexical_state beginning_state, token_ite
   }
 }
 
-namespace {
-  struct highlight {
-    unsigned				beginning_codepoint_index;
-    unsigned				end_codepoint_index;
-    ::highlight_code			highlight_code;
-  };
+static const highlight_code INVALID_HIGHLIGHT = 0xFFFFFFFF;
+
+i7_string buffer::get_codepoints(unsigned beginning, unsigned end) const {
+  i7_string result;
+  token_iterator i = source_text.find(token{beginning});
+  unsigned index = source_text.sum_over_interval(source_text.begin(), i).get_codepoint_count();
+  for (; index < end && i != source_text.end(); ++i) {
+    const i7_string&text = *i->get_text();
+    unsigned from = (beginning > index) ? beginning - index : 0;
+    unsigned to = min(static_cast<unsigned>(text.size()), end - index);
+    result.append(text, from, to - from);
+    index += text.size();
+  }
+  return result;
 }
 
-static const highlight_code INVALID_HIGHLIGHT = 0xFFFFFFFF;
+void buffer::mark_dirty(token_iterator beginning, token_iterator end) {
+  // Widen the range to whole sentences, taking in the sentence endings on
+  // either side, so that the observations that the handler makes on its edges
+  // are redone too.
+  if (beginning.can_decrement()) {
+    do {
+      --beginning;
+    } while (beginning.can_decrement() && sentence_endings.find(beginning) == sentence_endings.end());
+  }
+  while (end.can_increment() && sentence_endings.find(end) == sentence_endings.end()) {
+    ++end;
+  }
+  ++end;
+  unsigned beginning_codepoint_index = source_text.sum_over_interval(source_text.begin(), beginning).get_codepoint_count();
+  unsigned end_codepoint_index = beginning_codepoint_index + source_text.sum_over_interval(beginning, end).get_codepoint_count();
+  if (has_dirty_range) {
+    dirty_beginning = min(dirty_beginning, beginning_codepoint_index);
+    dirty_end = max(dirty_end, end_codepoint_index);
+  } else {
+    has_dirty_range = true;
+    dirty_beginning = beginning_codepoint_index;
+    dirty_end = end_codepoint_index;
+  }
+}
+
+// Brings the editor's highlights in [beginning, end) in line with the intended
+// ones.
+void buffer::send_highlights(unsigned beginning, unsigned end) {
+  vector<highlight_run>runs;
+  intended_highlights.get_runs(beginning, end, runs);
+  vector<pair<unsigned, unsigned>>changed_stretches;
+  highlights.update(beginning, end, runs, changed_stretches);
+  vector<highlight_run>::const_iterator run = runs.begin();
+  vector<highlight_run>stretch_runs;
+  for (const pair<unsigned, unsigned>&stretch : changed_stretches) {
+    while (run != runs.end() && run->end_codepoint_index <= stretch.first) {
+      ++run;
+    }
+    stretch_runs.clear();
+    for (vector<highlight_run>::const_iterator i = run; i != runs.end() && i->beginning_codepoint_index < stretch.second; ++i) {
+      // The shadow still records runs that the editor cannot show, since they
+      // only need sending again if the intended highlight changes.
+      if (owner.supports_highlight_code(i->highlight_code)) {
+	stretch_runs.push_back({max(i->beginning_codepoint_index, stretch.first), min(i->end_codepoint_index, stretch.second), i->highlight_code});
+      }
+    }
+    replace_highlights(buffer_number, stretch.first, stretch.second, stretch_runs);
+  }
+}
+
+void buffer::send_deferred_highlights(const vector<pair<unsigned, unsigned>>&stretches) {
+  for (const pair<unsigned, unsigned>&stretch : stretches) {
+    send_highlights(stretch.first, stretch.second);
+  }
+}
+
+void buffer::send_visible_highlights() {
+  if (deferred_highlights.empty()) {
+    return;
+  }
+  vector<pair<unsigned, unsigned>>stretches;
+  if (view_ranges.empty()) {
+    // Without views we cannot tell what is on screen, so assume everything.
+    deferred_highlights.extract(0, numeric_limits<unsigned>::max(), stretches);
+  } else {
+    for (const auto&view_range : view_ranges) {
+      deferred_highlights.extract(view_range.second.first, view_range.second.second, stretches);
+    }
+  }
+  send_deferred_highlights(stretches);
+}
 
-void buffer::rehighlight(const lexical_reference_points_from_edit&reference_points_from_edit) {
+void buffer::rehighlight(const lexical_reference_points_from_edit&reference_points_from_edit, bool send_visible) {
   if (reference_points_from_edit.start_of_relexed_text == source_text.end()) {
     return;
   }
   unsigned initial_codepoint_index = source_text.sum_over_interval(source_text.begin(), reference_points_from_edit.start_of_relexed_text).get_codepoint_count();
-  vector<highlight>new_highlights;
+  vector<highlight_run>new_highlights;
   bool done_with_relexed_portion = false;
   //
   unsigned codepoint_index_before = initial_codepoint_index;
@@ -189,15 +313,26 @@ void buffer::rehighlight(const lexical_reference_points_from_edit&reference_poin
     lexical_state_before = lexical_state_after;
     highlight_before = highlight_after;
   }
-  //
-  parser_rehighlight_handler(reference_points_from_edit.pre_relex_state, reference_points_from_edit.start_of_relexed_text, i);
-  //
   if (highlight_codepoint_index_before < codepoint_index_before) {
     new_highlights.push_back({ highlight_codepoint_index_before, codepoint_index_before, highlight_before });
   }
-  remove_highlights(buffer_number, initial_codepoint_index, codepoint_index_before);
-  for (const ::highlight&highlight : new_highlights) {
-    add_highlight(buffer_number, highlight.beginning_codepoint_index, highlight.end_codepoint_index, highlight.highlight_code);
+  // Most edits leave most of the relexed text highlighted as it was, so only
+  // the stretches where the highlighting actually changed need to be sent.
+  // Those that the editor can see go out before parsing so that they never wait
+  // on it; the rest can wait until the editor needs them.
+  vector<pair<unsigned, unsigned>>changed_stretches;
+  intended_highlights.update(initial_codepoint_index, codepoint_index_before, new_highlights, changed_stretches);
+  for (const pair<unsigned, unsigned>&stretch : changed_stretches) {
+    deferred_highlights.insert(stretch.first, stretch.second);
+  }
+  if (send_visible) {
+    send_visible_highlights();
+  }
+  //
+  owner.begin_cancellable_propagation();
+  parser_rehighlight_handler(reference_points_from_edit.pre_relex_state, reference_points_from_edit.start_of_relexed_text, i);
+  if (owner.end_cancellable_propagation()) {
+    mark_dirty(reference_points_from_edit.start_of_relexed_text, i);
   }
 }
 
@@ -260,11 +395,114 @@ void buffer::remove_partial_match(const match*partial_match) {
 }
 
 void buffer::remove_codepoints(unsigned beginning, unsigned end) {
-  rehighlight(::remove_codepoints(source_text, beginning, end));
+  if (beginning == end) {
+    return;
+  }
+  // An edit that the journal cannot merge waits for the pending one to be
+  // applied, which rehighlights in the coordinates from before the new edit, so
+  // everything else only moves for the new edit afterward.  But the editor has
+  // already made the new edit, so highlights can only go to it after that.
+  bool applied_pending_edits = !pending_edits.remove_codepoints(beginning, end);
+  if (applied_pending_edits) {
+    apply_pending_edits(false);
+    pending_edits.remove_codepoints(beginning, end);
+  }
+  highlights.remove_codepoints(beginning, end);
+  intended_highlights.remove_codepoints(beginning, end);
+  deferred_highlights.remove_codepoints(beginning, end);
+  unsigned count = end - beginning;
+  auto clamp = [beginning, end, count](unsigned index) {
+    return index <= beginning ? index : index >= end ? index - count : beginning;
+  };
+  if (has_dirty_range) {
+    dirty_beginning = clamp(dirty_beginning);
+    dirty_end = clamp(dirty_end);
+  }
+  // Views move with the text until the editor says otherwise.
+  for (auto&view_range : view_ranges) {
+    view_range.second.first = clamp(view_range.second.first);
+    view_range.second.second = clamp(view_range.second.second);
+  }
+  if (applied_pending_edits) {
+    send_visible_highlights();
+  }
+}
+
+void buffer::add_codepoints(unsigned beginning, i7_string&&insertion) {
+  unsigned count = insertion.size();
+  if (!count) {
+    return;
+  }
+  // As in remove_codepoints, the journal comes first.  It only takes the
+  // insertion when it records it.
+  bool applied_pending_edits = !pending_edits.add_codepoints(beginning, move(insertion));
+  if (applied_pending_edits) {
+    apply_pending_edits(false);
+    pending_edits.add_codepoints(beginning, move(insertion));
+  }
+  highlights.add_codepoints(beginning, count);
+  intended_highlights.add_codepoints(beginning, count);
+  deferred_highlights.add_codepoints(beginning, count);
+  if (has_dirty_range) {
+    if (dirty_beginning > beginning) {
+      dirty_beginning += count;
+    }
+    if (dirty_end >= beginning) {
+      dirty_end += count;
+    }
+  }
+  // Text inserted before a view pushes it along; text inserted inside it
+  // pushes other text off of its end instead.
+  for (auto&view_range : view_ranges) {
+    if (view_range.second.first > beginning) {
+      view_range.second.first += count;
+      view_range.second.second += count;
+    }
+  }
+  if (applied_pending_edits) {
+    send_visible_highlights();
+  }
+}
+
+void buffer::apply_pending_edits(bool send_visible) {
+  if (pending_edits.is_pending()) {
+    rehighlight(::replace_codepoints(source_text, pending_edits.get_beginning(), pending_edits.get_end(), pending_edits.get_insertion()), send_visible);
+    pending_edits.clear();
+  }
+}
+
+void buffer::reparse_dirty_range() {
+  if (has_dirty_range) {
+    has_dirty_range = false;
+    // Relexing the same text erases the old tokens, and with them, by way of
+    // fact_annotatable::predelete, exactly the observations that the cancelled
+    // handler justified, retracting everything deduced from those; then the
+    // handler starts over on the new tokens.
+    rehighlight(::replace_codepoints(source_text, dirty_beginning, dirty_end, get_codepoints(dirty_beginning, dirty_end)));
+  }
+}
+
+void buffer::introduce_view(unsigned view_number) {
+  view_ranges[view_number] = {0, 0};
+}
+
+void buffer::discard_view(unsigned view_number) {
+  view_ranges.erase(view_number);
+  send_visible_highlights();
+}
+
+void buffer::move_view(unsigned view_number, unsigned beginning, unsigned end) {
+  view_ranges[view_number] = {beginning, end};
+  vector<pair<unsigned, unsigned>>stretches;
+  deferred_highlights.extract(beginning, end, stretches);
+  send_deferred_highlights(stretches);
 }
 
-void buffer::add_codepoints(unsigned beginning, const i7_string&insertion) {
-  rehighlight(::add_codepoints(source_text, beginning, insertion));
+bool buffer::send_some_deferred_highlights(unsigned count) {
+  vector<pair<unsigned, unsigned>>stretches;
+  deferred_highlights.extract_first(count, stretches);
+  send_deferred_highlights(stretches);
+  return !deferred_highlights.empty();
 }
 
 ostream&operator <<(ostream&out, const ::buffer&buffer) {
@@ -2,13 +2,19 @@
 #define BUFFER_HEADER
 
 #include <iostream>
+#include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "codepoints.hpp"
 #include "token.hpp"
 #include "monoid_sequence.hpp"
 #include "custom_multimap.hpp"
 #include "relexer.hpp"
+#include "highlight_shadow.hpp"
+#include "interval_set.hpp"
+#include "edit_journal.hpp"
 
 class session;
 class parseme;
@@ -35,16 +41,42 @@ protected:
   std::unordered_set<token_iterator>	sentence_endings;
   custom_multimap<const nonterminal*, const match*>
 					partial_matches_by_need;
+  // What the editor has been told to highlight, for sending only differences,
+  // and what it should be told; the two differ only in deferred_highlights.
+  // Changes are sent at once if they fall in a view (or if the editor has not
+  // set up any views), and otherwise wait until the editor scrolls to them or
+  // is quiet for a while.
+  highlight_shadow			highlights;
+  highlight_shadow			intended_highlights;
+  interval_set				deferred_highlights;
+  // The visible range of each view of this buffer, by view number.
+  std::unordered_map<unsigned, std::pair<unsigned, unsigned>>
+					view_ranges;
+  // Edits received but not yet relexed.
+  edit_journal				pending_edits;
+  // Codepoints whose parsing was cancelled in favor of newer input and still
+  // need to be reparsed.
+  bool					has_dirty_range;
+  unsigned				dirty_beginning;
+  unsigned				dirty_end;
 
 public:
   buffer(typename ::session&owner, unsigned buffer_number) :
     owner(owner),
     buffer_number{buffer_number},
-    type{UNDECIDED_BUFFER} {}
+    type{UNDECIDED_BUFFER},
+    has_dirty_range{false},
+    dirty_beginning{0},
+    dirty_end{0} {}
 
 protected:
+  i7_string get_codepoints(unsigned beginning, unsigned end) const;
+  void mark_dirty(token_iterator beginning, token_iterator end);
   void parser_rehighlight_handler(lexical_state beginning_state, token_iterator beginning, token_iterator end);
-  void rehighlight(const lexical_reference_points_from_edit&reference_points_from_edit);
+  void send_highlights(unsigned beginning, unsigned end);
+  void send_deferred_highlights(const std::vector<std::pair<unsigned, unsigned>>&stretches);
+  void send_visible_highlights();
+  void rehighlight(const lexical_reference_points_from_edit&reference_points_from_edit, bool send_visible = true);
 
 public:
   const std::unordered_set<token_iterator>&get_parseme_beginnings(const parseme&terminal);
@@ -62,7 +94,20 @@ public:
   void remove_partial_match(const match*partial_match);
 
   void remove_codepoints(unsigned beginning, unsigned end);
-  void add_codepoints(unsigned beginning, const i7_string&insertion);
+  // Takes the insertion's storage where it can; see edit_journal.
+  void add_codepoints(unsigned beginning, i7_string&&insertion);
+  // Relexes and rehighlights for any edits still in the journal, leaving even
+  // the highlights that the editor can see deferred if send_visible is false.
+  void apply_pending_edits(bool send_visible = true);
+  // Redoes parsing that was cancelled.
+  void reparse_dirty_range();
+
+  void introduce_view(unsigned view_number);
+  void discard_view(unsigned view_number);
+  void move_view(unsigned view_number, unsigned beginning, unsigned end);
+  // Sends up to count codepoints' worth of deferred highlights, returning true
+  // if any remain.
+  bool send_some_deferred_highlights(unsigned count);
 
   friend std::ostream&operator <<(std::ostream&out, const ::buffer&buffer);
 };
@@ -0,0 +1,410 @@
+// Consistency checks for incremental parsing.
+//
+// Build with `make i7-check` and then run `./i7-check` to run every check or
+// `./i7-check NAME...` to run only the named ones.  Each check parses the same
+// text in two ways that ought to reach the same facts, since deduction is meant
+// not to depend on the order in which observations arrive, and compares the
+// annotations that the parser leaves on the buffers or the highlights that the
+// editor would end up showing.  The one exception, the stalled check, runs the
+// built highlighter in the current directory instead.
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <map>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "io.hpp"
+#include "highlight_shadow.hpp"
+#include "lexical_highlights.hpp"
+#include "protocol.hpp"
+#include "session.hpp"
+
+using namespace std;
+
+// Sentences that the built-in grammar has something to say about, including
+// nonterminal declarations, words that match their names, and numbers.
+static const char*SAMPLE_TEXT =
+  "# name word is a wording.\n"
+  "# lamp is a sentence.\n"
+  "\n"
+  "The lamp is here.  Take 12 lamps; it is 3:15.\n"
+  "\n"
+  "# brass lamp is a line.\n"
+  "Take the lamp (carefully).\n";
+
+static typename ::session*session = nullptr;
+static unsigned failure_count = 0;
+static unsigned next_buffer_number = 0;
+// What the editor would be showing for each buffer, given the highlights sent
+// to it and its own edits.
+static map<unsigned, highlight_shadow> editor_highlights;
+
+// The number of times that has_pending_input may still answer false, or the
+// maximum for never.
+static unsigned polls_before_input = numeric_limits<unsigned>::max();
+
+static i7_string encode(const char*text) {
+  i7_string result;
+  for (; *text; ++text) {
+    result.push_back(static_cast<unsigned char>(*text));
+  }
+  return result;
+}
+
+// Makes an edit both in the session and in the editor's highlights, as the
+// editor itself would.
+static void add_codepoints(unsigned buffer_number, unsigned beginning, const i7_string&insertion) {
+  editor_highlights[buffer_number].add_codepoints(beginning, insertion.size());
+  session->add_codepoints(buffer_number, beginning, i7_string{insertion});
+}
+
+static void remove_codepoints(unsigned buffer_number, unsigned beginning, unsigned end) {
+  editor_highlights[buffer_number].remove_codepoints(beginning, end);
+  session->remove_codepoints(buffer_number, beginning, end);
+}
+
+static void discard_buffer(unsigned buffer_number) {
+  session->discard_buffer(buffer_number);
+  editor_highlights.erase(buffer_number);
+}
+
+// Returns the buffer's annotations one per line, sorted, because the order in
+// which a token lists them depends on hashing, and with token addresses left
+// out.
+static string describe_buffer(unsigned buffer_number) {
+  static const regex ADDRESS{"0x[0-9a-f]+ = "};
+  stringstream dump;
+  dump << *session->get_buffers().at(buffer_number);
+  vector<string>lines;
+  for (string line; getline(dump, line);) {
+    if (line.compare(0, 6, "BEGIN ") && line.compare(0, 4, "END ")) {
+      lines.push_back(regex_replace(line, ADDRESS, ""));
+    }
+  }
+  sort(lines.begin(), lines.end());
+  string result;
+  for (const string&line : lines) {
+    result += line;
+    result += '\n';
+  }
+  return result;
+}
+
+// Loads the text into a new buffer and then makes the insertion, letting
+// parsing be cancelled after the given number of polls each time (and then
+// finished when it next goes idle).  Returns the buffer's description after
+// each of the two steps.
+static vector<string>describe_edits(const i7_string&text, unsigned edit_point, const i7_string&insertion, unsigned polls) {
+  unsigned buffer_number = next_buffer_number++;
+  vector<string>results;
+  session->introduce_buffer(buffer_number);
+  for (unsigned step = 0; step < 2; ++step) {
+    if (step) {
+      add_codepoints(buffer_number, edit_point, insertion);
+    } else {
+      add_codepoints(buffer_number, 0, text);
+    }
+    polls_before_input = polls;
+    session->idle();
+    polls_before_input = numeric_limits<unsigned>::max();
+    session->idle();
+    results.push_back(describe_buffer(buffer_number));
+  }
+  discard_buffer(buffer_number);
+  return results;
+}
+
+// Loads the text into a new buffer and then types the codepoints one at a
+// time from the edit point on, going idle after each, as an editor would send
+// them.  Returns the buffer's description at the end.
+static string describe_typing(const i7_string&text, unsigned edit_point, const i7_string&typed) {
+  unsigned buffer_number = next_buffer_number++;
+  session->introduce_buffer(buffer_number);
+  add_codepoints(buffer_number, 0, text);
+  session->idle();
+  for (size_t i = 0; i < typed.size(); ++i) {
+    add_codepoints(buffer_number, edit_point + i, typed.substr(i, 1));
+    session->idle();
+  }
+  string result = describe_buffer(buffer_number);
+  discard_buffer(buffer_number);
+  return result;
+}
+
+// Goes idle and then sends all deferred output, as when the editor pauses.
+static void settle() {
+  session->idle();
+  while (session->send_deferred_output());
+}
+
+// Returns the highlights that the editor shows for the buffer, one run per
+// line, and then forgets the buffer.
+static string describe_editor_highlights(unsigned buffer_number) {
+  vector<highlight_run>runs;
+  editor_highlights[buffer_number].get_runs(0, numeric_limits<unsigned>::max(), runs);
+  discard_buffer(buffer_number);
+  string result;
+  for (const highlight_run&run : runs) {
+    result += to_string(run.beginning_codepoint_index) + "-" + to_string(run.end_codepoint_index) + ": " + to_string(run.highlight_code) + "\n";
+  }
+  return result;
+}
+
+static void expect(bool condition, const char*check_name, const string&variant) {
+  if (!condition) {
+    printf("%-12s FAILED: %s\n", check_name, variant.c_str());
+    ++failure_count;
+  }
+}
+
+// Cancels parsing after every possible number of polls, both on loading and on
+// an edit in the middle, and checks that the reparse at the next idle catches
+// up with an uncancelled run.
+static void check_cancel() {
+  i7_string text = encode(SAMPLE_TEXT);
+  unsigned edit_point = text.find('.') + 1;
+  i7_string insertion = encode("  Take 7 lamps.");
+  vector<string>expected = describe_edits(text, edit_point, insertion, numeric_limits<unsigned>::max());
+  for (unsigned polls = 0; polls < 2 * text.size(); ++polls) {
+    vector<string>actual = describe_edits(text, edit_point, insertion, polls);
+    expect(actual[0] == expected[0], "cancel", "load cancelled after " + to_string(polls) + " polls");
+    expect(actual[1] == expected[1], "cancel", "edit cancelled after " + to_string(polls) + " polls");
+  }
+}
+
+// Types into and onto words, some of which the grammar matches, including
+// single letters that patch a word in place, and checks that the parser ends up
+// where it would have on loading the result.
+static void check_typing() {
+  static const struct {
+    const char*context;
+    unsigned offset;
+    const char*typed;
+  } EDITS[] = {
+    {"Take 12", 4, "s"},
+    {"lamp (", 2, "x"},
+    {"lamp is here", 0, "s"},
+    {"12 lamps", 1, "a"},
+    {"name word", 4, "s"},
+    {"is a line", 9, "s"},
+  };
+  i7_string text = encode(SAMPLE_TEXT);
+  for (const auto&edit : EDITS) {
+    unsigned edit_point = text.find(encode(edit.context)) + edit.offset;
+    i7_string typed = encode(edit.typed);
+    i7_string edited_text = text;
+    edited_text.insert(edit_point, typed);
+    expect(describe_typing(text, edit_point, typed) == describe_typing(edited_text, 0, {}), "typing", string{"typing \""} + edit.typed + "\" into \"" + edit.context + "\"");
+  }
+}
+
+// Makes runs of edits, each with no idle before the next, so that those that
+// do not touch the pending one force it to be applied mid-run, and checks that
+// the editor ends up showing what it would for a fresh load of the result.
+// Highlights come from the lexer alone, so parsing is kept from ever running,
+// as for an editor that never stops sending.
+static void check_edits() {
+  static const char*INSERTIONS[] = {"x", "lamp", " ", "\"", "\"[", "]", ";\n", "(", ")", "\n\n# "};
+  static const unsigned SEQUENCE_COUNT = 300;
+  static const unsigned MAXIMUM_EDIT_COUNT = 4;
+  static const unsigned MAXIMUM_REMOVAL_LENGTH = 6;
+  minstd_rand random;
+  i7_string original_text = encode(SAMPLE_TEXT);
+  polls_before_input = 0;
+  for (unsigned sequence = 0; sequence < SEQUENCE_COUNT; ++sequence) {
+    i7_string text = original_text;
+    unsigned buffer_number = next_buffer_number++;
+    session->introduce_buffer(buffer_number);
+    add_codepoints(buffer_number, 0, text);
+    settle();
+    string description;
+    unsigned edit_count = 1 + random() % MAXIMUM_EDIT_COUNT;
+    for (unsigned edit = 0; edit < edit_count; ++edit) {
+      unsigned beginning = random() % (text.size() + 1);
+      if (random() % 2 || beginning == text.size()) {
+	i7_string insertion = encode(INSERTIONS[random() % (sizeof(INSERTIONS) / sizeof(INSERTIONS[0]))]);
+	text.insert(beginning, insertion);
+	add_codepoints(buffer_number, beginning, insertion);
+	description += " add@" + to_string(beginning);
+      } else {
+	unsigned end = min<unsigned>(text.size(), beginning + 1 + random() % MAXIMUM_REMOVAL_LENGTH);
+	text.erase(beginning, end - beginning);
+	remove_codepoints(buffer_number, beginning, end);
+	description += " remove@" + to_string(beginning) + "-" + to_string(end);
+      }
+    }
+    settle();
+    string actual = describe_editor_highlights(buffer_number);
+    unsigned fresh_buffer_number = next_buffer_number++;
+    session->introduce_buffer(fresh_buffer_number);
+    add_codepoints(fresh_buffer_number, 0, text);
+    settle();
+    expect(actual == describe_editor_highlights(fresh_buffer_number), "edits", "highlights after" + description);
+  }
+  polls_before_input = numeric_limits<unsigned>::max();
+}
+
+static void append_word(string&bytes, uint32_t word) {
+  for (unsigned i = 0; i < 4; ++i) {
+    bytes.push_back(static_cast<char>((word >> (24 - 8 * i)) & 0xFF));
+  }
+}
+
+// Returns the messages that open a session declaring every highlight code and
+// introduce a buffer with the given text.
+static string open_session(const i7_string&text) {
+  string result;
+  for (unsigned i = 0; i < ALL_HIGHLIGHT_CODE_COUNT; ++i) {
+    append_word(result, CLIENT_SUPPORT_HIGHLIGHT_CODE);
+    append_word(result, ALL_HIGHLIGHT_CODES[i]);
+  }
+  for (uint32_t word : initializer_list<uint32_t>{CLIENT_BEGIN_SESSION, CLIENT_INTRODUCE_BUFFER, 0U, CLIENT_ADD_CODEPOINTS, 0U, 0U}) {
+    append_word(result, word);
+  }
+  for (i7_codepoint codepoint : text) {
+    append_word(result, codepoint);
+  }
+  append_word(result, 0);
+  return result;
+}
+
+static bool write_all(int file_descriptor, const string&bytes) {
+  for (size_t written = 0; written < bytes.size();) {
+    ssize_t count = write(file_descriptor, bytes.data() + written, bytes.size() - written);
+    if (count <= 0) {
+      return false;
+    }
+    written += static_cast<size_t>(count);
+  }
+  return true;
+}
+
+// Connects to a highlighter listening on a socket as an editor that loads a
+// buffer with far more highlights than the socket can hold and then never reads
+// them, and checks that a second editor still hears back, rather than waiting
+// behind the first.
+static void check_stalled() {
+  static const int REPLY_TIMEOUT_MILLISECONDS = 10000;
+  string socket_path = "/tmp/i7-check-" + to_string(getpid()) + ".socket";
+  pid_t server = fork();
+  if (!server) {
+    execl("./i7-highlighter", "./i7-highlighter", "--listen", socket_path.c_str(), static_cast<char*>(nullptr));
+    _exit(127);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+  int connections[2];
+  for (int&connection : connections) {
+    connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    // The first connection has to wait for the server to come up.
+    for (unsigned attempt = 0; connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)); ++attempt) {
+      if (attempt == REPLY_TIMEOUT_MILLISECONDS) {
+	expect(false, "stalled", "cannot connect to " + socket_path);
+	kill(server, SIGTERM);
+	waitpid(server, nullptr, 0);
+	return;
+      }
+      usleep(1000);
+    }
+  }
+  i7_string text;
+  while (text.size() < (1 << 18)) {
+    text += encode("Say \"[the lamp] is [if lit]lit[end if].\"\n");
+  }
+  expect(write_all(connections[0], open_session(text)), "stalled", "sending to the editor that never reads");
+  // Only speak up once the server is busy sending to the first editor, so that
+  // it cannot answer the second one first.
+  pollfd descriptor{connections[0], POLLIN, 0};
+  expect(poll(&descriptor, 1, REPLY_TIMEOUT_MILLISECONDS) == 1, "stalled", "the first editor's first reply");
+  usleep(100000);
+  expect(write_all(connections[1], open_session(encode(SAMPLE_TEXT))), "stalled", "sending to the second editor");
+  descriptor.fd = connections[1];
+  expect(poll(&descriptor, 1, REPLY_TIMEOUT_MILLISECONDS) == 1, "stalled", "the second editor's first reply");
+  kill(server, SIGTERM);
+  waitpid(server, nullptr, 0);
+  for (int connection : connections) {
+    close(connection);
+  }
+  unlink(socket_path.c_str());
+}
+
+namespace {
+  struct check {
+    const char*name;
+    void (*run)();
+  };
+}
+
+static const check CHECKS[] = {
+  {"cancel", check_cancel},
+  {"typing", check_typing},
+  {"edits", check_edits},
+  {"stalled", check_stalled},
+};
+
+int main(int argc, char**argv) {
+  session = new typename ::session{*new typename ::grammar{}};
+  for (unsigned i = 0; i < ALL_HIGHLIGHT_CODE_COUNT; ++i) {
+    session->support_highlight_code(ALL_HIGHLIGHT_CODES[i]);
+  }
+  for (const check&candidate : CHECKS) {
+    bool selected = (argc < 2);
+    for (int i = 1; i < argc; ++i) {
+      selected |= !strcmp(argv[i], candidate.name);
+    }
+    if (selected) {
+      unsigned previous_failure_count = failure_count;
+      candidate.run();
+      printf("%-12s %s\n", candidate.name, failure_count == previous_failure_count ? "ok" : "FAILED");
+    }
+  }
+  return failure_count ? 1 : 0;
+}
+
+// Stand-ins for io.cpp, which write nothing but the highlights that the checks
+// compare; has_pending_input is how the checks make parsing give way.
+
+bool has_pending_input() {
+  if (polls_before_input == numeric_limits<unsigned>::max()) {
+    return false;
+  }
+  if (!polls_before_input) {
+    return true;
+  }
+  --polls_before_input;
+  return false;
+}
+
+void remove_highlights(unsigned buffer_number, unsigned beginning, unsigned end) {}
+void add_highlight(unsigned buffer_number, unsigned beginning, unsigned end, ::highlight_code highlight_code) {}
+void replace_highlights(unsigned buffer_number, unsigned beginning, unsigned end, const vector<highlight_run>&runs) {
+  vector<pair<unsigned, unsigned>>changed_stretches;
+  editor_highlights[buffer_number].update(beginning, end, runs, changed_stretches);
+}
+void remove_warnings(unsigned buffer_number, unsigned beginning, unsigned end) {}
+void add_warning(unsigned buffer_number, unsigned beginning, unsigned end) {}
+void remove_errors(unsigned buffer_number, unsigned beginning, unsigned end) {}
+void add_error(unsigned buffer_number, unsigned beginning, unsigned end) {}
+void remove_hovertexts(unsigned buffer_number, unsigned beginning, unsigned end) {}
+void add_hovertext(unsigned buffer_number, unsigned beginning, unsigned end, const i7_string&hovertext) {}
+
+void remove_emphasis(unsigned view_number, unsigned beginning, unsigned end) {}
+void add_emphasis(unsigned view_number, unsigned beginning, unsigned end) {}
+void clear_suggestions(unsigned view_number) {}
+void make_suggestions(unsigned view_number, const i7_string&suggestion) {}
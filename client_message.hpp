@@ -0,0 +1,40 @@
+#ifndef CLIENT_MESSAGE_HEADER
+#define CLIENT_MESSAGE_HEADER
+
+#include <chrono>
+#include <cstdint>
+
+#include "codepoints.hpp"
+
+struct client_connection;
+
+enum client_message_problem {
+  NO_PROBLEM,
+  // The command is unknown and, because messages are not framed, could not be
+  // skipped.
+  UNRECOGNIZED_COMMAND,
+  // The message overran its stated length.
+  MALFORMED_COMMAND
+};
+
+// One message from the client (see protocol.hpp), decoded by the reader thread
+// and handed to the thread that does the actual work.
+//
+// The numeric fields are stored in arguments in the order that protocol.hpp
+// lists them, and a string field, if any, in text.  For the negotiation
+// messages, CLIENT_REQUEST_PROTOCOL_VERSION and CLIENT_REQUEST_WIRE_ENCODING,
+// the argument is what the server agreed to rather than what the client asked
+// for, because the reader has to act on the agreement before it can decode the
+// next message.
+struct client_message {
+  // The editor connection that the message arrived on.
+  client_connection*			connection;
+  uint32_t				command;
+  uint32_t				arguments[3];
+  i7_string				text;
+  client_message_problem		problem;
+  // When the reader finished decoding the message.
+  std::chrono::steady_clock::time_point	arrival_time;
+};
+
+#endif
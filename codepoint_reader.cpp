@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "codepoint_reader.hpp"
+#include "protocol.hpp"
+#include "utf8.hpp"
+
+using namespace std;
+
+static const size_t INITIAL_RING_SIZE = 1 << 16;
+// Don't bother reading unless at least this many words will fit.
+static const size_t MINIMUM_READ_SIZE = 1 << 12;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static const bool HOST_IS_BIG_ENDIAN = true;
+#else
+static const bool HOST_IS_BIG_ENDIAN = false;
+#endif
+
+void swap_codepoint_byte_order(i7_codepoint*beginning, i7_codepoint*end) {
+#ifdef __SSE2__
+  for (; end - beginning >= 4; beginning += 4) {
+    __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(beginning));
+    // Swap the bytes within each half-word, then swap the half-words.
+    words = _mm_or_si128(_mm_slli_epi16(words, 8), _mm_srli_epi16(words, 8));
+    words = _mm_shufflelo_epi16(words, _MM_SHUFFLE(2, 3, 0, 1));
+    words = _mm_shufflehi_epi16(words, _MM_SHUFFLE(2, 3, 0, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(beginning), words);
+  }
+#endif
+  for (; beginning != end; ++beginning) {
+    *beginning = __builtin_bswap32(*beginning);
+  }
+}
+
+codepoint_reader::codepoint_reader(int file_descriptor) :
+  file_descriptor{file_descriptor},
+  closed{false},
+  endianness_undetermined{true},
+  flip_endianness{false},
+  swap_bytes{!HOST_IS_BIG_ENDIAN},
+  ring(INITIAL_RING_SIZE),
+  read_position{0},
+  decoded_end{0},
+  filled_bytes{0},
+  consumed_count{0},
+  encoding{WIRE_ENCODING_UCS_4},
+  byte_position{0} {}
+
+void codepoint_reader::determine_endianness() {
+  assert(filled_bytes >= sizeof(i7_codepoint) * (decoded_end + 1));
+  uint32_t first = ring[decoded_end];
+  if (swap_bytes) {
+    first = __builtin_bswap32(first);
+  }
+  endianness_undetermined = false;
+  flip_endianness = (first > 0xFFFF);
+  swap_bytes = (HOST_IS_BIG_ENDIAN == flip_endianness);
+}
+
+void codepoint_reader::slide() {
+  size_t consumed_bytes = (encoding == WIRE_ENCODING_UTF_8) ? byte_position : sizeof(i7_codepoint) * read_position;
+  if (!consumed_bytes) {
+    return;
+  }
+  char*bytes = reinterpret_cast<char*>(ring.data());
+  memmove(bytes, bytes + consumed_bytes, filled_bytes - consumed_bytes);
+  filled_bytes -= consumed_bytes;
+  if (encoding == WIRE_ENCODING_UTF_8) {
+    byte_position = 0;
+  } else {
+    decoded_end -= read_position;
+    read_position = 0;
+  }
+}
+
+void codepoint_reader::make_room() {
+  if (ring.size() - filled_bytes / sizeof(i7_codepoint) >= MINIMUM_READ_SIZE) {
+    return;
+  }
+  slide();
+  if (ring.size() - filled_bytes / sizeof(i7_codepoint) < MINIMUM_READ_SIZE) {
+    ring.resize(2 * ring.size());
+  }
+}
+
+bool codepoint_reader::fill() {
+  if (closed) {
+    return false;
+  }
+  size_t previous_decoded_end = decoded_end;
+  size_t previous_filled_bytes = filled_bytes;
+  while (encoding == WIRE_ENCODING_UTF_8 ? filled_bytes == previous_filled_bytes : decoded_end == previous_decoded_end) {
+    make_room();
+    char*bytes = reinterpret_cast<char*>(ring.data());
+    ssize_t count = read(file_descriptor, bytes + filled_bytes, sizeof(i7_codepoint) * ring.size() - filled_bytes);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      closed = true;
+      return false;
+    }
+    filled_bytes += static_cast<size_t>(count);
+    if (encoding == WIRE_ENCODING_UTF_8) {
+      continue;
+    }
+    size_t complete_end = filled_bytes / sizeof(i7_codepoint);
+    if (complete_end == decoded_end) {
+      continue;
+    }
+    if (endianness_undetermined) {
+      determine_endianness();
+    }
+    if (swap_bytes) {
+      swap_codepoint_byte_order(ring.data() + decoded_end, ring.data() + complete_end);
+    }
+    decoded_end = complete_end;
+  }
+  return true;
+}
+
+bool codepoint_reader::is_closed() const {
+  return closed;
+}
+
+bool codepoint_reader::flips_endianness() const {
+  return flip_endianness;
+}
+
+void codepoint_reader::set_encoding(uint32_t encoding) {
+  if (encoding == this->encoding) {
+    return;
+  }
+  // Only the switch away from UCS-4 is supported.  The words already decoded
+  // but not yet read are really bytes in the new encoding, so restore their
+  // original order.
+  assert(this->encoding == WIRE_ENCODING_UCS_4 && encoding == WIRE_ENCODING_UTF_8);
+  if (swap_bytes) {
+    swap_codepoint_byte_order(ring.data() + read_position, ring.data() + decoded_end);
+  }
+  byte_position = sizeof(i7_codepoint) * read_position;
+  read_position = decoded_end = 0;
+  this->encoding = encoding;
+}
+
+bool codepoint_reader::has_buffered_input() const {
+  if (encoding == WIRE_ENCODING_UTF_8) {
+    return byte_position != filled_bytes;
+  }
+  return read_position != decoded_end;
+}
+
+bool codepoint_reader::has_pending_input() const {
+  if (has_buffered_input() || closed) {
+    return true;
+  }
+  pollfd descriptor{file_descriptor, POLLIN, 0};
+  return poll(&descriptor, 1, 0) > 0;
+}
+
+uint64_t codepoint_reader::get_consumed_count() const {
+  return consumed_count;
+}
+
+uint32_t codepoint_reader::read_varint() {
+  const unsigned char*bytes = reinterpret_cast<const unsigned char*>(ring.data());
+  uint32_t result = 0;
+  for (unsigned shift = 0;; shift += 7) {
+    if (byte_position == filled_bytes) {
+      if (!fill()) {
+	return CLIENT_END_SESSION;
+      }
+      bytes = reinterpret_cast<const unsigned char*>(ring.data());
+    }
+    unsigned char byte = bytes[byte_position++];
+    ++consumed_count;
+    if (shift < 32) {
+      result |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    }
+    if (!(byte & 0x80)) {
+      return result;
+    }
+  }
+}
+
+i7_string_view codepoint_reader::read_utf8_string(i7_string&result) {
+  size_t length = 0;
+  for (;;) {
+    const char*beginning = reinterpret_cast<const char*>(ring.data()) + byte_position;
+    const char*terminator = static_cast<const char*>(memchr(beginning + length, 0, filled_bytes - byte_position - length));
+    if (terminator) {
+      length = static_cast<size_t>(terminator - beginning);
+      decode_utf8(beginning, terminator, result);
+      byte_position += length + 1;
+      consumed_count += length + 1;
+      return result;
+    }
+    length = filled_bytes - byte_position;
+    if (!fill()) {
+      beginning = reinterpret_cast<const char*>(ring.data()) + byte_position;
+      decode_utf8(beginning, beginning + length, result);
+      byte_position += length;
+      consumed_count += length;
+      return result;
+    }
+  }
+}
+
+uint32_t codepoint_reader::read_codepoint() {
+  if (encoding == WIRE_ENCODING_UTF_8) {
+    return read_varint();
+  }
+  if (read_position == decoded_end && !fill()) {
+    return CLIENT_END_SESSION;
+  }
+  ++consumed_count;
+  return ring[read_position++];
+}
+
+i7_string_view codepoint_reader::read_string() {
+  if (encoding == WIRE_ENCODING_UTF_8) {
+    return read_utf8_string(decoded);
+  }
+  // Positions are kept as offsets from read_position, since filling may slide
+  // the ring's contents.
+  size_t length = 0;
+  for (;;) {
+    const i7_codepoint*beginning = ring.data() + read_position;
+    const i7_codepoint*end = ring.data() + decoded_end;
+    const i7_codepoint*terminator = std::find(beginning + length, end, 0);
+    length = static_cast<size_t>(terminator - beginning);
+    if (terminator != end) {
+      read_position += length + 1;
+      consumed_count += length + 1;
+      return {beginning, length};
+    }
+    if (!fill()) {
+      // The input ended mid-string; return what arrived, as the terminator
+      // would have been the end-of-session codepoint anyway.
+      read_position = decoded_end;
+      consumed_count += length;
+      return {ring.data() + decoded_end - length, length};
+    }
+  }
+}
+
+i7_string_view codepoint_reader::read_utf8_codepoints(size_t count, i7_string&result) {
+  while (filled_bytes - byte_position < count) {
+    if (!fill()) {
+      count = filled_bytes - byte_position;
+      break;
+    }
+  }
+  const char*beginning = reinterpret_cast<const char*>(ring.data()) + byte_position;
+  decode_utf8(beginning, beginning + count, result);
+  byte_position += count;
+  consumed_count += count;
+  return result;
+}
+
+i7_string_view codepoint_reader::read_codepoints(size_t count) {
+  // The ring only grows as the string arrives, since the count comes from the
+  // client and may promise more than it sends.
+  if (encoding == WIRE_ENCODING_UTF_8) {
+    return read_utf8_codepoints(count, decoded);
+  }
+  while (decoded_end - read_position < count) {
+    if (!fill()) {
+      count = decoded_end - read_position;
+      break;
+    }
+  }
+  const i7_codepoint*beginning = ring.data() + read_position;
+  read_position += count;
+  consumed_count += count;
+  return {beginning, count};
+}
+
+void codepoint_reader::read_string(i7_string&result) {
+  if (encoding == WIRE_ENCODING_UTF_8) {
+    read_utf8_string(result);
+    return;
+  }
+  i7_string_view view = read_string();
+  result.assign(view.begin(), view.end());
+}
+
+void codepoint_reader::read_codepoints(size_t count, i7_string&result) {
+  if (encoding == WIRE_ENCODING_UTF_8) {
+    read_utf8_codepoints(count, result);
+    return;
+  }
+  i7_string_view view = read_codepoints(count);
+  result.assign(view.begin(), view.end());
+}
+
+void codepoint_reader::skip_codepoints(size_t count) {
+  for (;;) {
+    size_t skipped = min(count, (encoding == WIRE_ENCODING_UTF_8) ? filled_bytes - byte_position : decoded_end - read_position);
+    if (encoding == WIRE_ENCODING_UTF_8) {
+      byte_position += skipped;
+    } else {
+      read_position += skipped;
+    }
+    consumed_count += skipped;
+    count -= skipped;
+    if (!count || !fill()) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,99 @@
+#ifndef CODEPOINT_READER_HEADER
+#define CODEPOINT_READER_HEADER
+
+#include <cstdint>
+#include <vector>
+
+#include "codepoints.hpp"
+
+// A codepoint_reader decodes the codepoint stream that the client sends (see
+// protocol.hpp) from a file descriptor.  Rather than pulling bytes through
+// stdio one at a time, it reads large blocks into a ring buffer of words and
+// converts every complete word to native byte order in a single pass as soon
+// as the block arrives, so that the per-codepoint cost of reading is an index
+// increment.
+//
+// Strings are returned as views into the ring.  To keep those views contiguous,
+// the ring never wraps in the middle of unread data; instead, when the space
+// after the unread words runs out, they are slid back to the front (or, if the
+// ring is full of a single unterminated string, the ring is grown).  A view is
+// therefore only valid until the next call to one of the read methods.
+//
+// As in the original protocol implementation, the byte order is detected from
+// the first codepoint: the stream is big-endian unless that codepoint only
+// makes sense read the other way around, in which case flips_endianness()
+// becomes true.
+//
+// After the client negotiates the UTF-8 wire encoding, the ring holds raw
+// bytes instead: words are read as varints, and strings are decoded into a
+// scratch string that the returned views point into.  Counts, both of consumed
+// input and of read_codepoints(), are then in bytes rather than words.
+class codepoint_reader {
+protected:
+  int file_descriptor;
+  bool closed;
+  bool endianness_undetermined;
+  bool flip_endianness;
+  bool swap_bytes;
+  std::vector<i7_codepoint> ring;
+  // Words before read_position have been consumed, words in [read_position,
+  // decoded_end) are decoded and waiting, and the filled_bytes - 4 *
+  // decoded_end bytes after that are a partially received word.
+  size_t read_position;
+  size_t decoded_end;
+  size_t filled_bytes;
+  // The number of words (or, in UTF-8, bytes) read so far, counting string
+  // terminators.
+  uint64_t consumed_count;
+  // The wire encoding in use, and, for UTF-8, the read position in bytes.
+  uint32_t encoding;
+  size_t byte_position;
+  i7_string decoded;
+
+  void determine_endianness();
+  void slide();
+  void make_room();
+  // Blocks until at least one more word is decoded (or, in UTF-8, one more byte
+  // arrives); returns false if the input ends first.
+  bool fill();
+
+  uint32_t read_varint();
+  // Decode into result and return a view of it.
+  i7_string_view read_utf8_string(i7_string&result);
+  i7_string_view read_utf8_codepoints(size_t count, i7_string&result);
+
+public:
+  codepoint_reader(int file_descriptor);
+
+  bool is_closed() const;
+  bool flips_endianness() const;
+  // Switches from UCS-4 to the given wire encoding for everything after the
+  // codepoints read so far.
+  void set_encoding(uint32_t encoding);
+  // True if a decoded codepoint is already waiting in the ring.
+  bool has_buffered_input() const;
+  // True if the next read will not block, either because input is buffered or
+  // because the file descriptor already has more (or has reached its end).
+  bool has_pending_input() const;
+  uint64_t get_consumed_count() const;
+
+  // Returns CLIENT_END_SESSION once the input is exhausted.
+  uint32_t read_codepoint();
+  // Reads a null-terminated string, returning it without the terminator.
+  i7_string_view read_string();
+  // Reads a string of known length.  The view is shorter than requested only if
+  // the input ends first.
+  i7_string_view read_codepoints(size_t count);
+  // The same as the two above, but store the string in result, which, unlike a
+  // view, outlives the next read.  Under UTF-8 it is decoded straight there.
+  void read_string(i7_string&result);
+  void read_codepoints(size_t count, i7_string&result);
+  // Discards count codepoints (or, in UTF-8, bytes) as they arrive, without
+  // holding them all in the ring at once.
+  void skip_codepoints(size_t count);
+};
+
+// Converts a run of words from one byte order to the other in place.
+void swap_codepoint_byte_order(i7_codepoint*beginning, i7_codepoint*end);
+
+#endif
@@ -0,0 +1,134 @@
+#include <cerrno>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "codepoint_writer.hpp"
+#include "codepoint_reader.hpp"
+
+using namespace std;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static const bool HOST_IS_BIG_ENDIAN = true;
+#else
+static const bool HOST_IS_BIG_ENDIAN = false;
+#endif
+
+codepoint_writer::codepoint_writer(int file_descriptor, bool may_block) :
+  file_descriptor{file_descriptor},
+  may_block{may_block},
+  flip_endianness{false},
+  encoding{WIRE_ENCODING_UCS_4},
+  failed{false} {}
+
+void codepoint_writer::set_flip_endianness(bool flip_endianness) {
+  this->flip_endianness = flip_endianness;
+}
+
+void codepoint_writer::set_encoding(uint32_t encoding) {
+  flush();
+  this->encoding = encoding;
+}
+
+bool codepoint_writer::has_pending_output() const {
+  return !pending.empty() || !pending_bytes.empty();
+}
+
+bool codepoint_writer::has_unsent_output() const {
+  return !unsent_bytes.empty();
+}
+
+void codepoint_writer::write_string(const i7_string&string) {
+  if (encoding == WIRE_ENCODING_UTF_8) {
+    encode_utf8(string.data(), string.data() + string.size(), pending_bytes);
+    pending_bytes.push_back(0);
+  } else {
+    pending.insert(pending.end(), string.begin(), string.end());
+    pending.push_back(0);
+  }
+}
+
+void codepoint_writer::write_counted_string(const i7_string&string) {
+  size_t mark = begin_length_prefix();
+  if (encoding == WIRE_ENCODING_UTF_8) {
+    encode_utf8(string.data(), string.data() + string.size(), pending_bytes);
+  } else {
+    pending.insert(pending.end(), string.begin(), string.end());
+  }
+  end_length_prefix(mark);
+}
+
+size_t codepoint_writer::begin_length_prefix() {
+  if (encoding == WIRE_ENCODING_UTF_8) {
+    // The varint's width isn't known yet, so it is inserted afterward.
+    return pending_bytes.size();
+  }
+  pending.push_back(0);
+  return pending.size();
+}
+
+void codepoint_writer::end_length_prefix(size_t mark) {
+  if (encoding == WIRE_ENCODING_UTF_8) {
+    string length;
+    encode_varint(static_cast<uint32_t>(pending_bytes.size() - mark), length);
+    pending_bytes.insert(mark, length);
+  } else {
+    pending[mark - 1] = static_cast<i7_codepoint>(pending.size() - mark);
+  }
+}
+
+bool codepoint_writer::flush() {
+  if (failed) {
+    pending.clear();
+    pending_bytes.clear();
+    return false;
+  }
+  if (!has_pending_output() && !has_unsent_output()) {
+    return true;
+  }
+  const char*bytes;
+  size_t remaining;
+  if (encoding == WIRE_ENCODING_UTF_8) {
+    bytes = pending_bytes.data();
+    remaining = pending_bytes.size();
+  } else {
+    if (HOST_IS_BIG_ENDIAN == flip_endianness) {
+      swap_codepoint_byte_order(pending.data(), pending.data() + pending.size());
+    }
+    bytes = reinterpret_cast<const char*>(pending.data());
+    remaining = sizeof(i7_codepoint) * pending.size();
+  }
+  if (!may_block) {
+    // Later output has to queue behind any backlog.
+    unsent_bytes.append(bytes, remaining);
+    bytes = unsent_bytes.data();
+    remaining = unsent_bytes.size();
+  }
+  while (remaining) {
+    ssize_t count = may_block ?
+      write(file_descriptor, bytes, remaining) :
+      send(file_descriptor, bytes, remaining, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count < 0 && !may_block && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (count <= 0) {
+      failed = true;
+      break;
+    }
+    bytes += count;
+    remaining -= static_cast<size_t>(count);
+  }
+  if (!may_block) {
+    unsent_bytes.erase(0, unsent_bytes.size() - remaining);
+    failed |= (unsent_bytes.size() > MAXIMUM_UNSENT_BYTES);
+  }
+  pending.clear();
+  pending_bytes.clear();
+  if (failed) {
+    unsent_bytes.clear();
+    unsent_bytes.shrink_to_fit();
+  }
+  return !failed;
+}
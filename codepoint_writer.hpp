@@ -0,0 +1,85 @@
+#ifndef CODEPOINT_WRITER_HEADER
+#define CODEPOINT_WRITER_HEADER
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "codepoints.hpp"
+#include "protocol.hpp"
+#include "utf8.hpp"
+
+// A codepoint_writer encodes the server's side of the codepoint stream (see
+// protocol.hpp).  Messages accumulate in a contiguous buffer in native byte
+// order, and only when flush() is called are they converted to the client's
+// byte order in one pass and handed to the file descriptor with a single
+// write() (or as few as the descriptor will accept).  The command loop flushes
+// once per batch of client commands rather than once per message, which keeps
+// the number of system calls and client wakeups down while the author types.
+//
+// In the UTF-8 wire encoding, the pending output is kept as bytes instead, with
+// words written as varints.
+//
+// A writer to a socket shared with other editors never blocks: whatever the
+// socket will not take yet is kept, already encoded, for the next flush, so
+// that an editor that stops reading stalls only its own output.  Once that
+// backlog passes MAXIMUM_UNSENT_BYTES, the writer gives up on the editor.
+class codepoint_writer {
+public:
+  static const size_t MAXIMUM_UNSENT_BYTES = 1 << 24;
+
+protected:
+  int file_descriptor;
+  bool may_block;
+  bool flip_endianness;
+  uint32_t encoding;
+  std::vector<i7_codepoint> pending;
+  std::string pending_bytes;
+  // Encoded output that a nonblocking flush could not hand off yet.
+  std::string unsent_bytes;
+  // True once the descriptor has refused output or the backlog has grown too
+  // long, after which everything written is discarded.
+  bool failed;
+
+public:
+  // A writer that may not block must write to a socket.
+  codepoint_writer(int file_descriptor, bool may_block = true);
+
+  // Sets whether the client expects little-endian rather than big-endian
+  // words; see codepoint_reader::flips_endianness().
+  void set_flip_endianness(bool flip_endianness);
+  // Flushes, and then switches to the given wire encoding for everything
+  // written afterward.
+  void set_encoding(uint32_t encoding);
+
+  bool has_pending_output() const;
+  // True if a nonblocking flush left output behind for the next one.
+  bool has_unsent_output() const;
+
+  void write_codepoint(uint32_t codepoint) {
+    if (encoding == WIRE_ENCODING_UTF_8) {
+      encode_varint(codepoint, pending_bytes);
+    } else {
+      pending.push_back(static_cast<i7_codepoint>(codepoint));
+    }
+  }
+  // Writes a null-terminated string.
+  void write_string(const i7_string&string);
+  // Writes a string preceded by its length.
+  void write_counted_string(const i7_string&string);
+
+  // Marks the beginning of output that is to be preceded by its length, as
+  // when a message's length is only known once the message has been written.
+  // The length, in words (or, in UTF-8, bytes), is filled in by
+  // end_length_prefix, which must be called before the next flush.
+  size_t begin_length_prefix();
+  void end_length_prefix(size_t mark);
+
+  // Hands all pending output to the file descriptor, blocking until it is taken
+  // or, for a writer that may not block, keeping what the socket will not take
+  // yet.  Returns false if the descriptor refuses output or the backlog is too
+  // long.
+  bool flush();
+};
+
+#endif
@@ -1,3 +1,9 @@
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "codepoints.hpp"
 
 using namespace std;
@@ -7,124 +13,270 @@ string ASSUME_EIGHT_BIT(const i7_string&text) {
 }
 
 // See Unicode 6.0, Chapter 4.6.
-bool is_i7_whitespace(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case 0x0009:
-  case 0x000A:
-  case 0x000B:
-  case 0x000C:
-  case 0x000D:
-  case 0x0020:
-  case 0x007C: // `|', an Inform 7 paragraph break.
-  case 0x0085:
-  case 0x00A0:
-  case 0x1680:
-  case 0x180E:
-  case 0x2000:
-  case 0x2001:
-  case 0x2002:
-  case 0x2003:
-  case 0x2004:
-  case 0x2005:
-  case 0x2006:
-  case 0x2007:
-  case 0x2008:
-  case 0x2009:
-  case 0x200A:
-  case 0x2028:
-  case 0x2029:
-  case 0x202F:
-  case 0x205F:
-  case 0x3000:
-    return true;
-  default:
-    return false;
-  }
+static constexpr bool is_unicode_whitespace_or_paragraph_break(i7_codepoint codepoint) {
+  return
+    (0x0009 <= codepoint && codepoint <= 0x000D) ||
+    codepoint == 0x0020 ||
+    codepoint == 0x007C || // `|', an Inform 7 paragraph break.
+    codepoint == 0x0085 ||
+    codepoint == 0x00A0 ||
+    codepoint == 0x1680 ||
+    codepoint == 0x180E ||
+    (0x2000 <= codepoint && codepoint <= 0x200A) ||
+    codepoint == 0x2028 ||
+    codepoint == 0x2029 ||
+    codepoint == 0x202F ||
+    codepoint == 0x205F ||
+    codepoint == 0x3000;
 }
 
-bool is_i7_punctuation(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case 0x0021:
-  case 0x0022:
-  case 0x0027:
-  case 0x0028:
-  case 0x0029:
-  case 0x002A:
-  case 0x002B:
-  case 0x002D:
-  case 0x002E:
-  case 0x003A:
-  case 0x003B:
-  case 0x005B:
-  case 0x005C:
-  case 0x005D:
-    return true;
-  default:
-    return false;
-  }
+static constexpr bool is_delimiter_punctuation(i7_codepoint codepoint) {
+  return
+    (0x0021 <= codepoint && codepoint <= 0x0022) ||
+    (0x0027 <= codepoint && codepoint <= 0x002B) ||
+    (0x002D <= codepoint && codepoint <= 0x002E) ||
+    (0x003A <= codepoint && codepoint <= 0x003B) ||
+    (0x005B <= codepoint && codepoint <= 0x005D);
 }
 
-bool is_i7_letter(i7_codepoint codepoint) {
-  return !is_i7_whitespace(codepoint) && !is_i7_punctuation(codepoint) && codepoint != TERMINATOR_CODEPOINT;
+// The letters of DOCUMENTATION.
+static constexpr bool is_documentation_letter(i7_codepoint codepoint) {
+  return
+    codepoint == 'A' || codepoint == 'C' || codepoint == 'D' || codepoint == 'E' || codepoint == 'I' ||
+    codepoint == 'M' || codepoint == 'N' || codepoint == 'O' || codepoint == 'T' || codepoint == 'U';
 }
 
-bool is_i7_digit(i7_codepoint codepoint) {
-  return ('0' <= codepoint) && (codepoint <= '9');
+// This bit gotten by trawling the internet until I found ni's @<Return Unicode
+// fancy equivalents as simpler literals@>, and then rewritten as a constant
+// expression so that the class table can record which codepoints it changes.
+static constexpr i7_codepoint compute_i7_normalization(i7_codepoint codepoint) {
+  return
+    (codepoint == 0x85 || codepoint == 0x2028 || codepoint == 0x2029) ? '\n' :
+    (codepoint == 0xA0 || (0x2000 <= codepoint && codepoint <= 0x200A)) ? ' ' :
+    (0x2010 <= codepoint && codepoint <= 0x2014) ? '-' :
+    (codepoint == 0x2018 || codepoint == 0x2019) ? '\'' :
+    (codepoint == 0x201C || codepoint == 0x201D) ? '"' :
+    codepoint;
 }
 
-bool is_i7_lexical_delimiter_letter(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case 'D':
-  case 'O':
-  case 'C':
-  case 'U':
-  case 'M':
-  case 'E':
-  case 'N':
-  case 'T':
-  case 'A':
-  case 'I':
-    return true;
-  default:
-    return false;
-  }
+static constexpr uint8_t compute_i7_normalized_codepoint_class(i7_codepoint codepoint) {
+  return
+    codepoint == TERMINATOR_CODEPOINT ? I7_TERMINATOR :
+    is_unicode_whitespace_or_paragraph_break(codepoint) ? I7_WHITESPACE :
+    is_delimiter_punctuation(codepoint) ? I7_PUNCTUATION :
+    I7_LETTER |
+    (('0' <= codepoint && codepoint <= '9') ? I7_DIGIT : 0) |
+    (is_documentation_letter(codepoint) ? I7_LEXICAL_DELIMITER_LETTER : 0);
 }
 
-// This bit gotten by trawling the internet until I found ni's @<Return Unicode
-// fancy equivalents as simpler literals@>, and then adjusted it to use a switch
-// and therefore return slightly faster in the common case.
+// Codepoints are classified as what they normalize to.
+static constexpr uint8_t compute_i7_codepoint_class(i7_codepoint codepoint) {
+  return compute_i7_normalized_codepoint_class(compute_i7_normalization(codepoint)) | (compute_i7_normalization(codepoint) != codepoint ? I7_NORMALIZED : 0);
+}
+
+// Only a handful of pages hold anything but letters.  Page 0 of the table is
+// all letters and is shared by every other page.
+static constexpr i7_codepoint DISTINCT_PAGE_BEGINNINGS[] = {
+  0x0000,
+  0x0000,
+  0x1600,
+  0x1800,
+  0x2000,
+  0x3000,
+  0xFF00
+};
+static const unsigned DISTINCT_PAGE_COUNT = sizeof(DISTINCT_PAGE_BEGINNINGS) / sizeof(*DISTINCT_PAGE_BEGINNINGS);
+
+static constexpr uint8_t compute_page_number(unsigned page) {
+  return
+    page == 0x00 ? 1 :
+    page == 0x16 ? 2 :
+    page == 0x18 ? 3 :
+    page == 0x20 ? 4 :
+    page == 0x30 ? 5 :
+    page == 0xFF ? 6 :
+    0;
+}
+
+static constexpr uint8_t compute_page_entry(unsigned index) {
+  return (index >> I7_CODEPOINT_CLASS_PAGE_BITS) ?
+    compute_i7_codepoint_class(DISTINCT_PAGE_BEGINNINGS[index >> I7_CODEPOINT_CLASS_PAGE_BITS] + (index & I7_CODEPOINT_CLASS_PAGE_MASK)) :
+    I7_LETTER;
+}
+
+// C++11 constexpr functions cannot loop, so the tables are spelled out by
+// repeating an initializer over a range of indices.
+#define REPEAT_4(M, base) M((base)) M((base) + 1) M((base) + 2) M((base) + 3)
+#define REPEAT_16(M, base) REPEAT_4(M, (base)) REPEAT_4(M, (base) + 4) REPEAT_4(M, (base) + 8) REPEAT_4(M, (base) + 12)
+#define REPEAT_64(M, base) REPEAT_16(M, (base)) REPEAT_16(M, (base) + 16) REPEAT_16(M, (base) + 32) REPEAT_16(M, (base) + 48)
+#define REPEAT_256(M, base) REPEAT_64(M, (base)) REPEAT_64(M, (base) + 64) REPEAT_64(M, (base) + 128) REPEAT_64(M, (base) + 192)
+#define REPEAT_1024(M, base) REPEAT_256(M, (base)) REPEAT_256(M, (base) + 256) REPEAT_256(M, (base) + 512) REPEAT_256(M, (base) + 768)
+#define PAGE_NUMBER(page) compute_page_number(page),
+#define PAGE_ENTRY(index) compute_page_entry(index),
+
+static_assert(I7_CODEPOINT_LIMIT >> I7_CODEPOINT_CLASS_PAGE_BITS == 4 * 1024 + 256, "The page number table does not cover Unicode.");
+constexpr uint8_t I7_CODEPOINT_CLASS_PAGE_NUMBERS[I7_CODEPOINT_LIMIT >> I7_CODEPOINT_CLASS_PAGE_BITS] = {
+  REPEAT_1024(PAGE_NUMBER, 0)
+  REPEAT_1024(PAGE_NUMBER, 1024)
+  REPEAT_1024(PAGE_NUMBER, 2048)
+  REPEAT_1024(PAGE_NUMBER, 3072)
+  REPEAT_256(PAGE_NUMBER, 4096)
+};
+
+static_assert(DISTINCT_PAGE_COUNT == 7, "The page table does not cover the distinct pages.");
+constexpr uint8_t I7_CODEPOINT_CLASS_PAGES[][I7_CODEPOINT_CLASS_PAGE_MASK + 1] = {
+  {REPEAT_256(PAGE_ENTRY, 0)},
+  {REPEAT_256(PAGE_ENTRY, 256)},
+  {REPEAT_256(PAGE_ENTRY, 512)},
+  {REPEAT_256(PAGE_ENTRY, 768)},
+  {REPEAT_256(PAGE_ENTRY, 1024)},
+  {REPEAT_256(PAGE_ENTRY, 1280)},
+  {REPEAT_256(PAGE_ENTRY, 1536)}
+};
+
+#undef PAGE_ENTRY
+#undef PAGE_NUMBER
+#undef REPEAT_1024
+#undef REPEAT_256
+#undef REPEAT_64
+#undef REPEAT_16
+#undef REPEAT_4
+
 i7_codepoint i7_normalize(i7_codepoint codepoint) {
-  switch (codepoint) {
-    case 0x85:
-      return '\n';
-    case 0xA0:
-    case 0x2000:
-    case 0x2001:
-    case 0x2002:
-    case 0x2003:
-    case 0x2004:
-    case 0x2005:
-    case 0x2006:
-    case 0x2007:
-    case 0x2008:
-    case 0x2009:
-    case 0x200a:
-      return ' ';
-    case 0x2010:
-    case 0x2011:
-    case 0x2012:
-    case 0x2013:
-    case 0x2014:
-      return '-';
-    case 0x2018:
-    case 0x2019:
-      return '\'';
-    case 0x201c:
-    case 0x201d:
-      return '"';
-    case 0x2028:
-    case 0x2029:
-      return '\n';
+  if (get_i7_codepoint_class(codepoint) & I7_NORMALIZED) {
+    return compute_i7_normalization(codepoint);
   }
   return codepoint;
 }
+
+namespace {
+  // The vector tests compare unsigned ranges with signed comparisons, the only
+  // kind that SSE2 and AVX2 have for 32-bit lanes, by shifting both sides down
+  // by 2^31.
+#if defined(__AVX2__)
+  using codepoint_lanes = __m256i;
+  static const unsigned LANE_COUNT = 8;
+
+  inline codepoint_lanes load_lanes(const i7_codepoint*codepoints) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(codepoints));
+  }
+  inline unsigned get_lane_mask(codepoint_lanes lanes) {
+    return static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(lanes)));
+  }
+  inline codepoint_lanes lanes_in_range(codepoint_lanes lanes, uint32_t low, uint32_t count) {
+    codepoint_lanes biased = _mm256_sub_epi32(lanes, _mm256_set1_epi32(static_cast<int32_t>(low - 0x80000000u)));
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int32_t>(0x80000000u + count)), biased);
+  }
+  inline codepoint_lanes lanes_equal(codepoint_lanes lanes, uint32_t value) {
+    return _mm256_cmpeq_epi32(lanes, _mm256_set1_epi32(static_cast<int32_t>(value)));
+  }
+  inline codepoint_lanes lanes_or(codepoint_lanes left, codepoint_lanes right) {
+    return _mm256_or_si256(left, right);
+  }
+  inline codepoint_lanes lanes_with_bit(codepoint_lanes lanes, uint32_t bit) {
+    return _mm256_or_si256(lanes, _mm256_set1_epi32(static_cast<int32_t>(bit)));
+  }
+#elif defined(__SSE2__)
+  using codepoint_lanes = __m128i;
+  static const unsigned LANE_COUNT = 4;
+
+  inline codepoint_lanes load_lanes(const i7_codepoint*codepoints) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(codepoints));
+  }
+  inline unsigned get_lane_mask(codepoint_lanes lanes) {
+    return static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(lanes)));
+  }
+  inline codepoint_lanes lanes_in_range(codepoint_lanes lanes, uint32_t low, uint32_t count) {
+    codepoint_lanes biased = _mm_sub_epi32(lanes, _mm_set1_epi32(static_cast<int32_t>(low - 0x80000000u)));
+    return _mm_cmplt_epi32(biased, _mm_set1_epi32(static_cast<int32_t>(0x80000000u + count)));
+  }
+  inline codepoint_lanes lanes_equal(codepoint_lanes lanes, uint32_t value) {
+    return _mm_cmpeq_epi32(lanes, _mm_set1_epi32(static_cast<int32_t>(value)));
+  }
+  inline codepoint_lanes lanes_or(codepoint_lanes left, codepoint_lanes right) {
+    return _mm_or_si128(left, right);
+  }
+  inline codepoint_lanes lanes_with_bit(codepoint_lanes lanes, uint32_t bit) {
+    return _mm_or_si128(lanes, _mm_set1_epi32(static_cast<int32_t>(bit)));
+  }
+#endif
+
+  struct alphanumeric {
+    // Setting bit 5 folds uppercase ASCII letters onto lowercase ones without
+    // moving anything else into either range.
+    static bool test(i7_codepoint codepoint) {
+      return ((codepoint | 0x20) - 'a' < 26) || (codepoint - '0' < 10);
+    }
+#if defined(__AVX2__) || defined(__SSE2__)
+    static codepoint_lanes test(codepoint_lanes lanes) {
+      return lanes_or(lanes_in_range(lanes_with_bit(lanes, 0x20), 'a', 26), lanes_in_range(lanes, '0', 10));
+    }
+#endif
+  };
+
+  struct ascii {
+    static bool test(i7_codepoint codepoint) {
+      return codepoint < 0x80;
+    }
+#if defined(__AVX2__) || defined(__SSE2__)
+    static codepoint_lanes test(codepoint_lanes lanes) {
+      return lanes_in_range(lanes, 0, 0x80);
+    }
+#endif
+  };
+
+  struct blank {
+    static bool test(i7_codepoint codepoint) {
+      return codepoint == ' ' || codepoint == '\t';
+    }
+#if defined(__AVX2__) || defined(__SSE2__)
+    static codepoint_lanes test(codepoint_lanes lanes) {
+      return lanes_or(lanes_equal(lanes, ' '), lanes_equal(lanes, '\t'));
+    }
+#endif
+  };
+}
+
+template<typename C>static const i7_codepoint*skip_codepoints(const i7_codepoint*beginning, const i7_codepoint*end) {
+#if defined(__AVX2__) || defined(__SSE2__)
+  static const unsigned ALL_LANES = (1u << LANE_COUNT) - 1;
+  for (; static_cast<size_t>(end - beginning) >= LANE_COUNT; beginning += LANE_COUNT) {
+    unsigned mask = get_lane_mask(C::test(load_lanes(beginning)));
+    if (mask != ALL_LANES) {
+      return beginning + __builtin_ctz(~mask);
+    }
+  }
+#endif
+  for (; beginning != end && C::test(*beginning); ++beginning);
+  return beginning;
+}
+
+const i7_codepoint*skip_alphanumeric_codepoints(const i7_codepoint*beginning, const i7_codepoint*end) {
+  return skip_codepoints<alphanumeric>(beginning, end);
+}
+
+const i7_codepoint*skip_blank_codepoints(const i7_codepoint*beginning, const i7_codepoint*end) {
+  return skip_codepoints<blank>(beginning, end);
+}
+
+const i7_codepoint*skip_ascii_codepoints(const i7_codepoint*beginning, const i7_codepoint*end) {
+  return skip_codepoints<ascii>(beginning, end);
+}
+
+uint32_t checksum_codepoints(const i7_string_view&text) {
+  static const uint32_t MODULUS = 65521;
+  // Codepoints are at most 0x10FFFF, so with 64-bit sums we only need to reduce
+  // once per block.
+  static const size_t BLOCK_LENGTH = 4096;
+  uint64_t a = 1, b = 0;
+  for (const i7_codepoint*block = text.begin(), *end = text.end(); block != end;) {
+    const i7_codepoint*block_end = block + (static_cast<size_t>(end - block) < BLOCK_LENGTH ? end - block : BLOCK_LENGTH);
+    for (; block != block_end; ++block) {
+      a += *block;
+      b += a;
+    }
+    a %= MODULUS;
+    b %= MODULUS;
+  }
+  return static_cast<uint32_t>((b << 16) | a);
+}
@@ -23,11 +23,15 @@
 // Finally, one of I7's goals is to account for idiosyncrasies that word
 // processors might introduce if used to edit the source text.  This header also
 // includes a function that reimplements its counter–word processor
-// normalization.  (But note that we don't normalize newlines—that could give us
-// a different codepoint count than our client, which would be all sorts of
-// headaches.  Instead, we tell the lexer how to tokenize line breaks according
-// to ni's feed_file_into_lexer.)
+// normalization, which maps smart quotes, dashes, and so on one for one onto
+// their plain equivalents, and codepoints are classified as what they normalize
+// to, so the lexer takes them for the plain ones without changing any text.
+// (But note that we don't normalize newlines—that could give us a different
+// codepoint count than our client, which would be all sorts of headaches.
+// Instead, we tell the lexer how to tokenize line breaks according to ni's
+// feed_file_into_lexer.)
 
+#include <cstdint>
 #include <string>
 #include <sstream>
 
@@ -35,17 +39,112 @@ using i7_codepoint = char32_t;
 using i7_string = std::u32string;
 using i7_string_stream = std::basic_stringstream<i7_codepoint>;
 
+// A read-only view of codepoints stored elsewhere, in the spirit of C++17's
+// std::u32string_view.  Views are only valid as long as their storage is, so
+// convert them with str() if they need to outlive it.
+class i7_string_view {
+protected:
+  const i7_codepoint*beginning;
+  size_t length;
+
+public:
+  i7_string_view() :
+    beginning{nullptr},
+    length{0} {}
+  i7_string_view(const i7_codepoint*beginning, size_t length) :
+    beginning{beginning},
+    length{length} {}
+  i7_string_view(const i7_string&string) :
+    beginning{string.data()},
+    length{string.size()} {}
+
+  const i7_codepoint*data() const {
+    return beginning;
+  }
+  size_t size() const {
+    return length;
+  }
+  bool empty() const {
+    return !length;
+  }
+  const i7_codepoint*begin() const {
+    return beginning;
+  }
+  const i7_codepoint*end() const {
+    return beginning + length;
+  }
+  i7_codepoint operator [](size_t index) const {
+    return beginning[index];
+  }
+
+  i7_string str() const {
+    return {beginning, length};
+  }
+};
+
 // 0xFFFF is one of the codepoints that Unicode reserves for an application's
 // internal use.
 static const i7_codepoint TERMINATOR_CODEPOINT = 0xFFFF;
 #define ENCODE(string_literal) U ## string_literal
 std::string ASSUME_EIGHT_BIT(const i7_string&text);
 
-bool is_i7_whitespace(i7_codepoint codepoint);
-bool is_i7_punctuation(i7_codepoint codepoint);
-bool is_i7_letter(i7_codepoint codepoint);
-bool is_i7_digit(i7_codepoint codepoint);
-bool is_i7_lexical_delimiter_letter(i7_codepoint codepoint);
+// The classification of every codepoint is precomputed as a set of bits, held
+// in a two-level table that is generated at compile time: the high bits of a
+// codepoint pick one of a few distinct pages, and the low bits an entry in that
+// page.  Anything past the end of Unicode is a letter.
+static const uint8_t I7_WHITESPACE = 0x01;
+static const uint8_t I7_PUNCTUATION = 0x02;
+static const uint8_t I7_LETTER = 0x04;
+static const uint8_t I7_DIGIT = 0x08;
+// The letters of DOCUMENTATION, as in a documentation break.
+static const uint8_t I7_LEXICAL_DELIMITER_LETTER = 0x10;
+static const uint8_t I7_TERMINATOR = 0x20;
+// Set if i7_normalize changes the codepoint; the other bits then describe what
+// it changes it to.
+static const uint8_t I7_NORMALIZED = 0x40;
+
+static const i7_codepoint I7_CODEPOINT_LIMIT = 0x110000;
+static const unsigned I7_CODEPOINT_CLASS_PAGE_BITS = 8;
+static const unsigned I7_CODEPOINT_CLASS_PAGE_MASK = (1 << I7_CODEPOINT_CLASS_PAGE_BITS) - 1;
+extern const uint8_t I7_CODEPOINT_CLASS_PAGE_NUMBERS[];
+extern const uint8_t I7_CODEPOINT_CLASS_PAGES[][I7_CODEPOINT_CLASS_PAGE_MASK + 1];
+
+inline uint8_t get_i7_codepoint_class(i7_codepoint codepoint) {
+  if (codepoint >= I7_CODEPOINT_LIMIT) {
+    return I7_LETTER;
+  }
+  return I7_CODEPOINT_CLASS_PAGES[I7_CODEPOINT_CLASS_PAGE_NUMBERS[codepoint >> I7_CODEPOINT_CLASS_PAGE_BITS]][codepoint & I7_CODEPOINT_CLASS_PAGE_MASK];
+}
+
+inline bool is_i7_whitespace(i7_codepoint codepoint) {
+  return get_i7_codepoint_class(codepoint) & I7_WHITESPACE;
+}
+inline bool is_i7_punctuation(i7_codepoint codepoint) {
+  return get_i7_codepoint_class(codepoint) & I7_PUNCTUATION;
+}
+inline bool is_i7_letter(i7_codepoint codepoint) {
+  return get_i7_codepoint_class(codepoint) & I7_LETTER;
+}
+inline bool is_i7_digit(i7_codepoint codepoint) {
+  return get_i7_codepoint_class(codepoint) & I7_DIGIT;
+}
+inline bool is_i7_lexical_delimiter_letter(i7_codepoint codepoint) {
+  return get_i7_codepoint_class(codepoint) & I7_LEXICAL_DELIMITER_LETTER;
+}
 i7_codepoint i7_normalize(i7_codepoint codepoint);
 
+// Return a pointer to the first codepoint in [beginning, end) that is not an
+// ASCII letter or digit, or, for the second function, not a space or a tab, or,
+// for the third, not ASCII at all, or end if there is none.  These are fast paths for the lexer's long runs, so
+// they look for a narrower class than I7 letters or whitespace, and scan
+// several codepoints at a time with SSE2 or AVX2 when the compiler targets
+// them.
+const i7_codepoint*skip_alphanumeric_codepoints(const i7_codepoint*beginning, const i7_codepoint*end);
+const i7_codepoint*skip_blank_codepoints(const i7_codepoint*beginning, const i7_codepoint*end);
+const i7_codepoint*skip_ascii_codepoints(const i7_codepoint*beginning, const i7_codepoint*end);
+
+// Adler-32, but over codepoints instead of bytes (see SERVER_FILE_LOADED in
+// protocol.hpp).
+uint32_t checksum_codepoints(const i7_string_view&text);
+
 #endif
@@ -4,6 +4,25 @@
 
 using namespace std;
 
+void context::begin_cancellable_propagation() {
+  propagation_is_cancellable = true;
+  propagation_was_cancelled = false;
+}
+
+bool context::end_cancellable_propagation() {
+  bool result = propagation_was_cancelled;
+  propagation_is_cancellable = false;
+  propagation_was_cancelled = false;
+  return result;
+}
+
+bool context::is_propagation_cancelled() {
+  if (propagation_is_cancellable && !propagation_was_cancelled) {
+    propagation_was_cancelled = should_cancel_propagation();
+  }
+  return propagation_was_cancelled;
+}
+
 void fact::justify() const {
   assert(is_observation());
   bool change = !operator bool();
@@ -10,8 +10,34 @@
  * state.
  */
 class context {
+protected:
+  bool					propagation_is_cancellable;
+  bool					propagation_was_cancelled;
+
+  /* Polled by is_propagation_cancelled; see begin_cancellable_propagation.
+   */
+  virtual bool should_cancel_propagation() const { return false; }
+
 public:
+  context() : propagation_is_cancellable{false}, propagation_was_cancelled{false} {}
   virtual ~context() {}
+
+  /* Between these two calls, code that justifies a series of observations may
+   * stop part way through the series, as soon as is_propagation_cancelled
+   * returns true.  Each observation's own propagation is always run to
+   * completion, since a true fact whose consequences had not all been deduced
+   * would later be unjustified as if they had, so the context is left
+   * consistent, only with some observations not yet justified.
+   * end_cancellable_propagation reports whether that happened, in which case
+   * the caller must eventually unjustify the observations that it did justify
+   * and start the series over.
+   */
+  void begin_cancellable_propagation();
+  bool end_cancellable_propagation();
+  /* Returns true if the caller should stop justifying observations, which, once
+   * cancellation has happened, stays true until end_cancellable_propagation.
+   */
+  bool is_propagation_cancelled();
 };
 
 /* A fact is equivalent to a predicate on a context; it always evaluates to true
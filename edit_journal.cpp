@@ -0,0 +1,63 @@
+#include <algorithm>
+
+#include "edit_journal.hpp"
+
+using namespace std;
+
+void edit_journal::clear() {
+  pending = false;
+  insertion.clear();
+}
+
+bool edit_journal::remove_codepoints(unsigned beginning, unsigned end) {
+  if (!pending) {
+    pending = true;
+    this->beginning = beginning;
+    this->end = end;
+    return true;
+  }
+  unsigned insertion_end = this->beginning + insertion.size();
+  if (beginning > insertion_end || end < this->beginning) {
+    return false;
+  }
+  unsigned overlap_beginning = max(beginning, this->beginning);
+  unsigned overlap_end = min(end, insertion_end);
+  insertion.erase(overlap_beginning - this->beginning, overlap_end - overlap_beginning);
+  // Text after the pending insertion is offset from its old position by the
+  // difference between the insertion's length and the length it replaced, and
+  // text before the insertion is where it always was.
+  if (end > insertion_end) {
+    this->end += end - insertion_end;
+  }
+  if (beginning < this->beginning) {
+    this->beginning = beginning;
+  }
+  return true;
+}
+
+bool edit_journal::add_codepoints(unsigned beginning, const i7_string_view&insertion) {
+  if (!pending) {
+    pending = true;
+    this->beginning = beginning;
+    this->end = beginning;
+    this->insertion.assign(insertion.begin(), insertion.end());
+    return true;
+  }
+  if (beginning < this->beginning || beginning > this->beginning + this->insertion.size()) {
+    return false;
+  }
+  this->insertion.insert(this->insertion.begin() + (beginning - this->beginning), insertion.begin(), insertion.end());
+  return true;
+}
+
+bool edit_journal::add_codepoints(unsigned beginning, i7_string&&insertion) {
+  if (pending) {
+    return add_codepoints(beginning, i7_string_view{insertion});
+  }
+  pending = true;
+  this->beginning = beginning;
+  this->end = beginning;
+  this->insertion.swap(insertion);
+  insertion.clear();
+  return true;
+}
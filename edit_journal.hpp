@@ -0,0 +1,55 @@
+#ifndef EDIT_JOURNAL_HEADER
+#define EDIT_JOURNAL_HEADER
+
+#include "codepoints.hpp"
+
+/*
+ * A record of edits to one buffer that have not yet been relexed.
+ *
+ * While the editor is still sending, typing, keyboard macros, and search and
+ * replace tend to produce runs of edits that touch or overlap one another.
+ * Rather than relex and rehighlight after each of them, the journal merges them
+ * into a single replacement: the codepoints [beginning, end) of the text as of
+ * the last relex have since become the codepoints of insertion.  An edit
+ * elsewhere cannot be merged, so the owner must apply the pending replacement
+ * first.
+ */
+class edit_journal {
+protected:
+  bool					pending;
+  unsigned				beginning;
+  unsigned				end;
+  i7_string				insertion;
+
+public:
+  edit_journal() :
+    pending{false},
+    beginning{0},
+    end{0} {}
+
+  bool is_pending() const {
+    return pending;
+  }
+  unsigned get_beginning() const {
+    return beginning;
+  }
+  unsigned get_end() const {
+    return end;
+  }
+  const i7_string&get_insertion() const {
+    return insertion;
+  }
+  void clear();
+
+  // These take indices into the current text, with all earlier edits applied,
+  // and return false, recording nothing, if the edit does not touch the pending
+  // replacement.
+  bool remove_codepoints(unsigned beginning, unsigned end);
+  bool add_codepoints(unsigned beginning, const i7_string_view&insertion);
+  // If nothing is pending, swaps the insertion into the journal rather than
+  // copying it, leaving the journal's old (empty) storage in its place, so that
+  // a whole file need not be copied on loading.
+  bool add_codepoints(unsigned beginning, i7_string&&insertion);
+};
+
+#endif
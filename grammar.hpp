@@ -0,0 +1,90 @@
+#ifndef GRAMMAR_HEADER
+#define GRAMMAR_HEADER
+
+#include <functional>
+#include <unordered_set>
+#include <unordered_map>
+
+#include "custom_multimap.hpp"
+#include "token.hpp"
+#include "monoid_sequence.hpp"
+#include "deduction.hpp"
+
+using token_sequence = monoid_sequence<token>;
+using token_iterator = typename token_sequence::iterator;
+
+class session;
+class parseme;
+class production;
+class subsentence;
+class wording;
+class sentence;
+class passage;
+class potential_match;
+
+// The productions that sessions parse with.  The grammar is built once, before
+// any session exists, and then shared by all of them, none of which can change
+// it, so that every editor connected to one server pays for it only once.
+class grammar : public context {
+protected:
+  using production_map = custom_multimap<const parseme*, const production*>;
+  using production_set = typename production_map::value_set_type;
+  std::unordered_set<const subsentence*>subsentences;
+  std::unordered_set<const wording*>	wordings;
+  std::unordered_set<const sentence*>	sentences;
+  std::unordered_set<const passage*>	passages;
+  production_map			productions_by_beginnings;
+  production_map			productions_by_results;
+  // The sessions parsing with the grammar, whose buffers a change to a
+  // production would affect.  Not part of the grammar proper.
+  mutable std::unordered_set<session*>	sessions;
+
+public:
+  grammar(); // Defined in language.cpp rather than grammar.cpp.
+  // Destructor intentionally omitted, as, at the moment, the only instance
+  // lives as long as the process and does not need to clean up.
+  // ~grammar();
+
+protected:
+  const production*add_production(const ::production&production);
+  const production*remove_production(const ::production&production);
+
+public:
+  const std::unordered_set<session*>&get_sessions() const;
+  void add_session(::session&session) const;
+  void remove_session(::session&session) const;
+
+  const std::unordered_set<const subsentence*>&get_subsentences() const;
+  const std::unordered_set<const wording*>&get_wordings() const;
+  const std::unordered_set<const sentence*>&get_sentences() const;
+  const std::unordered_set<const passage*>&get_passages() const;
+
+  void add_subsentence(const ::subsentence&subsentence);
+  void add_wording(const ::wording&wording);
+  void add_sentence(const ::sentence&sentence);
+  void add_passage(const ::passage&passage);
+
+  void remove_subsentence(const ::subsentence&subsentence);
+  void remove_wording(const ::wording&wording);
+  void remove_sentence(const ::sentence&sentence);
+  void remove_passage(const ::passage&passage);
+
+  const production_set&get_productions_beginning_with(const parseme*beginning) const;
+  const production_set&get_productions_resulting_in(const parseme*result) const;
+
+protected:
+  bool can_begin_descendant(const production*key, const production*root, std::unordered_set<const production*>&visited) const;
+  void get_additional_beginnings(const production*root, std::unordered_set<const production*>&visited) const;
+  void get_additional_beginnings_relying_on(const production*root, std::unordered_map<const production*, unsigned>&visited, const production&crux, const std::function<bool(const production*)>&exemption) const;
+  std::unordered_set<const production*>get_beginnings_relying_on(const production&crux, const std::function<bool(const production*)>&exemption) const;
+
+public:
+  bool can_begin_sentence_with(const production*key) const;
+  std::unordered_set<const production*>get_sentence_beginnings() const;
+  std::unordered_set<const production*>get_sentence_beginnings_relying_on(const production&crux) const;
+  std::unordered_set<const production*>get_result_beginnings_relying_on(const production&crux) const;
+  std::unordered_set<const production*>get_continuing_beginnings(const potential_match&partial_match) const;
+  std::unordered_set<const production*>get_continuing_beginnings(token_iterator inclusive_end_of_matches) const;
+};
+
+#endif
@@ -0,0 +1,118 @@
+#include <algorithm>
+
+#include "highlight_shadow.hpp"
+
+using namespace std;
+
+vector<highlight_run>::iterator highlight_shadow::first_ending_after(unsigned codepoint_index) {
+  return upper_bound(runs.begin(), runs.end(), codepoint_index, [](unsigned index, const highlight_run&run) {
+      return index < run.end_codepoint_index;
+    });
+}
+
+// Merges the run at position into its predecessor if they touch and share a
+// code.
+void highlight_shadow::coalesce_at(vector<highlight_run>::iterator position) {
+  if (position == runs.begin() || position == runs.end()) {
+    return;
+  }
+  highlight_run&previous = *(position - 1);
+  if (previous.end_codepoint_index == position->beginning_codepoint_index && previous.highlight_code == position->highlight_code) {
+    previous.end_codepoint_index = position->end_codepoint_index;
+    runs.erase(position);
+  }
+}
+
+void highlight_shadow::add_codepoints(unsigned beginning, unsigned count) {
+  // A run containing the insertion point grows; runs after it shift.
+  for (vector<highlight_run>::iterator i = first_ending_after(beginning), end = runs.end(); i != end; ++i) {
+    if (i->beginning_codepoint_index > beginning) {
+      i->beginning_codepoint_index += count;
+    }
+    i->end_codepoint_index += count;
+  }
+}
+
+void highlight_shadow::remove_codepoints(unsigned beginning, unsigned end) {
+  unsigned count = end - beginning;
+  auto clamp = [beginning, end, count](unsigned index) {
+    return index <= beginning ? index : index >= end ? index - count : beginning;
+  };
+  vector<highlight_run>::iterator i = first_ending_after(beginning);
+  vector<highlight_run>::iterator kept = i;
+  for (; i != runs.end(); ++i) {
+    highlight_run run{clamp(i->beginning_codepoint_index), clamp(i->end_codepoint_index), i->highlight_code};
+    if (run.beginning_codepoint_index < run.end_codepoint_index) {
+      *kept++ = run;
+    }
+  }
+  runs.erase(kept, runs.end());
+  // The deletion may have brought two runs with the same code together.
+  coalesce_at(first_ending_after(beginning));
+}
+
+void highlight_shadow::get_runs(unsigned beginning, unsigned end, vector<highlight_run>&result) {
+  for (vector<highlight_run>::iterator i = first_ending_after(beginning); i != runs.end() && i->beginning_codepoint_index < end; ++i) {
+    result.push_back({max(i->beginning_codepoint_index, beginning), min(i->end_codepoint_index, end), i->highlight_code});
+  }
+}
+
+void highlight_shadow::update(unsigned beginning, unsigned end, const vector<highlight_run>&new_runs, vector<pair<unsigned, unsigned>>&changed_stretches) {
+  vector<highlight_run>::iterator old_beginning = first_ending_after(beginning);
+  vector<highlight_run>::iterator old_end = old_beginning;
+  while (old_end != runs.end() && old_end->beginning_codepoint_index < end) {
+    ++old_end;
+  }
+  // Sweep both run lists together, stopping wherever either one starts or ends
+  // a run, and note the stretches where they disagree.
+  vector<highlight_run>::iterator old_run = old_beginning;
+  vector<highlight_run>::const_iterator new_run = new_runs.begin();
+  for (unsigned position = beginning; position < end;) {
+    while (old_run != old_end && old_run->end_codepoint_index <= position) {
+      ++old_run;
+    }
+    while (new_run != new_runs.end() && new_run->end_codepoint_index <= position) {
+      ++new_run;
+    }
+    bool old_covers = (old_run != old_end && old_run->beginning_codepoint_index <= position);
+    bool new_covers = (new_run != new_runs.end() && new_run->beginning_codepoint_index <= position);
+    unsigned next = end;
+    if (old_run != old_end) {
+      next = min(next, old_covers ? old_run->end_codepoint_index : old_run->beginning_codepoint_index);
+    }
+    if (new_run != new_runs.end()) {
+      next = min(next, new_covers ? new_run->end_codepoint_index : new_run->beginning_codepoint_index);
+    }
+    if (old_covers != new_covers || (old_covers && old_run->highlight_code != new_run->highlight_code)) {
+      if (!changed_stretches.empty() && changed_stretches.back().second == position) {
+	changed_stretches.back().second = next;
+      } else {
+	changed_stretches.push_back({position, next});
+      }
+    }
+    position = next;
+  }
+  // Splice the new runs in, keeping whatever parts of the old runs at the edges
+  // lie outside of the interval.
+  replacement.clear();
+  auto append = [this](const highlight_run&run) {
+    if (!replacement.empty() && replacement.back().end_codepoint_index == run.beginning_codepoint_index && replacement.back().highlight_code == run.highlight_code) {
+      replacement.back().end_codepoint_index = run.end_codepoint_index;
+    } else {
+      replacement.push_back(run);
+    }
+  };
+  if (old_beginning != old_end && old_beginning->beginning_codepoint_index < beginning) {
+    append({old_beginning->beginning_codepoint_index, beginning, old_beginning->highlight_code});
+  }
+  for (const highlight_run&run : new_runs) {
+    append(run);
+  }
+  if (old_beginning != old_end && (old_end - 1)->end_codepoint_index > end) {
+    append({end, (old_end - 1)->end_codepoint_index, (old_end - 1)->highlight_code});
+  }
+  vector<highlight_run>::iterator inserted = runs.insert(runs.erase(old_beginning, old_end), replacement.begin(), replacement.end());
+  size_t inserted_offset = static_cast<size_t>(inserted - runs.begin());
+  coalesce_at(inserted + replacement.size());
+  coalesce_at(runs.begin() + inserted_offset);
+}
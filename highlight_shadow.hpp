@@ -0,0 +1,48 @@
+#ifndef HIGHLIGHT_SHADOW_HEADER
+#define HIGHLIGHT_SHADOW_HEADER
+
+#include <utility>
+#include <vector>
+
+#include "lexical_highlights.hpp"
+
+/*
+ * A copy of the highlights that the editor currently holds for one buffer, kept
+ * so that rehighlighting can send only the runs that actually changed.  (A
+ * buffer also keeps one of the highlights that the editor should hold, which
+ * differ where sending was put off.)
+ *
+ * The editor stores highlights as overlays that advance at neither end: text
+ * inserted at an overlay's beginning or strictly inside it joins the overlay,
+ * text inserted at its end does not, and an overlay whose text is all deleted
+ * no longer highlights anything.  The shadow applies the same rules to edits.
+ * Since only the highlight of each codepoint is observable, it stores maximal
+ * runs of equal highlight codes rather than the overlays themselves; adjacent
+ * overlays with the same code behave like one under those rules anyway.
+ */
+class highlight_shadow {
+protected:
+  // Sorted, disjoint, and nonempty, with no two touching runs sharing a code.
+  std::vector<highlight_run>		runs;
+  // Scratch space for update, kept to avoid reallocation.
+  std::vector<highlight_run>		replacement;
+
+  std::vector<highlight_run>::iterator first_ending_after(unsigned codepoint_index);
+  void coalesce_at(std::vector<highlight_run>::iterator position);
+
+public:
+  void add_codepoints(unsigned beginning, unsigned count);
+  void remove_codepoints(unsigned beginning, unsigned end);
+
+  // Appends the runs overlapping [beginning, end) to result, trimmed to that
+  // interval.
+  void get_runs(unsigned beginning, unsigned end, std::vector<highlight_run>&result);
+  // Records that the editor's highlights in [beginning, end) are to become
+  // new_runs, which must be sorted, disjoint, and within that interval, and
+  // appends to changed_stretches the maximal subintervals where that differs
+  // from what the editor holds now.  The caller is responsible for actually
+  // sending those differences.
+  void update(unsigned beginning, unsigned end, const std::vector<highlight_run>&new_runs, std::vector<std::pair<unsigned, unsigned>>&changed_stretches);
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <unordered_map>
 
 #include "base_class.hpp"
+#include "codepoints.hpp"
 
 template<typename T>const T*internalizer_clone(const T&copy, typename std::enable_if<!std::is_base_of<base_class, T>::value, T>::type* = nullptr) {
   return new T{copy};
@@ -14,55 +15,101 @@ template<typename T>const T*internalizer_clone(const T&copy, typename std::enabl
   return dynamic_cast<const T*>(copy.clone());
 }
 
+// How an internalizer finds its elements.  By default it compares and hashes
+// the elements themselves, so every lookup needs a complete T, but a
+// specialization can key elements by something cheaper to come by, and then
+// acquire will accept that instead, only constructing a T when the element is
+// new.
+template<typename T>struct internalizer_key {
+  const T*value;
+
+  internalizer_key(const T&value) :
+    value{&value} {}
+
+  bool operator ==(const internalizer_key&other) const {
+    return *value == *other.value;
+  }
+  size_t hash() const {
+    static std::hash<T>subhash;
+    return subhash(*value);
+  }
+  const T*clone() const {
+    return internalizer_clone(*value);
+  }
+};
+
+// Strings are keyed by views, so that the lexer can intern token text straight
+// from its input.
+template<>struct internalizer_key<i7_string> {
+  i7_string_view view;
+
+  internalizer_key(const i7_string&value) :
+    view{value} {}
+  internalizer_key(const i7_string_view&view) :
+    view{view} {}
+
+  bool operator ==(const internalizer_key&other) const {
+    return view.size() == other.view.size() && i7_string::traits_type::compare(view.data(), other.view.data(), view.size()) == 0;
+  }
+  // FNV-1a, a codepoint at a time.
+  size_t hash() const {
+    size_t result = static_cast<size_t>(14695981039346656037ULL);
+    for (i7_codepoint codepoint : view) {
+      result = (result ^ codepoint) * static_cast<size_t>(1099511628211ULL);
+    }
+    return result;
+  }
+  const i7_string*clone() const {
+    return new i7_string{view.str()};
+  }
+};
+
 template<typename T>class internalizer {
 protected:
-  struct key_type {
+  using key_type = internalizer_key<T>;
+  struct entry_type {
     const T*value;
-    bool operator <(const key_type&other) const {
-      return *value < *other.value;
-    }
-    bool operator ==(const key_type&other) const {
-      return *value == *other.value;
-    }
-  };
-  struct key_type_hash {
-    size_t operator()(const key_type&key) const {
-      static std::hash<T>subhash;
-      return subhash(*key.value);
-    }
+    unsigned count;
   };
-  using map_type = std::unordered_map<key_type, unsigned, key_type_hash>;
+  // The keys refer to the values that they belong to.
+  using map_type = std::unordered_map<key_type, entry_type>;
   using value_type = typename map_type::value_type;
   using insertion_result_type = std::pair<typename map_type::iterator, bool>;
   map_type				elements;
 
 public:
   const T*lookup(const T&key) const {
-    typename map_type::const_iterator iterator = elements.find({&key});
+    typename map_type::const_iterator iterator = elements.find(key_type{key});
     if (iterator == elements.end()) {
       return nullptr;
     }
-    return iterator->first.value;
+    return iterator->second.value;
   }
 
   const T&acquire(const T&key) {
-    typename map_type::iterator iterator = elements.find({&key}), end = elements.end();
+    return acquire(key_type{key});
+  }
+
+  const T&acquire(const key_type&key) {
+    typename map_type::iterator iterator = elements.find(key), end = elements.end();
     if (iterator != end) {
-      ++(iterator->second);
-      return *(iterator->first.value);
+      ++(iterator->second.count);
+      return *(iterator->second.value);
     }
-    const T*internalization = internalizer_clone(key);
-    insertion_result_type result = elements.insert(value_type{{internalization}, 1});
+    const T*internalization = key.clone();
+    insertion_result_type result = elements.insert(value_type{key_type{*internalization}, entry_type{internalization, 1}});
     assert(result.second);
     return *internalization;
   }
 
   void release(const T&key) {
-    typename map_type::iterator iterator = elements.find({&key});
+    typename map_type::iterator iterator = elements.find(key_type{key});
     assert(iterator != elements.end());
-    if (!--(iterator->second)) {
-      delete iterator->first.value;
+    if (!--(iterator->second.count)) {
+      // The key refers to the value, so the value has to outlive the erasure.
+      const T*internalization = iterator->second.value;
       elements.erase(iterator);
+      delete internalization;
     }
   }
 };
@@ -0,0 +1,101 @@
+#include <algorithm>
+
+#include "interval_set.hpp"
+
+using namespace std;
+
+using interval = pair<unsigned, unsigned>;
+
+// Returns the first interval ending after codepoint_index.
+static vector<interval>::iterator first_ending_after(vector<interval>&intervals, unsigned codepoint_index) {
+  return upper_bound(intervals.begin(), intervals.end(), codepoint_index, [](unsigned index, const interval&candidate) {
+      return index < candidate.second;
+    });
+}
+
+void interval_set::add_codepoints(unsigned beginning, unsigned count) {
+  for (vector<interval>::iterator i = first_ending_after(intervals, beginning), end = intervals.end(); i != end; ++i) {
+    if (i->first > beginning) {
+      i->first += count;
+    }
+    i->second += count;
+  }
+}
+
+void interval_set::remove_codepoints(unsigned beginning, unsigned end) {
+  unsigned count = end - beginning;
+  auto clamp = [beginning, end, count](unsigned index) {
+    return index <= beginning ? index : index >= end ? index - count : beginning;
+  };
+  vector<interval>::iterator i = first_ending_after(intervals, beginning);
+  vector<interval>::iterator kept = i;
+  for (; i != intervals.end(); ++i) {
+    interval clamped{clamp(i->first), clamp(i->second)};
+    if (clamped.first == clamped.second) {
+      continue;
+    }
+    // The deletion may have brought two intervals together.
+    if (kept != intervals.begin() && (kept - 1)->second == clamped.first) {
+      (kept - 1)->second = clamped.second;
+    } else {
+      *kept++ = clamped;
+    }
+  }
+  intervals.erase(kept, intervals.end());
+}
+
+void interval_set::insert(unsigned beginning, unsigned end) {
+  if (beginning >= end) {
+    return;
+  }
+  // Absorb every interval that overlaps or touches the new one.
+  vector<interval>::iterator first = lower_bound(intervals.begin(), intervals.end(), beginning, [](const interval&candidate, unsigned index) {
+      return candidate.second < index;
+    });
+  vector<interval>::iterator last = first;
+  while (last != intervals.end() && last->first <= end) {
+    beginning = min(beginning, last->first);
+    end = max(end, last->second);
+    ++last;
+  }
+  intervals.insert(intervals.erase(first, last), {beginning, end});
+}
+
+void interval_set::extract(unsigned beginning, unsigned end, vector<interval>&result) {
+  if (beginning >= end) {
+    return;
+  }
+  vector<interval>::iterator first = first_ending_after(intervals, beginning);
+  vector<interval>::iterator last = first;
+  while (last != intervals.end() && last->first < end) {
+    result.push_back({max(last->first, beginning), min(last->second, end)});
+    ++last;
+  }
+  if (first == last) {
+    return;
+  }
+  // Keep whatever sticks out on either side.
+  interval before{first->first, beginning}, after{end, (last - 1)->second};
+  vector<interval>::iterator position = intervals.erase(first, last);
+  if (after.first < after.second) {
+    position = intervals.insert(position, after);
+  }
+  if (before.first < before.second) {
+    intervals.insert(position, before);
+  }
+}
+
+void interval_set::extract_first(unsigned count, vector<interval>&result) {
+  vector<interval>::iterator i = intervals.begin();
+  for (; i != intervals.end() && count; ++i) {
+    unsigned length = i->second - i->first;
+    if (length > count) {
+      result.push_back({i->first, i->first + count});
+      i->first += count;
+      break;
+    }
+    result.push_back(*i);
+    count -= length;
+  }
+  intervals.erase(intervals.begin(), i);
+}
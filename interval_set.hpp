@@ -0,0 +1,35 @@
+#ifndef INTERVAL_SET_HEADER
+#define INTERVAL_SET_HEADER
+
+#include <utility>
+#include <vector>
+
+/*
+ * A set of codepoint indices in a buffer, stored as half-open intervals, and
+ * carried along through edits by the same rules as a highlight_shadow's runs:
+ * text inserted at an interval's beginning or strictly inside it joins the
+ * interval, and text inserted at its end does not.
+ */
+class interval_set {
+protected:
+  // Sorted, disjoint, nonempty, and not touching.
+  std::vector<std::pair<unsigned, unsigned>>intervals;
+
+public:
+  bool empty() const {
+    return intervals.empty();
+  }
+
+  void add_codepoints(unsigned beginning, unsigned count);
+  void remove_codepoints(unsigned beginning, unsigned end);
+
+  void insert(unsigned beginning, unsigned end);
+  // Removes the members in [beginning, end), appending them to result as
+  // maximal intervals.
+  void extract(unsigned beginning, unsigned end, std::vector<std::pair<unsigned, unsigned>>&result);
+  // Removes the lowest members, up to count of them, appending them to result
+  // as maximal intervals.
+  void extract_first(unsigned count, std::vector<std::pair<unsigned, unsigned>>&result);
+};
+
+#endif
@@ -1,241 +1,780 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include "io.hpp"
+#include "session.hpp"
+#include "client_message.hpp"
+#include "codepoint_reader.hpp"
+#include "codepoint_writer.hpp"
 #include "protocol.hpp"
+#include "spsc_queue.hpp"
+#include "trace.hpp"
+#include "utf8.hpp"
 
-static bool endianness_undetermined = true;
-static bool flip_endianness = false;
-static union {
-  struct { uint8_t a, b, c, d; } bytes;
-  uint32_t codepoint;
-} codepoint_union;
-
-static bool stdin_closed = false;
-static inline uint8_t read_byte() {
-  int result = fgetc(stdin);
-  stdin_closed |= (result == EOF);
-  return static_cast<uint8_t>(result);
-}
-
-static inline uint32_t read_codepoint() {
-  if (flip_endianness) {
-    codepoint_union.bytes.a = static_cast<uint8_t>(read_byte());
-    codepoint_union.bytes.b = static_cast<uint8_t>(read_byte());
-    codepoint_union.bytes.c = static_cast<uint8_t>(read_byte());
-    codepoint_union.bytes.d = static_cast<uint8_t>(read_byte());
+using namespace std;
+
+// Each editor connection's input is read and decoded on a thread of its own so
+// that its pipe or socket is drained (and the editor never blocks writing to
+// it) even while the main thread is busy relexing or parsing, and so that the
+// main thread can tell when more edits are already on their way.  Only the
+// reader thread touches a connection's input, and only the main thread touches
+// its output.
+//
+// Each connection has a session of its own, which holds its buffers and views
+// under the numbers that the editor gave them, but all of the sessions share
+// the one grammar, built once at startup.  Output goes to the connection whose
+// session is running, so the main thread notes which that is before handing a
+// session anything to do.
+//
+// When serving many editors, no editor's socket may block the main thread, so
+// their output is written without blocking and retried while the main thread
+// waits for input.  An editor that falls too far behind is disconnected.
+
+struct client_connection {
+  // Normally both file descriptors are the same socket; for the connection over
+  // standard input and output, they differ.
+  int					input_file_descriptor;
+  int					output_file_descriptor;
+  codepoint_reader			input;
+  codepoint_writer			output;
+  // The protocol version in effect for input, which changes as soon as the
+  // request is read rather than when the main thread gets to it, and the one
+  // in effect for output.
+  uint32_t				input_protocol_version;
+  uint32_t				protocol_version;
+  // Where the framed message being read ends, counted as the input's consumed
+  // count is.
+  uint64_t				input_message_end;
+  thread				reader;
+  // Numbers connections in the order that they were opened, for traces.
+  unsigned				serial_number;
+  // Whether the editor may have the server read files for it with
+  // CLIENT_LOAD_FILE, which is only when it could read them itself.
+  bool					may_load_files;
+  // True once the main thread has received a message from the connection.
+  bool					is_known;
+  // The optional server messages that the editor understands.
+  unordered_set<uint32_t>		supported_server_messages;
+  // Created by the main thread along with is_known.
+  typename ::session*			session;
+
+  client_connection(int input_file_descriptor, int output_file_descriptor, unsigned serial_number, bool may_load_files) :
+    input_file_descriptor{input_file_descriptor},
+    output_file_descriptor{output_file_descriptor},
+    input{input_file_descriptor},
+    // Only the connection over standard output serves a lone editor, and so
+    // may block.
+    output{output_file_descriptor, input_file_descriptor != output_file_descriptor},
+    input_protocol_version{0},
+    protocol_version{0},
+    input_message_end{0},
+    serial_number{serial_number},
+    may_load_files{may_load_files},
+    is_known{false},
+    session{nullptr} {}
+};
+
+// Messages from every connection, in arrival order.  The queue only supports a
+// single producer, so the reader threads take turns pushing.
+static spsc_queue<client_message> client_messages{1024};
+static mutex client_message_producer_mutex;
+
+// Reader threads:
+
+// The longest framed message, in words (or, in UTF-8, bytes), that we accept; a
+// longer one is treated as a malformed message.  A length only bounds what is
+// read: the input ring grows as the message actually arrives, never to the
+// length up front.
+static const uint32_t MAXIMUM_MESSAGE_LENGTH = 1 << 26;
+
+// Reads the length of a framed string, which cannot run past the end of the
+// message that contains it.
+static uint32_t read_string_length(client_connection&connection, client_message&message) {
+  uint32_t length = connection.input.read_codepoint();
+  if (length > connection.input_message_end - connection.input.get_consumed_count()) {
+    message.problem = MALFORMED_COMMAND;
+    return 0;
+  }
+  return length;
+}
+
+static i7_string_view read_string(client_connection&connection, client_message&message) {
+  if (connection.input_protocol_version) {
+    return connection.input.read_codepoints(read_string_length(connection, message));
+  }
+  return connection.input.read_string();
+}
+
+static void read_arguments(client_connection&connection, client_message&message, unsigned count) {
+  for (unsigned i = 0; i < count; ++i) {
+    message.arguments[i] = connection.input.read_codepoint();
+  }
+}
+
+// Reads a string into the message's text, decoding it straight there if the
+// wire encoding is UTF-8.
+static void read_text(client_connection&connection, client_message&message) {
+  if (connection.input_protocol_version) {
+    connection.input.read_codepoints(read_string_length(connection, message), message.text);
   } else {
-    codepoint_union.bytes.d = static_cast<uint8_t>(read_byte());
-    codepoint_union.bytes.c = static_cast<uint8_t>(read_byte());
-    codepoint_union.bytes.b = static_cast<uint8_t>(read_byte());
-    codepoint_union.bytes.a = static_cast<uint8_t>(read_byte());
+    connection.input.read_string(message.text);
   }
-  if (stdin_closed) {
-    return CLIENT_END_SESSION;
+}
+
+// Maps the named file into memory and decodes it as UTF-8 straight from there
+// into text, which is where the codepoints would otherwise have arrived over the
+// wire.  Returns false if the file cannot be read.
+static bool load_file(const i7_string_view&path, i7_string&text) {
+  string encoded_path;
+  encode_utf8(path.begin(), path.end(), encoded_path);
+  int file_descriptor = open(encoded_path.c_str(), O_RDONLY);
+  if (file_descriptor < 0) {
+    return false;
   }
-  if (endianness_undetermined) {
-    endianness_undetermined = false;
-    flip_endianness = (codepoint_union.codepoint > 0xFFFF);
-    if (flip_endianness) {
-      uint8_t swap = codepoint_union.bytes.a;
-      codepoint_union.bytes.a = codepoint_union.bytes.d;
-      codepoint_union.bytes.d = swap;
-      swap = codepoint_union.bytes.b;
-      codepoint_union.bytes.b = codepoint_union.bytes.c;
-      codepoint_union.bytes.c = swap;
+  struct stat status;
+  bool result = false;
+  if (fstat(file_descriptor, &status) == 0 && S_ISREG(status.st_mode)) {
+    size_t size = static_cast<size_t>(status.st_size);
+    if (!size) {
+      text.clear();
+      result = true;
+    } else {
+      void*contents = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+      if (contents != MAP_FAILED) {
+	madvise(contents, size, MADV_SEQUENTIAL);
+	const char*bytes = static_cast<const char*>(contents);
+	decode_utf8(bytes, bytes + size, text);
+	munmap(contents, size);
+	result = true;
+      }
     }
   }
-  return codepoint_union.codepoint;
+  close(file_descriptor);
+  return result;
 }
 
-static inline i7_string read_string() {
-  i7_string_stream stream;
-  for (uint32_t codepoint; (codepoint = read_codepoint());) {
-    stream << static_cast<i7_codepoint>(codepoint);
+// Decodes the next message.  Returns false if the message is to be skipped
+// rather than passed on.
+static bool read_message(client_connection&connection, client_message&message, bool first, bool&session_begun, uint32_t&wire_encoding) {
+  codepoint_reader&input = connection.input;
+  bool switch_wire_encoding = false;
+  uint64_t message_end = 0;
+  message.connection = &connection;
+  message.command = input.read_codepoint();
+  message.problem = NO_PROBLEM;
+  bool framed = (connection.input_protocol_version != 0);
+  if (framed) {
+    uint32_t length = input.read_codepoint();
+    if (length > MAXIMUM_MESSAGE_LENGTH) {
+      message.problem = MALFORMED_COMMAND;
+      return true;
+    }
+    message_end = input.get_consumed_count() + length;
+    connection.input_message_end = message_end;
   }
-  return stream.str();
+  switch (message.command) {
+  case CLIENT_END_SESSION:
+    return true;
+  case CLIENT_BEGIN_SESSION:
+    session_begun = true;
+    break;
+  case CLIENT_REQUEST_PROTOCOL_VERSION:
+    // Framing can only change before anything else has been read under the
+    // old framing.
+    if (!first) {
+      message.problem = UNRECOGNIZED_COMMAND;
+      return true;
+    }
+    connection.input_protocol_version = input.read_codepoint();
+    if (connection.input_protocol_version > PROTOCOL_VERSION_NUMBER) {
+      connection.input_protocol_version = PROTOCOL_VERSION_NUMBER;
+    }
+    message.arguments[0] = connection.input_protocol_version;
+    break;
+  case CLIENT_REQUEST_WIRE_ENCODING:
+    if (session_begun || wire_encoding != WIRE_ENCODING_UCS_4) {
+      message.problem = UNRECOGNIZED_COMMAND;
+      return true;
+    }
+    wire_encoding = input.read_codepoint();
+    if (wire_encoding != WIRE_ENCODING_UTF_8) {
+      wire_encoding = WIRE_ENCODING_UCS_4;
+    }
+    message.arguments[0] = wire_encoding;
+    // Switch only once the rest of this message has been read.
+    switch_wire_encoding = (wire_encoding != WIRE_ENCODING_UCS_4);
+    break;
+  case CLIENT_SUPPORT_HIGHLIGHT_CODE:
+  case CLIENT_SUPPORT_SERVER_MESSAGE:
+  case CLIENT_DISCARD_BUFFER:
+  case CLIENT_INTRODUCE_BUFFER:
+  case CLIENT_MARK_BUFFER_UNDECIDED:
+  case CLIENT_MARK_BUFFER_AS_STORY:
+  case CLIENT_DISCARD_VIEW:
+  case CLIENT_CLEAR_VIEW:
+  case CLIENT_CLEAR_CURSOR:
+    read_arguments(connection, message, 1);
+    break;
+  case CLIENT_MARK_BUFFER_AS_EXTENSION:
+    read_arguments(connection, message, 1);
+    read_text(connection, message);
+    break;
+  case CLIENT_REMOVE_CODEPOINTS:
+  case CLIENT_MOVE_VIEW:
+  case CLIENT_SET_CURSOR:
+    read_arguments(connection, message, 3);
+    break;
+  case CLIENT_ADD_CODEPOINTS:
+    read_arguments(connection, message, 2);
+    read_text(connection, message);
+    break;
+  case CLIENT_LOAD_FILE:
+    // The file is read here rather than on the main thread, and the message
+    // passed on with the file's contents as its text and whether they could be
+    // read as its last argument.  An editor that may not load files is told
+    // that the file could not be read without the server trying.
+    read_arguments(connection, message, 2);
+    {
+      i7_string_view path = read_string(connection, message);
+      message.arguments[2] = (message.problem == NO_PROBLEM) && connection.may_load_files && load_file(path, message.text);
+    }
+    break;
+  case CLIENT_INTRODUCE_VIEW:
+    read_arguments(connection, message, 2);
+    break;
+  default:
+    if (!framed) {
+      message.problem = UNRECOGNIZED_COMMAND;
+      return true;
+    }
+    // Framing lets us skip messages from newer clients.
+    input.skip_codepoints(static_cast<size_t>(message_end - input.get_consumed_count()));
+    return false;
+  }
+  if (message.problem != NO_PROBLEM) {
+    return true;
+  }
+  if (framed) {
+    // Trailing fields that we don't understand are skipped; a message that
+    // overran its stated length means that we have lost synchronization.
+    uint64_t consumed_count = input.get_consumed_count();
+    if (consumed_count > message_end) {
+      message.problem = MALFORMED_COMMAND;
+      return true;
+    }
+    input.skip_codepoints(static_cast<size_t>(message_end - consumed_count));
+  }
+  if (switch_wire_encoding) {
+    input.set_encoding(wire_encoding);
+  }
+  return true;
 }
 
+static void read_messages(client_connection*connection) {
+  bool session_begun = false;
+  uint32_t wire_encoding = WIRE_ENCODING_UCS_4;
+  client_message message;
+  bool first = true;
+  for (;;) {
+    if (!read_message(*connection, message, first, session_begun, wire_encoding)) {
+      continue;
+    }
+    if (first) {
+      // The byte order is settled by the first codepoint, and pushing the first
+      // message publishes it to the main thread before any output is written.
+      connection->output.set_flip_endianness(connection->input.flips_endianness());
+      first = false;
+    }
+    bool last = (message.command == CLIENT_END_SESSION || message.problem != NO_PROBLEM);
+    message.arrival_time = chrono::steady_clock::now();
+    {
+      lock_guard<mutex>lock{client_message_producer_mutex};
+      client_messages.push(message);
+    }
+    if (last) {
+      return;
+    }
+  }
+}
+
+// Main thread:
+
+static const grammar*shared_grammar = nullptr;
+static vector<client_connection*> connections;
+// Connections whose sessions are over, but whose editors have yet to read the
+// last of their output.
+static vector<client_connection*> draining_connections;
+// The connection being written to, which is the one whose session is running.
+static client_connection*current_connection = nullptr;
+static size_t message_length_mark;
+// Where to record the session, if anywhere.
+static trace_writer*trace = nullptr;
+
 static inline void write_codepoint(uint32_t codepoint) {
-  codepoint_union.codepoint = codepoint;
-  if (flip_endianness) {
-    fputc(codepoint_union.bytes.a, stdout);
-    fputc(codepoint_union.bytes.b, stdout);
-    fputc(codepoint_union.bytes.c, stdout);
-    fputc(codepoint_union.bytes.d, stdout);
+  current_connection->output.write_codepoint(codepoint);
+}
+
+static inline void write_string(const i7_string&string) {
+  if (current_connection->protocol_version) {
+    current_connection->output.write_counted_string(string);
   } else {
-    fputc(codepoint_union.bytes.d, stdout);
-    fputc(codepoint_union.bytes.c, stdout);
-    fputc(codepoint_union.bytes.b, stdout);
-    fputc(codepoint_union.bytes.a, stdout);
+    current_connection->output.write_string(string);
   }
 }
 
-static inline void write_string(const i7_string&string) {
-  for (i7_codepoint codepoint : string) {
-    write_codepoint(static_cast<uint32_t>(codepoint));
+static inline void begin_message(uint32_t purpose) {
+  write_codepoint(purpose);
+  if (current_connection->protocol_version) {
+    message_length_mark = current_connection->output.begin_length_prefix();
   }
 }
 
-void startup_io() {
-  freopen(NULL, "rb", stdin);
-  freopen(NULL, "wb", stdout);
-  uint32_t command;
-  unsigned buffer_number;
-  unsigned view_number;
-  unsigned beginning, end;
-  ::highlight_code highlight_code;
-  i7_string text;
-  for (;;) {
-    command = read_codepoint();
-    switch (command) {
-    case CLIENT_END_SESSION:
-      return;
-    case CLIENT_BEGIN_SESSION:
-      break;
-    case CLIENT_SUPPORT_HIGHLIGHT_CODE:
-      highlight_code = static_cast< ::highlight_code>(read_codepoint());
-      support_highlight_code(highlight_code);
-      break;
-    case CLIENT_DISCARD_BUFFER:
-      buffer_number = static_cast<unsigned>(read_codepoint());
-      discard_buffer(buffer_number);
-      break;
-    case CLIENT_INTRODUCE_BUFFER:
-      buffer_number = static_cast<unsigned>(read_codepoint());
-      introduce_buffer(buffer_number);
-      break;
-    case CLIENT_MARK_BUFFER_UNDECIDED:
-      buffer_number = static_cast<unsigned>(read_codepoint());
-      mark_buffer_undecided(buffer_number);
-      break;
-    case CLIENT_MARK_BUFFER_AS_STORY:
-      buffer_number = static_cast<unsigned>(read_codepoint());
-      mark_buffer_as_story(buffer_number);
-      break;
-    case CLIENT_MARK_BUFFER_AS_EXTENSION:
-      buffer_number = static_cast<unsigned>(read_codepoint());
-      text = read_string();
-      mark_buffer_as_extension(buffer_number, text);
-      break;
-    case CLIENT_REMOVE_CODEPOINTS:
-      buffer_number = static_cast<unsigned>(read_codepoint());
-      beginning = static_cast<unsigned>(read_codepoint());
-      end = static_cast<unsigned>(read_codepoint());
-      remove_codepoints(buffer_number, beginning, end);
-      break;
-    case CLIENT_ADD_CODEPOINTS:
-      buffer_number = static_cast<unsigned>(read_codepoint());
-      beginning = static_cast<unsigned>(read_codepoint());
-      text = read_string();
-      add_codepoints(buffer_number, beginning, text);
-      break;
-    case CLIENT_DISCARD_VIEW:
-      view_number = static_cast<unsigned>(read_codepoint());
-      discard_view(view_number);
-      break;
-    case CLIENT_INTRODUCE_VIEW:
-      view_number = static_cast<unsigned>(read_codepoint());
-      buffer_number = static_cast<unsigned>(read_codepoint());
-      introduce_view(view_number, buffer_number);
-      break;
-    case CLIENT_CLEAR_VIEW:
-      view_number = static_cast<unsigned>(read_codepoint());
-      move_view(view_number, 0, 0);
-      break;
-    case CLIENT_MOVE_VIEW:
-      view_number = static_cast<unsigned>(read_codepoint());
-      beginning = static_cast<unsigned>(read_codepoint());
-      end = static_cast<unsigned>(read_codepoint());
-      move_view(view_number, beginning, end);
-      break;
-    case CLIENT_CLEAR_CURSOR:
-      view_number = static_cast<unsigned>(read_codepoint());
-      clear_cursor(view_number);
-      break;
-    case CLIENT_SET_CURSOR:
-      view_number = static_cast<unsigned>(read_codepoint());
-      beginning = static_cast<unsigned>(read_codepoint());
-      end = static_cast<unsigned>(read_codepoint());
-      set_cursor(view_number, beginning, end);
+static inline void end_message() {
+  if (current_connection->protocol_version) {
+    current_connection->output.end_length_prefix(message_length_mark);
+  }
+}
+
+static inline void begin_buffer_message(uint32_t purpose, unsigned buffer_number) {
+  begin_message(purpose);
+  write_codepoint(buffer_number);
+}
+
+static inline void begin_view_message(uint32_t purpose, unsigned view_number) {
+  begin_message(purpose);
+  write_codepoint(view_number);
+}
+
+static void release_connection(client_connection*connection) {
+  close(connection->input_file_descriptor);
+  if (connection->output_file_descriptor != connection->input_file_descriptor) {
+    close(connection->output_file_descriptor);
+  }
+  delete connection;
+}
+
+// Hands each editor as much of its output as it will take.  An editor that
+// refuses output or has let too much pile up is hung up on, which its reader
+// thread sees as the end of its session.  Returns true if no output is left
+// waiting.
+static bool flush_connections() {
+  bool result = true;
+  for (client_connection*connection : connections) {
+    if (!connection->output.flush() && connection->input_file_descriptor == connection->output_file_descriptor) {
+      shutdown(connection->input_file_descriptor, SHUT_RDWR);
+    }
+    result &= !connection->output.has_unsent_output();
+  }
+  for (vector<client_connection*>::iterator i = draining_connections.begin(); i != draining_connections.end();) {
+    if ((*i)->output.flush() && (*i)->output.has_unsent_output()) {
+      result = false;
+      ++i;
+    } else {
+      release_connection(*i);
+      i = draining_connections.erase(i);
+    }
+  }
+  return result;
+}
+
+// Lets every editor's session go idle, each writing to its own editor.
+static void idle() {
+  for (client_connection*connection : connections) {
+    current_connection = connection;
+    connection->session->idle();
+  }
+}
+
+static bool send_deferred_output() {
+  bool result = false;
+  for (client_connection*connection : connections) {
+    current_connection = connection;
+    result |= connection->session->send_deferred_output();
+  }
+  return result;
+}
+
+// Discards the connection's session and lets it go once the editor has the
+// rest of its output.
+static void close_connection(client_connection*connection) {
+  delete connection->session;
+  connection->session = nullptr;
+  connection->output.flush();
+  connection->reader.join();
+  for (vector<client_connection*>::iterator i = connections.begin(); i != connections.end(); ++i) {
+    if (*i == connection) {
+      connections.erase(i);
       break;
-    default:
-      printf("Unrecognized command from editor: %08x.", command);
+    }
+  }
+  if (connection->output.has_unsent_output()) {
+    draining_connections.push_back(connection);
+  } else {
+    release_connection(connection);
+  }
+}
+
+// Acts on one message from an editor, taking its text where the session can
+// use it as is.  Returns false once that editor's session is over.
+static bool dispatch(client_message&message, bool serving_many) {
+  client_connection*connection = message.connection;
+  const uint32_t*arguments = message.arguments;
+  if (!connection->is_known) {
+    connection->is_known = true;
+    connection->session = new typename ::session{*shared_grammar};
+    connections.push_back(connection);
+  }
+  typename ::session&session = *connection->session;
+  current_connection = connection;
+  if (message.problem != NO_PROBLEM) {
+    const char*description = (message.problem == MALFORMED_COMMAND) ? "Malformed" : "Unrecognized";
+    if (serving_many) {
+      // One confused editor should not take the others down with it.
+      fprintf(stderr, "%s command from editor: %08x.\n", description, message.command);
+      close_connection(connection);
+      return false;
+    }
+    connection->output.flush();
+    printf("%s command from editor: %08x.", description, message.command);
+    exit(1);
+  }
+  switch (message.command) {
+  case CLIENT_END_SESSION:
+    session.idle();
+    flush_connections();
+    if (serving_many) {
+      close_connection(connection);
+    }
+    return false;
+  case CLIENT_BEGIN_SESSION:
+    break;
+  case CLIENT_REQUEST_PROTOCOL_VERSION:
+    // The reply is always in version 0 framing so that the client can read it
+    // before it knows which version was agreed on.
+    write_codepoint(SERVER_ACCEPT_PROTOCOL_VERSION);
+    write_codepoint(arguments[0]);
+    connection->protocol_version = arguments[0];
+    break;
+  case CLIENT_REQUEST_WIRE_ENCODING:
+    begin_message(SERVER_ACCEPT_WIRE_ENCODING);
+    write_codepoint(arguments[0]);
+    end_message();
+    connection->output.set_encoding(arguments[0]);
+    break;
+  case CLIENT_SUPPORT_HIGHLIGHT_CODE:
+    session.support_highlight_code(static_cast< ::highlight_code>(arguments[0]));
+    break;
+  case CLIENT_SUPPORT_SERVER_MESSAGE:
+    connection->supported_server_messages.insert(arguments[0]);
+    break;
+  case CLIENT_DISCARD_BUFFER:
+    session.discard_buffer(arguments[0]);
+    break;
+  case CLIENT_INTRODUCE_BUFFER:
+    session.introduce_buffer(arguments[0]);
+    break;
+  case CLIENT_MARK_BUFFER_UNDECIDED:
+    mark_buffer_undecided(arguments[0]);
+    break;
+  case CLIENT_MARK_BUFFER_AS_STORY:
+    mark_buffer_as_story(arguments[0]);
+    break;
+  case CLIENT_MARK_BUFFER_AS_EXTENSION:
+    mark_buffer_as_extension(arguments[0], message.text);
+    break;
+  case CLIENT_REMOVE_CODEPOINTS:
+    session.remove_codepoints(arguments[0], arguments[1], arguments[2]);
+    break;
+  case CLIENT_ADD_CODEPOINTS:
+    session.add_codepoints(arguments[0], arguments[1], move(message.text));
+    break;
+  case CLIENT_LOAD_FILE:
+    if (arguments[2]) {
+      // The reply describes the text that the session is about to take.
+      begin_buffer_message(SERVER_FILE_LOADED, arguments[0]);
+      write_codepoint(static_cast<uint32_t>(message.text.size()));
+      write_codepoint(checksum_codepoints(message.text));
+      session.add_codepoints(arguments[0], arguments[1], move(message.text));
+    } else {
+      begin_buffer_message(SERVER_FILE_NOT_LOADED, arguments[0]);
+    }
+    end_message();
+    break;
+  case CLIENT_DISCARD_VIEW:
+    session.discard_view(arguments[0]);
+    break;
+  case CLIENT_INTRODUCE_VIEW:
+    session.introduce_view(arguments[0], arguments[1]);
+    break;
+  case CLIENT_CLEAR_VIEW:
+    session.move_view(arguments[0], 0, 0);
+    break;
+  case CLIENT_MOVE_VIEW:
+    session.move_view(arguments[0], arguments[1], arguments[2]);
+    break;
+  case CLIENT_CLEAR_CURSOR:
+    clear_cursor(arguments[0]);
+    break;
+  case CLIENT_SET_CURSOR:
+    set_cursor(arguments[0], arguments[1], arguments[2]);
+    break;
+  }
+  return true;
+}
+
+bool has_pending_input() {
+  return !client_messages.empty();
+}
+
+static client_connection*open_connection(int input_file_descriptor, int output_file_descriptor, bool may_load_files) {
+  // Only the accepting thread opens connections after startup.
+  static unsigned next_serial_number = 0;
+  client_connection*result = new client_connection{input_file_descriptor, output_file_descriptor, next_serial_number++, may_load_files};
+  // The main thread only learns of the connection from its first message, so
+  // holding the producers' lock until the reader is stored keeps the main
+  // thread from joining it before then, as it would for an editor that hangs
+  // up right away.
+  lock_guard<mutex>lock{client_message_producer_mutex};
+  result->reader = thread{read_messages, result};
+  return result;
+}
+
+// The same as Emacs's default jit-lock-context-time, for which Emacs itself
+// waits before refontifying text after an edit that could affect it.
+static const chrono::milliseconds DEFERRED_OUTPUT_DELAY{500};
+// How often to retry output that an editor was not ready for while waiting for
+// input.
+static const chrono::milliseconds UNSENT_OUTPUT_RETRY_DELAY{10};
+
+// Waits up to timeout for a message, retrying unsent output in the meantime.
+static bool wait_for_message(client_message&message, chrono::steady_clock::duration timeout) {
+  chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + timeout;
+  while (!flush_connections()) {
+    chrono::steady_clock::duration remaining = deadline - chrono::steady_clock::now();
+    if (remaining <= chrono::steady_clock::duration::zero()) {
+      return false;
+    }
+    if (client_messages.pop_for(message, min<chrono::steady_clock::duration>(remaining, UNSENT_OUTPUT_RETRY_DELAY))) {
+      return true;
+    }
+  }
+  return client_messages.pop_for(message, deadline - chrono::steady_clock::now());
+}
+
+// Waits for a message, retrying unsent output in the meantime.
+static void wait_for_message(client_message&message) {
+  while (!flush_connections()) {
+    if (client_messages.pop_for(message, UNSENT_OUTPUT_RETRY_DELAY)) {
+      return;
+    }
+  }
+  client_messages.pop(message);
+}
+
+// Handles messages until an editor ends its session, or, if serving_many, for
+// as long as the process runs.
+static void serve(bool serving_many) {
+  client_message message;
+  do {
+    if (!client_messages.try_pop(message)) {
+      // Only wake the editors once the current burst of commands is handled,
+      // and only then finish any work that later commands could have made moot.
+      if (trace) {
+	trace->write_idle();
+      }
+      idle();
+      flush_connections();
+      // Output that the editors aren't showing waits for a pause in their
+      // input, and then goes out a piece at a time so that new input can cut
+      // in.
+      if (!wait_for_message(message, DEFERRED_OUTPUT_DELAY)) {
+	bool more;
+	do {
+	  more = send_deferred_output();
+	  flush_connections();
+	} while (more && client_messages.empty());
+	wait_for_message(message);
+      }
+    }
+    if (trace && message.problem == NO_PROBLEM) {
+      trace->write_message(message.connection->serial_number, message);
+    }
+  } while (dispatch(message, serving_many) || serving_many);
+}
+
+void record_trace(const char*trace_path) {
+  trace = new trace_writer{trace_path};
+}
+
+void startup_io(const grammar&grammar) {
+  shared_grammar = &grammar;
+  // The editor on standard input started the server, so runs as the same user.
+  client_connection*connection = open_connection(STDIN_FILENO, STDOUT_FILENO, true);
+  serve(false);
+  connection->reader.join();
+}
+
+// True if the peer on the other end of the socket runs as the same user as the
+// server, and so could read any file that the server could on its own.
+static bool is_same_user(int file_descriptor) {
+  ucred credentials;
+  socklen_t length = sizeof(credentials);
+  return getsockopt(file_descriptor, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 && credentials.uid == geteuid();
+}
+
+static void accept_connections(int listener) {
+  for (;;) {
+    int file_descriptor = accept(listener, nullptr, nullptr);
+    if (file_descriptor < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+	continue;
+      }
+      perror("accept");
       exit(1);
     }
-    fflush(stdout);
+    open_connection(file_descriptor, file_descriptor, is_same_user(file_descriptor));
+  }
+}
+
+void startup_io(const grammar&grammar, const char*socket_path) {
+  shared_grammar = &grammar;
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", socket_path);
+    exit(1);
+  }
+  strcpy(address.sun_path, socket_path);
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    perror("socket");
+    exit(1);
+  }
+  // Replace a socket left behind by an earlier server, but nothing else.
+  struct stat status;
+  if (lstat(socket_path, &status) == 0 && S_ISSOCK(status.st_mode)) {
+    unlink(socket_path);
+  }
+  if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listener, SOMAXCONN) < 0) {
+    perror(socket_path);
+    exit(1);
   }
+  // An editor that disconnects without ending its session should not kill the
+  // server when we next write to it; the write just fails.
+  signal(SIGPIPE, SIG_IGN);
+  thread{accept_connections, listener}.detach();
+  serve(true);
 }
 
 void remove_highlights(unsigned buffer_number, unsigned beginning, unsigned end) {
-  write_codepoint(SERVER_REMOVE_HIGHLIGHTS);
-  write_codepoint(buffer_number);
+  begin_buffer_message(SERVER_REMOVE_HIGHLIGHTS, buffer_number);
   write_codepoint(beginning);
   write_codepoint(end);
+  end_message();
 }
 void add_highlight(unsigned buffer_number, unsigned beginning, unsigned end, ::highlight_code highlight_code) {
-  write_codepoint(SERVER_ADD_HIGHLIGHT);
-  write_codepoint(buffer_number);
+  begin_buffer_message(SERVER_ADD_HIGHLIGHT, buffer_number);
   write_codepoint(beginning);
   write_codepoint(end);
   write_codepoint(static_cast<i7_codepoint>(highlight_code));
+  end_message();
+}
+void replace_highlights(unsigned buffer_number, unsigned beginning, unsigned end, const vector<highlight_run>&runs) {
+  // The batched message can only say this if the runs leave no gaps.
+  bool is_tiling = !runs.empty() && runs.front().beginning_codepoint_index == beginning && runs.back().end_codepoint_index == end;
+  for (size_t i = 1; is_tiling && i < runs.size(); ++i) {
+    is_tiling = (runs[i - 1].end_codepoint_index == runs[i].beginning_codepoint_index);
+  }
+  if (!is_tiling || !current_connection->supported_server_messages.count(SERVER_REPLACE_HIGHLIGHT_RUNS)) {
+    remove_highlights(buffer_number, beginning, end);
+    for (const highlight_run&run : runs) {
+      add_highlight(buffer_number, run.beginning_codepoint_index, run.end_codepoint_index, run.highlight_code);
+    }
+    return;
+  }
+  begin_buffer_message(SERVER_REPLACE_HIGHLIGHT_RUNS, buffer_number);
+  write_codepoint(beginning);
+  write_codepoint(static_cast<uint32_t>(runs.size()));
+  for (const highlight_run&run : runs) {
+    write_codepoint(run.end_codepoint_index - run.beginning_codepoint_index);
+    write_codepoint(static_cast<i7_codepoint>(run.highlight_code));
+  }
+  end_message();
 }
 void remove_warnings(unsigned buffer_number, unsigned beginning, unsigned end) {
-  write_codepoint(SERVER_REMOVE_WARNINGS);
-  write_codepoint(buffer_number);
+  begin_buffer_message(SERVER_REMOVE_WARNINGS, buffer_number);
   write_codepoint(beginning);
   write_codepoint(end);
+  end_message();
 }
 void add_warning(unsigned buffer_number, unsigned beginning, unsigned end) {
-  write_codepoint(SERVER_ADD_WARNING);
-  write_codepoint(buffer_number);
+  begin_buffer_message(SERVER_ADD_WARNING, buffer_number);
   write_codepoint(beginning);
   write_codepoint(end);
+  end_message();
 }
 void remove_errors(unsigned buffer_number, unsigned beginning, unsigned end) {
-  write_codepoint(SERVER_REMOVE_ERRORS);
-  write_codepoint(buffer_number);
+  begin_buffer_message(SERVER_REMOVE_ERRORS, buffer_number);
   write_codepoint(beginning);
   write_codepoint(end);
+  end_message();
 }
 void add_error(unsigned buffer_number, unsigned beginning, unsigned end) {
-  write_codepoint(SERVER_ADD_ERROR);
-  write_codepoint(buffer_number);
+  begin_buffer_message(SERVER_ADD_ERROR, buffer_number);
   write_codepoint(beginning);
   write_codepoint(end);
+  end_message();
 }
 void remove_hovertexts(unsigned buffer_number, unsigned beginning, unsigned end) {
-  write_codepoint(SERVER_REMOVE_HOVERTEXTS);
-  write_codepoint(buffer_number);
+  begin_buffer_message(SERVER_REMOVE_HOVERTEXTS, buffer_number);
   write_codepoint(beginning);
   write_codepoint(end);
+  end_message();
 }
 void add_hovertext(unsigned buffer_number, unsigned beginning, unsigned end, const i7_string&hovertext) {
-  write_codepoint(SERVER_ADD_HOVERTEXT);
-  write_codepoint(buffer_number);
+  begin_buffer_message(SERVER_ADD_HOVERTEXT, buffer_number);
   write_codepoint(beginning);
   write_codepoint(end);
   write_string(hovertext);
+  end_message();
 }
 
 void remove_emphasis(unsigned view_number, unsigned beginning, unsigned end) {
-  write_codepoint(SERVER_REMOVE_EMPHASIS);
-  write_codepoint(view_number);
+  begin_view_message(SERVER_REMOVE_EMPHASIS, view_number);
   write_codepoint(beginning);
   write_codepoint(end);
+  end_message();
 }
 void add_emphasis(unsigned view_number, unsigned beginning, unsigned end) {
-  write_codepoint(SERVER_ADD_EMPHASIS);
-  write_codepoint(view_number);
+  begin_view_message(SERVER_ADD_EMPHASIS, view_number);
   write_codepoint(beginning);
   write_codepoint(end);
+  end_message();
 }
 void clear_suggestions(unsigned view_number) {
-  write_codepoint(SERVER_CLEAR_SUGGESTIONS);
-  write_codepoint(view_number);
+  begin_view_message(SERVER_CLEAR_SUGGESTIONS, view_number);
+  end_message();
 }
 void make_suggestions(unsigned view_number, const i7_string&suggestion) {
-  write_codepoint(SERVER_MAKE_SUGGESTION);
-  write_codepoint(view_number);
+  begin_view_message(SERVER_MAKE_SUGGESTION, view_number);
   write_string(suggestion);
+  end_message();
 }
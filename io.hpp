@@ -1,39 +1,49 @@
 #ifndef IO_HEADER
 #define IO_HEADER
 
+#include <vector>
+
 #include "codepoints.hpp"
 #include "lexical_highlights.hpp"
 
+class grammar;
+
 // See also protocol.hpp.
 
-void startup_io();
+// Makes the startup_io functions record every message that they receive, and
+// every time that they go idle, to a trace file (see trace.hpp).
+void record_trace(const char*trace_path);
 
-// To be implemented elsewhere:
+// Serves one editor over standard input and output, returning when it ends its
+// session.
+void startup_io(const grammar&grammar);
+// Serves any number of editors that connect to a Unix-domain socket at the
+// given path, each with a session of its own, but all sharing the one grammar.
+// Never returns.
+void startup_io(const grammar&grammar, const char*socket_path);
 
-void support_highlight_code(::highlight_code highlight_code);
-
-void discard_buffer(unsigned buffer_number);
-void introduce_buffer(unsigned buffer_number);
+// To be implemented elsewhere:
 
 void mark_buffer_undecided(unsigned buffer_number);
 void mark_buffer_as_story(unsigned buffer_number);
 void mark_buffer_as_extension(unsigned buffer_number, const i7_string&includable_file_name);
 
-void remove_codepoints(unsigned buffer_number, unsigned beginning, unsigned end);
-void add_codepoints(unsigned buffer_number, unsigned beginning, const i7_string&insertion);
-
-void discard_view(unsigned view_number);
-void introduce_view(unsigned view_number, unsigned buffer_number);
-
-void move_view(unsigned view_number, unsigned beginning, unsigned end);
-
 void clear_cursor(unsigned view_number);
 void set_cursor(unsigned view_number, unsigned beginning, unsigned end);
 
 // Implemented in io.cpp:
 
+// True if more client messages have already arrived, from any editor.
+bool has_pending_input();
+
+// The output below goes to the editor whose session is running.
+
 void remove_highlights(unsigned buffer_number, unsigned beginning, unsigned end);
 void add_highlight(unsigned buffer_number, unsigned beginning, unsigned end, ::highlight_code highlight_code);
+// Replaces all highlighting in [beginning, end) with the given runs, which must
+// be sorted and lie within that range, using whichever messages the client
+// supports that say so most compactly.
+void replace_highlights(unsigned buffer_number, unsigned beginning, unsigned end, const std::vector<highlight_run>&runs);
 void remove_warnings(unsigned buffer_number, unsigned beginning, unsigned end);
 void add_warning(unsigned buffer_number, unsigned beginning, unsigned end);
 void remove_errors(unsigned buffer_number, unsigned beginning, unsigned end);
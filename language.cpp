@@ -1,6 +1,6 @@
 #include "codepoints.hpp"
 #include "parser.hpp"
-#include "session.hpp"
+#include "grammar.hpp"
 
 using namespace std;
 
@@ -18,7 +18,7 @@ using namespace std;
 #define OTHER(parseme) current.add_alternative_to_last_slot(parseme);
 #define DONE current.justify(); }
 
-session::session() {
+grammar::grammar() {
   // Parentheses
   RESULT(wording, "left parenthesis", 0);
   SLOT TERMINAL("(");
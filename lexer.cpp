@@ -1,260 +1,577 @@
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
 #include "lexer.hpp"
 
 using namespace std;
 
-#define UPDATE_SIDE_STATE {						\
-    if (state == &lexer::in_documentation_break) {			\
-      documentation_break_match_count = 2; } }
-
-#define ACCUMULATE() {				\
-    accumulator << codepoint;			\
-    return; }
-
-#define ACCUMULATE_TO_STATE(next_state) {	\
-    accumulator << codepoint;			\
-    state = &lexer::next_state;			\
-    UPDATE_SIDE_STATE;				\
-    return; }
-
-#define FLUSH(only_whitespace, effect, newlines) {					\
-    results.push_back(token{accumulator.str(), only_whitespace, effect, newlines});	\
-    accumulator.str(i7_string{}); }
-
-#define ACCUMULATE_AND_FLUSH(only_whitespace, effect, newlines) {	\
-    accumulator << codepoint;						\
-    FLUSH(only_whitespace, effect, newlines);				\
-    state = &lexer::undecided;						\
-    return; }
-
-#define FLUSH_AND_ACCUMULATE(only_whitespace, effect, newlines) {	\
-    FLUSH(only_whitespace, effect, newlines);				\
-    undecided(codepoint);						\
-    return; }
-
-#define RELEX(inhibitor) {					\
-    inhibitor = true;						\
-    i7_string earlier_codepoints = accumulator.str();		\
-    accumulator.str(i7_string{});				\
-    state = &lexer::undecided;					\
-    for (i7_codepoint earlier_codepoint : earlier_codepoints) { \
-      (*this) << earlier_codepoint;				\
-    }								\
-    (*this) << codepoint;					\
-    return; }
+namespace {
+  // The columns of the transition table.  Each letter of DOCUMENTATION gets a
+  // class of its own so that the states matching a documentation break can
+  // tell them apart.
+  enum codepoint_class : unsigned char {
+    LINE_FEED_CLASS,
+    CARRIAGE_RETURN_CLASS,
+    TAB_CLASS,
+    SPACE_CLASS,
+    OTHER_WHITESPACE_CLASS,
+    HYPHEN_CLASS,
+    PLUS_CLASS,
+    OPEN_PARENTHESIS_CLASS,
+    CLOSE_PARENTHESIS_CLASS,
+    SINGLE_QUOTE_CLASS,
+    DOUBLE_QUOTE_CLASS,
+    LEFT_BRACKET_CLASS,
+    RIGHT_BRACKET_CLASS,
+    BANG_CLASS,
+    OTHER_PUNCTUATION_CLASS,
+    TERMINATOR_CLASS,
+    OTHER_LETTER_CLASS,
+    FIRST_DOCUMENTATION_LETTER_CLASS
+  };
 
-lexer::lexer() :
-  state(&lexer::undecided),
-  documentation_break_inhibited{false},
-  documentation_break_match_count{0} {}
+  // The rows of the transition table, one per state function in the original
+  // lexer (see reference_lexer.cpp), except that the documentation break
+  // matcher is unrolled into one state per codepoint matched.
+  enum lexer_state : unsigned char {
+    UNDECIDED,
+    AFTER_SINGLE_QUOTE,
+    AFTER_TWO_SINGLE_QUOTES,
+    IN_WHITESPACE,
+    AFTER_CARRIAGE_RETURN,
+    AFTER_LINE_FEED,
+    AFTER_NEWLINE,
+    IN_INDENTATION,
+    IN_WORD,
+    AFTER_OPEN_PARENTHESIS,
+    AFTER_HYPHEN,
+    AFTER_PLUS,
+    AFTER_DOCUMENTATION_BREAK_ENDED_BY_CARRIAGE_RETURN,
+    AFTER_DOCUMENTATION_BREAK_ENDED_BY_LINE_FEED,
+    AFTER_DOCUMENTATION_BREAK_ENDED_BY_NEWLINE,
+    IN_INDENTATION_AFTER_DOCUMENTATION_BREAK,
+    // IN_DOCUMENTATION_BREAK + n - 2 means that the first n codepoints of
+    // DOCUMENTATION_BREAK have matched; a break is entered after two.
+    IN_DOCUMENTATION_BREAK
+  };
 
-void lexer::operator <<(i7_codepoint codepoint) {
-  (this->*state)(codepoint);
+  // What a transition does to the accumulator besides flushing.
+  enum lexer_action : unsigned char {
+    // Append the codepoint.
+    ACCUMULATE,
+    // Drop the codepoint; only TERMINATOR_CODEPOINT is dropped.
+    SKIP,
+    // Give up on a documentation break, flush what was accumulated as the
+    // lexer_table says, and then lex the codepoint.
+    ABANDON_DOCUMENTATION_BREAK
+  };
+
+  // The tokens that a transition can flush, as indices into TOKEN_KINDS.
+  enum token_kind : unsigned char {
+    NO_TOKEN,
+    PLAIN_TEXT_TOKEN,
+    WHITESPACE_TOKEN,
+    BARE_NEWLINE_TOKEN,
+    INDENTATION_TOKEN,
+    SINGLE_QUOTE_TOKEN,
+    DOUBLE_QUOTE_TOKEN,
+    LEFT_BRACKET_TOKEN,
+    RIGHT_BRACKET_TOKEN,
+    BANG_TOKEN,
+    LEFT_CYCLOPS_TOKEN,
+    LEFT_CROSSEYED_CYCLOPS_TOKEN,
+    RIGHT_CYCLOPS_TOKEN,
+    RIGHT_CROSSEYED_CYCLOPS_TOKEN,
+    DOCUMENTATION_BREAK_TOKEN,
+    DOCUMENTATION_BREAK_FOLLOWED_BY_INDENTATION_TOKEN
+  };
+
+  struct token_kind_description {
+    bool				only_whitespace;
+    const lexer_monoid*			lexical_effect;
+    unsigned				line_count;
+  };
+
+  // A transition flushes the accumulator as flush_before, applies its action
+  // to the codepoint, flushes again as flush_after, and moves to next_state.
+  struct lexer_transition {
+    unsigned char			flush_before;
+    unsigned char			action;
+    unsigned char			flush_after;
+    unsigned char			next_state;
+
+    bool is_plain_accumulation() const {
+      return !(flush_before | action | flush_after);
+    }
+  };
 }
 
-bool lexer::most_recent_codepoint_did_not_combine() const {
-  return const_cast<i7_string_stream&>(accumulator).tellp() == 1;
+static const char DOCUMENTATION_BREAK[] = "\n---- DOCUMENTATION ----\n";
+static const unsigned DOCUMENTATION_BREAK_LENGTH = sizeof(DOCUMENTATION_BREAK) - 1;
+static const char DOCUMENTATION_LETTERS[] = "ACDEIMNOTU";
+
+static const unsigned CODEPOINT_CLASS_COUNT = FIRST_DOCUMENTATION_LETTER_CLASS + sizeof(DOCUMENTATION_LETTERS) - 1;
+static const unsigned LEXER_STATE_COUNT = IN_DOCUMENTATION_BREAK + DOCUMENTATION_BREAK_LENGTH - 2;
+
+// How many codepoints of a span are classified ahead of lexing at a time.
+static const size_t CLASSIFICATION_BLOCK_LENGTH = 4096;
+
+namespace {
+  // How the codepoints accumulated in a state matching a documentation break
+  // are flushed if the break falls through.  The leading newline becomes a
+  // BARE_NEWLINE_TOKEN, and the rest, from the first hyphen on, is lexed as if
+  // a documentation break had never been possible: as these tokens, followed by
+  // codepoints left in the accumulator in next_state.  Since there is no
+  // newline after the first, nothing there could begin another break, so the
+  // outcome depends only on how many codepoints had matched.
+  struct abandoned_documentation_break {
+    unsigned char			token_count;
+    unsigned char			token_kinds[DOCUMENTATION_BREAK_LENGTH];
+    unsigned char			token_lengths[DOCUMENTATION_BREAK_LENGTH];
+    unsigned char			next_state;
+  };
 }
 
-const vector<token>&lexer::get_results() const {
-  return results;
+static const token_kind_description TOKEN_KINDS[] = {
+  {false, nullptr, 0},
+  {false, &plain_text, 0},
+  {true, &plain_text, 0},
+  {true, &bare_newline, 1},
+  {true, &indentation, 1},
+  {false, &single_quote, 0},
+  {false, &double_quote, 0},
+  {false, &left_bracket, 0},
+  {false, &right_bracket, 0},
+  {false, &bang, 0},
+  {false, &left_cyclops, 0},
+  {false, &left_crosseyed_cyclops, 0},
+  {false, &right_cyclops, 0},
+  {false, &right_crosseyed_cyclops, 0},
+  {false, &documentation_break, 2},
+  {false, &documentation_break_followed_by_indentation, 2},
+};
+
+namespace {
+  class lexer_table {
+  public:
+    unsigned char			ascii_classes[128];
+    lexer_transition			transitions[LEXER_STATE_COUNT][CODEPOINT_CLASS_COUNT];
+    // Indexed by state - IN_DOCUMENTATION_BREAK.
+    abandoned_documentation_break	abandoned_documentation_breaks[DOCUMENTATION_BREAK_LENGTH - 2];
+
+  protected:
+    void set(unsigned state, unsigned codepoint_class, unsigned char flush_before, lexer_action action, unsigned char flush_after, unsigned char next_state) {
+      transitions[state][codepoint_class] = {flush_before, static_cast<unsigned char>(action), flush_after, next_state};
+    }
+
+    void set_all(unsigned state, unsigned char flush_before, lexer_action action, unsigned char flush_after, unsigned char next_state) {
+      for (unsigned codepoint_class = 0; codepoint_class < CODEPOINT_CLASS_COUNT; ++codepoint_class) {
+	set(state, codepoint_class, flush_before, action, flush_after, next_state);
+      }
+    }
+
+    void set_letters(unsigned state, unsigned char flush_before, lexer_action action, unsigned char flush_after, unsigned char next_state) {
+      for (unsigned codepoint_class = OTHER_LETTER_CLASS; codepoint_class < CODEPOINT_CLASS_COUNT; ++codepoint_class) {
+	set(state, codepoint_class, flush_before, action, flush_after, next_state);
+      }
+    }
+
+    // Equivalent to flushing the accumulator and lexing the codepoint afresh.
+    // Because no transition out of UNDECIDED flushes first, the two steps can
+    // be folded into one.
+    void set_all_to_flush_and_accumulate(unsigned state, unsigned char token_kind) {
+      for (unsigned codepoint_class = 0; codepoint_class < CODEPOINT_CLASS_COUNT; ++codepoint_class) {
+	transitions[state][codepoint_class] = transitions[UNDECIDED][codepoint_class];
+	transitions[state][codepoint_class].flush_before = token_kind;
+      }
+    }
+
+    static void add_token(abandoned_documentation_break&abandoned, unsigned char token_kind, unsigned char length) {
+      abandoned.token_kinds[abandoned.token_count] = token_kind;
+      abandoned.token_lengths[abandoned.token_count] = length;
+      ++abandoned.token_count;
+    }
+
+  public:
+    lexer_table() {
+      for (unsigned codepoint = 0; codepoint < 128; ++codepoint) {
+	ascii_classes[codepoint] =
+	  is_i7_whitespace(codepoint) ? OTHER_WHITESPACE_CLASS :
+	  is_i7_punctuation(codepoint) ? OTHER_PUNCTUATION_CLASS :
+	  OTHER_LETTER_CLASS;
+      }
+      ascii_classes[static_cast<unsigned char>('\n')] = LINE_FEED_CLASS;
+      ascii_classes[static_cast<unsigned char>('\r')] = CARRIAGE_RETURN_CLASS;
+      ascii_classes[static_cast<unsigned char>('\t')] = TAB_CLASS;
+      ascii_classes[static_cast<unsigned char>(' ')] = SPACE_CLASS;
+      ascii_classes[static_cast<unsigned char>('-')] = HYPHEN_CLASS;
+      ascii_classes[static_cast<unsigned char>('+')] = PLUS_CLASS;
+      ascii_classes[static_cast<unsigned char>('(')] = OPEN_PARENTHESIS_CLASS;
+      ascii_classes[static_cast<unsigned char>(')')] = CLOSE_PARENTHESIS_CLASS;
+      ascii_classes[static_cast<unsigned char>('\'')] = SINGLE_QUOTE_CLASS;
+      ascii_classes[static_cast<unsigned char>('"')] = DOUBLE_QUOTE_CLASS;
+      ascii_classes[static_cast<unsigned char>('[')] = LEFT_BRACKET_CLASS;
+      ascii_classes[static_cast<unsigned char>(']')] = RIGHT_BRACKET_CLASS;
+      ascii_classes[static_cast<unsigned char>('!')] = BANG_CLASS;
+      for (unsigned i = 0; DOCUMENTATION_LETTERS[i]; ++i) {
+	ascii_classes[static_cast<unsigned char>(DOCUMENTATION_LETTERS[i])] = FIRST_DOCUMENTATION_LETTER_CLASS + i;
+      }
+
+      set_all(UNDECIDED, NO_TOKEN, ACCUMULATE, NO_TOKEN, IN_WORD);
+      set(UNDECIDED, TERMINATOR_CLASS, NO_TOKEN, SKIP, NO_TOKEN, UNDECIDED);
+      set(UNDECIDED, LINE_FEED_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, AFTER_LINE_FEED);
+      set(UNDECIDED, CARRIAGE_RETURN_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, AFTER_CARRIAGE_RETURN);
+      set(UNDECIDED, OPEN_PARENTHESIS_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, AFTER_OPEN_PARENTHESIS);
+      set(UNDECIDED, HYPHEN_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, AFTER_HYPHEN);
+      set(UNDECIDED, PLUS_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, AFTER_PLUS);
+      set(UNDECIDED, SINGLE_QUOTE_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, AFTER_SINGLE_QUOTE);
+      set(UNDECIDED, DOUBLE_QUOTE_CLASS, NO_TOKEN, ACCUMULATE, DOUBLE_QUOTE_TOKEN, UNDECIDED);
+      set(UNDECIDED, LEFT_BRACKET_CLASS, NO_TOKEN, ACCUMULATE, LEFT_BRACKET_TOKEN, UNDECIDED);
+      set(UNDECIDED, RIGHT_BRACKET_CLASS, NO_TOKEN, ACCUMULATE, RIGHT_BRACKET_TOKEN, UNDECIDED);
+      set(UNDECIDED, BANG_CLASS, NO_TOKEN, ACCUMULATE, BANG_TOKEN, UNDECIDED);
+      for (unsigned codepoint_class : {TAB_CLASS, SPACE_CLASS, OTHER_WHITESPACE_CLASS}) {
+	set(UNDECIDED, codepoint_class, NO_TOKEN, ACCUMULATE, NO_TOKEN, IN_WHITESPACE);
+      }
+      set(UNDECIDED, CLOSE_PARENTHESIS_CLASS, NO_TOKEN, ACCUMULATE, PLAIN_TEXT_TOKEN, UNDECIDED);
+      set(UNDECIDED, OTHER_PUNCTUATION_CLASS, NO_TOKEN, ACCUMULATE, PLAIN_TEXT_TOKEN, UNDECIDED);
+
+      set_all_to_flush_and_accumulate(AFTER_SINGLE_QUOTE, SINGLE_QUOTE_TOKEN);
+      set(AFTER_SINGLE_QUOTE, SINGLE_QUOTE_CLASS, SINGLE_QUOTE_TOKEN, ACCUMULATE, NO_TOKEN, AFTER_TWO_SINGLE_QUOTES);
+
+      set_all_to_flush_and_accumulate(AFTER_TWO_SINGLE_QUOTES, SINGLE_QUOTE_TOKEN);
+      set(AFTER_TWO_SINGLE_QUOTES, SINGLE_QUOTE_CLASS, PLAIN_TEXT_TOKEN, ACCUMULATE, SINGLE_QUOTE_TOKEN, UNDECIDED);
+
+      set_all_to_flush_and_accumulate(IN_WHITESPACE, WHITESPACE_TOKEN);
+      for (unsigned codepoint_class : {TAB_CLASS, SPACE_CLASS, OTHER_WHITESPACE_CLASS}) {
+	set(IN_WHITESPACE, codepoint_class, NO_TOKEN, ACCUMULATE, NO_TOKEN, IN_WHITESPACE);
+      }
+
+      for (unsigned state : {AFTER_CARRIAGE_RETURN, AFTER_LINE_FEED, AFTER_NEWLINE}) {
+	set_all_to_flush_and_accumulate(state, BARE_NEWLINE_TOKEN);
+	set(state, TAB_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, IN_INDENTATION);
+	set(state, HYPHEN_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, IN_DOCUMENTATION_BREAK);
+      }
+      set(AFTER_CARRIAGE_RETURN, LINE_FEED_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, AFTER_NEWLINE);
+      set(AFTER_LINE_FEED, CARRIAGE_RETURN_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, AFTER_NEWLINE);
+
+      set_all_to_flush_and_accumulate(IN_INDENTATION, INDENTATION_TOKEN);
+      set(IN_INDENTATION, TAB_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, IN_INDENTATION);
+
+      set_all_to_flush_and_accumulate(IN_WORD, PLAIN_TEXT_TOKEN);
+      set_letters(IN_WORD, NO_TOKEN, ACCUMULATE, NO_TOKEN, IN_WORD);
+
+      set_all_to_flush_and_accumulate(AFTER_OPEN_PARENTHESIS, PLAIN_TEXT_TOKEN);
+      set(AFTER_OPEN_PARENTHESIS, HYPHEN_CLASS, NO_TOKEN, ACCUMULATE, LEFT_CYCLOPS_TOKEN, UNDECIDED);
+      set(AFTER_OPEN_PARENTHESIS, PLUS_CLASS, NO_TOKEN, ACCUMULATE, LEFT_CROSSEYED_CYCLOPS_TOKEN, UNDECIDED);
+
+      set_all_to_flush_and_accumulate(AFTER_HYPHEN, PLAIN_TEXT_TOKEN);
+      set(AFTER_HYPHEN, CLOSE_PARENTHESIS_CLASS, NO_TOKEN, ACCUMULATE, RIGHT_CYCLOPS_TOKEN, UNDECIDED);
+
+      set_all_to_flush_and_accumulate(AFTER_PLUS, PLAIN_TEXT_TOKEN);
+      set(AFTER_PLUS, CLOSE_PARENTHESIS_CLASS, NO_TOKEN, ACCUMULATE, RIGHT_CROSSEYED_CYCLOPS_TOKEN, UNDECIDED);
+
+      for (unsigned state : {AFTER_DOCUMENTATION_BREAK_ENDED_BY_CARRIAGE_RETURN, AFTER_DOCUMENTATION_BREAK_ENDED_BY_LINE_FEED, AFTER_DOCUMENTATION_BREAK_ENDED_BY_NEWLINE}) {
+	set_all_to_flush_and_accumulate(state, DOCUMENTATION_BREAK_TOKEN);
+	set(state, TAB_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, IN_INDENTATION_AFTER_DOCUMENTATION_BREAK);
+      }
+      set(AFTER_DOCUMENTATION_BREAK_ENDED_BY_CARRIAGE_RETURN, LINE_FEED_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, AFTER_DOCUMENTATION_BREAK_ENDED_BY_NEWLINE);
+      set(AFTER_DOCUMENTATION_BREAK_ENDED_BY_LINE_FEED, CARRIAGE_RETURN_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, AFTER_DOCUMENTATION_BREAK_ENDED_BY_NEWLINE);
+
+      set_all_to_flush_and_accumulate(IN_INDENTATION_AFTER_DOCUMENTATION_BREAK, DOCUMENTATION_BREAK_FOLLOWED_BY_INDENTATION_TOKEN);
+      set(IN_INDENTATION_AFTER_DOCUMENTATION_BREAK, TAB_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, IN_INDENTATION_AFTER_DOCUMENTATION_BREAK);
+
+      for (unsigned match_count = 2; match_count < DOCUMENTATION_BREAK_LENGTH - 1; ++match_count) {
+	unsigned state = IN_DOCUMENTATION_BREAK + match_count - 2;
+	set_all(state, NO_TOKEN, ABANDON_DOCUMENTATION_BREAK, NO_TOKEN, UNDECIDED);
+	set(state, ascii_classes[static_cast<unsigned char>(DOCUMENTATION_BREAK[match_count])], NO_TOKEN, ACCUMULATE, NO_TOKEN, state + 1);
+      }
+      // The final newline of a break can be either kind; which one decides how
+      // the break ends.
+      unsigned last_state = IN_DOCUMENTATION_BREAK + DOCUMENTATION_BREAK_LENGTH - 3;
+      set_all(last_state, NO_TOKEN, ABANDON_DOCUMENTATION_BREAK, NO_TOKEN, UNDECIDED);
+      set(last_state, LINE_FEED_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, AFTER_DOCUMENTATION_BREAK_ENDED_BY_LINE_FEED);
+      set(last_state, CARRIAGE_RETURN_CLASS, NO_TOKEN, ACCUMULATE, NO_TOKEN, AFTER_DOCUMENTATION_BREAK_ENDED_BY_CARRIAGE_RETURN);
+
+      // Run the table itself over each matched prefix, less its newline, to see
+      // how it would be lexed.  Only plain accumulations and flushes occur.
+      for (unsigned match_count = 2; match_count < DOCUMENTATION_BREAK_LENGTH; ++match_count) {
+	abandoned_documentation_break&abandoned = abandoned_documentation_breaks[match_count - 2];
+	abandoned.token_count = 0;
+	unsigned char state = UNDECIDED;
+	unsigned char length = 0;
+	for (unsigned index = 1; index < match_count; ++index) {
+	  const lexer_transition&transition = transitions[state][ascii_classes[static_cast<unsigned char>(DOCUMENTATION_BREAK[index])]];
+	  if (transition.flush_before) {
+	    add_token(abandoned, transition.flush_before, length);
+	    length = 0;
+	  }
+	  ++length;
+	  if (transition.flush_after) {
+	    add_token(abandoned, transition.flush_after, length);
+	    length = 0;
+	  }
+	  state = transition.next_state;
+	}
+	abandoned.next_state = state;
+      }
+    }
+
+    // Codepoints that i7_normalize changes are classified as the ASCII that
+    // they normalize to.
+    unsigned char classify(i7_codepoint codepoint) const {
+      if (codepoint < 128) {
+	return ascii_classes[codepoint];
+      }
+      uint8_t codepoint_class = get_i7_codepoint_class(codepoint);
+      if (codepoint_class & I7_NORMALIZED) {
+	return ascii_classes[i7_normalize(codepoint)];
+      }
+      if (codepoint_class & I7_TERMINATOR) {
+	return TERMINATOR_CLASS;
+      }
+      if (codepoint_class & I7_WHITESPACE) {
+	return OTHER_WHITESPACE_CLASS;
+      }
+      if (codepoint_class & I7_PUNCTUATION) {
+	return OTHER_PUNCTUATION_CLASS;
+      }
+      return OTHER_LETTER_CLASS;
+    }
+
+    // Classifies a block of codepoints in one sweep, finding the runs of ASCII,
+    // by far the common case, a vector at a time.
+    void classify(const i7_codepoint*beginning, const i7_codepoint*end, unsigned char*classes) const {
+      while (beginning != end) {
+	for (const i7_codepoint*ascii_end = skip_ascii_codepoints(beginning, end); beginning != ascii_end; ++beginning) {
+	  *classes++ = ascii_classes[*beginning];
+	}
+	if (beginning != end) {
+	  *classes++ = classify(*beginning++);
+	}
+      }
+    }
+  };
 }
 
-void lexer::undecided(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case TERMINATOR_CODEPOINT:
-    return;
-  case '\n':
-    ACCUMULATE_TO_STATE(after_line_feed);
-  case '\r':
-    ACCUMULATE_TO_STATE(after_carriage_return);
-  case '(':
-    ACCUMULATE_TO_STATE(after_open_parenthesis);
-  case '-':
-    ACCUMULATE_TO_STATE(after_hyphen);
-  case '+':
-    ACCUMULATE_TO_STATE(after_plus);
-  case '\'':
-    ACCUMULATE_TO_STATE(after_single_quote);
-  case '"':
-    ACCUMULATE_AND_FLUSH(false, double_quote, 0);
-  case '[':
-    ACCUMULATE_AND_FLUSH(false, left_bracket, 0);
-  case ']':
-    ACCUMULATE_AND_FLUSH(false, right_bracket, 0);
-  case '!':
-    ACCUMULATE_AND_FLUSH(false, bang, 0);
-  }
-  if (is_i7_whitespace(codepoint)) {
-    ACCUMULATE_TO_STATE(in_whitespace);
-  }
-  if (is_i7_punctuation(codepoint)) {
-    ACCUMULATE_AND_FLUSH(false, plain_text, 0);
-  }
-  ACCUMULATE_TO_STATE(in_word);
+static const lexer_table&get_lexer_table() {
+  static const lexer_table table;
+  return table;
 }
 
-void lexer::after_single_quote(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case '\'':
-    FLUSH(false, single_quote, 0);
-    ACCUMULATE_TO_STATE(after_two_single_quotes);
-  }
-  FLUSH_AND_ACCUMULATE(false, single_quote, 0);
+// A resume state packs the automaton's state into the low eight bits and the
+// number of pending codepoints, those accumulated but not yet flushed, into the
+// rest.
+static constexpr unsigned RESUME_STATE_PENDING_SHIFT = 8;
+
+static constexpr lexer_resume_state pack_resume_state(unsigned char state, size_t pending_codepoint_count) {
+  return pending_codepoint_count >= (UNKNOWN_LEXER_RESUME_STATE >> RESUME_STATE_PENDING_SHIFT) ?
+    UNKNOWN_LEXER_RESUME_STATE :
+    state | static_cast<lexer_resume_state>(pending_codepoint_count) << RESUME_STATE_PENDING_SHIFT;
 }
 
-void lexer::after_two_single_quotes(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case '\'':
-    FLUSH(false, plain_text, 0);
-    ACCUMULATE_AND_FLUSH(false, single_quote, 0);
-  }
-  FLUSH_AND_ACCUMULATE(false, single_quote, 0);
+static constexpr lexer_resume_state INITIAL_RESUME_STATE = pack_resume_state(UNDECIDED, 0);
+
+lexer::lexer() :
+  state{UNDECIDED},
+  pending_token_resume_state{INITIAL_RESUME_STATE} {}
+
+void lexer::reset() {
+  state = UNDECIDED;
+  accumulator.clear();
+  results.clear();
+  pending_token_resume_state = INITIAL_RESUME_STATE;
 }
 
-void lexer::in_whitespace(i7_codepoint codepoint) {
-  if (is_i7_whitespace(codepoint) && codepoint != '\r' && codepoint != '\n') {
-    ACCUMULATE();
-  }
-  FLUSH_AND_ACCUMULATE(true, plain_text, 0);
+void lexer::resume(lexer_resume_state resume_state, const i7_string&pending_codepoints, lexer_resume_state pending_token_resume_state) {
+  assert(resume_state != UNKNOWN_LEXER_RESUME_STATE);
+  assert(get_pending_codepoint_count(resume_state) == pending_codepoints.size());
+  reset();
+  state = static_cast<unsigned char>(resume_state);
+  accumulator = pending_codepoints;
+  this->pending_token_resume_state = pending_token_resume_state;
 }
 
-void lexer::after_carriage_return(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case '\n':
-    ACCUMULATE_TO_STATE(after_newline);
-  case '\t':
-    ACCUMULATE_TO_STATE(in_indentation);
-  case '-':
-    if (documentation_break_inhibited) {
-      documentation_break_inhibited = false;
-    } else {
-      ACCUMULATE_TO_STATE(in_documentation_break);
-    }
-    break;
-  }
-  FLUSH_AND_ACCUMULATE(true, bare_newline, 1);
+void lexer::emit(unsigned char token_kind, const i7_string_view&text) {
+  const token_kind_description&description = TOKEN_KINDS[token_kind];
+  results.emplace_back(text, description.only_whitespace, *description.lexical_effect, description.line_count, pending_token_resume_state);
 }
 
-void lexer::after_line_feed(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case '\r':
-    ACCUMULATE_TO_STATE(after_newline);
-  case '\t':
-    ACCUMULATE_TO_STATE(in_indentation);
-  case '-':
-    if (documentation_break_inhibited) {
-      documentation_break_inhibited = false;
-    } else {
-      ACCUMULATE_TO_STATE(in_documentation_break);
-    }
-    break;
+void lexer::flush(unsigned char token_kind, lexer_resume_state next_resume_state) {
+  emit(token_kind, accumulator);
+  accumulator.clear();
+  pending_token_resume_state = next_resume_state;
+}
+
+// A token that begins inside the span being lexed is interned straight from
+// the span; only one that began in an earlier call goes through the
+// accumulator.
+void lexer::flush(unsigned char token_kind, const i7_codepoint*beginning, const i7_codepoint*end, lexer_resume_state next_resume_state) {
+  if (accumulator.empty()) {
+    emit(token_kind, i7_string_view{beginning, static_cast<size_t>(end - beginning)});
+    pending_token_resume_state = next_resume_state;
+    return;
   }
-  FLUSH_AND_ACCUMULATE(true, bare_newline, 1);
+  accumulator.append(beginning, end);
+  flush(token_kind, next_resume_state);
 }
 
-void lexer::after_newline(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case '\t':
-    ACCUMULATE_TO_STATE(in_indentation);
-  case '-':
-    if (documentation_break_inhibited) {
-      documentation_break_inhibited = false;
-    } else {
-      ACCUMULATE_TO_STATE(in_documentation_break);
+// The accumulator holds a newline, one or two codepoints long, and then the
+// codepoints of DOCUMENTATION_BREAK after its newline that have matched.  Every
+// token flushed here records where the lexer stood before its first codepoint,
+// which was still partway through the would-be break.
+void lexer::abandon_documentation_break(i7_codepoint codepoint) {
+  const lexer_table&table = get_lexer_table();
+  const abandoned_documentation_break&abandoned = table.abandoned_documentation_breaks[state - IN_DOCUMENTATION_BREAK];
+  lexer_resume_state resume_state = get_resume_state();
+  size_t newline_length = accumulator.size() - (state - IN_DOCUMENTATION_BREAK + 1);
+  unsigned char state_after_newline = (newline_length == 2) ? AFTER_NEWLINE : (table.classify(accumulator[0]) == LINE_FEED_CLASS) ? AFTER_LINE_FEED : AFTER_CARRIAGE_RETURN;
+  const i7_codepoint*position = accumulator.data();
+  emit(BARE_NEWLINE_TOKEN, i7_string_view{position, newline_length});
+  position += newline_length;
+  pending_token_resume_state = pack_resume_state(state_after_newline, newline_length);
+  for (unsigned index = 0; index < abandoned.token_count; ++index) {
+    emit(abandoned.token_kinds[index], i7_string_view{position, abandoned.token_lengths[index]});
+    position += abandoned.token_lengths[index];
+    size_t pending_codepoint_count = static_cast<size_t>(position - accumulator.data());
+    pending_token_resume_state = pack_resume_state(IN_DOCUMENTATION_BREAK + (pending_codepoint_count - newline_length) - 1, pending_codepoint_count);
+  }
+  accumulator.erase(0, static_cast<size_t>(position - accumulator.data()));
+  state = abandoned.next_state;
+  // From where the codepoints after the newline leave the lexer, the codepoint
+  // can only be accumulated or, if it is the terminator, skipped.
+  const lexer_transition&transition = table.transitions[state][table.classify(codepoint)];
+  assert(transition.action == ACCUMULATE || transition.action == SKIP);
+  if (transition.flush_before) {
+    flush(transition.flush_before, resume_state);
+  }
+  if (transition.action == ACCUMULATE) {
+    accumulator.push_back(codepoint);
+    if (transition.flush_after) {
+      flush(transition.flush_after, pack_resume_state(transition.next_state, 0));
     }
-    break;
   }
-  FLUSH_AND_ACCUMULATE(true, bare_newline, 1);
+  state = transition.next_state;
 }
 
-void lexer::in_indentation(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case '\t':
-    ACCUMULATE();
+// Transitions other than accumulating are rare enough to be kept out of line.
+void lexer::take_unusual_transition(i7_codepoint codepoint) {
+  const lexer_table&table = get_lexer_table();
+  const lexer_transition&transition = table.transitions[state][table.classify(codepoint)];
+  switch (transition.action) {
+  case SKIP:
+    if (transition.flush_before) {
+      flush(transition.flush_before, get_resume_state());
+    }
+    state = transition.next_state;
+    return;
+  case ABANDON_DOCUMENTATION_BREAK:
+    abandon_documentation_break(codepoint);
+    return;
   }
-  FLUSH_AND_ACCUMULATE(true, indentation, 1);
 }
 
-void lexer::in_word(i7_codepoint codepoint) {
-  if (is_i7_letter(codepoint)) {
-    ACCUMULATE();
+inline void lexer::step(i7_codepoint codepoint) {
+  const lexer_table&table = get_lexer_table();
+  const lexer_transition&transition = table.transitions[state][table.classify(codepoint)];
+  if (transition.action != ACCUMULATE) {
+    take_unusual_transition(codepoint);
+    return;
+  }
+  if (transition.flush_before) {
+    flush(transition.flush_before, get_resume_state());
   }
-  FLUSH_AND_ACCUMULATE(false, plain_text, 0);
+  accumulator.push_back(codepoint);
+  if (transition.flush_after) {
+    flush(transition.flush_after, pack_resume_state(transition.next_state, 0));
+  }
+  state = transition.next_state;
 }
 
-void lexer::after_open_parenthesis(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case '-':
-    ACCUMULATE_AND_FLUSH(false, left_cyclops, 0);
-  case '+':
-    ACCUMULATE_AND_FLUSH(false, left_crosseyed_cyclops, 0);
-  }
-  FLUSH_AND_ACCUMULATE(false, plain_text, 0);
+void lexer::operator <<(i7_codepoint codepoint) {
+  step(codepoint);
 }
 
-void lexer::after_hyphen(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case ')':
-    ACCUMULATE_AND_FLUSH(false, right_cyclops, 0);
+// The same as lexing the codepoints one by one, except that accumulated
+// codepoints stay in the span until they are flushed, and only a token left
+// unfinished at the end of the span is copied to the accumulator.  The span is
+// classified a block at a time before it is lexed, so that the loop below
+// reads a class byte per codepoint instead of branching on what kind of
+// codepoint it has.  Inside words and whitespace, where most of the text is,
+// the common run is found by a vectorized scan (see codepoints.hpp) and skipped
+// without consulting the table.
+void lexer::operator <<(const i7_string_view&codepoints) {
+  const lexer_table&table = get_lexer_table();
+  unsigned char classes[CLASSIFICATION_BLOCK_LENGTH];
+  const i7_codepoint*unappended = codepoints.begin();
+  unsigned char current_state = state;
+  for (const i7_codepoint*block = codepoints.begin(), *end = codepoints.end(), *block_end; block != end; block = block_end) {
+    block_end = block + min(static_cast<size_t>(end - block), CLASSIFICATION_BLOCK_LENGTH);
+    table.classify(block, block_end, classes);
+    for (const i7_codepoint*position = block; position != block_end; ++position) {
+      if (current_state == IN_WORD) {
+	position = skip_alphanumeric_codepoints(position, block_end);
+      } else if (current_state == IN_WHITESPACE) {
+	position = skip_blank_codepoints(position, block_end);
+      }
+      if (position == block_end) {
+	break;
+      }
+      const lexer_transition&transition = table.transitions[current_state][classes[position - block]];
+      if (transition.is_plain_accumulation()) {
+	current_state = transition.next_state;
+	continue;
+      }
+      if (transition.action != ACCUMULATE) {
+	accumulator.append(unappended, position);
+	state = current_state;
+	take_unusual_transition(*position);
+	current_state = state;
+	unappended = position + 1;
+	continue;
+      }
+      if (transition.flush_before) {
+	size_t pending_codepoint_count = accumulator.size() + static_cast<size_t>(position - unappended);
+	flush(transition.flush_before, unappended, position, pack_resume_state(current_state, pending_codepoint_count));
+	unappended = position;
+      }
+      if (transition.flush_after) {
+	flush(transition.flush_after, unappended, position + 1, pack_resume_state(transition.next_state, 0));
+	unappended = position + 1;
+      }
+      current_state = transition.next_state;
+    }
   }
-  FLUSH_AND_ACCUMULATE(false, plain_text, 0);
+  accumulator.append(unappended, codepoints.end());
+  state = current_state;
 }
 
-void lexer::after_plus(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case ')':
-    ACCUMULATE_AND_FLUSH(false, right_crosseyed_cyclops, 0);
-  }
-  FLUSH_AND_ACCUMULATE(false, plain_text, 0);
+lexer_resume_state lexer::get_resume_state() const {
+  return pack_resume_state(state, accumulator.size());
 }
 
-void lexer::in_documentation_break(i7_codepoint codepoint) {
-  if (documentation_break_match_count == 24) {
-    switch (codepoint) {
-    case '\n':
-      ACCUMULATE_TO_STATE(after_documentation_break_ended_by_line_feed);
-    case '\r':
-      ACCUMULATE_TO_STATE(after_documentation_break_ended_by_carriage_return);
-    }
-  } else if (codepoint == static_cast<i7_codepoint>("\n---- DOCUMENTATION ----\n"[documentation_break_match_count])) {
-    ++documentation_break_match_count;
-    ACCUMULATE();
-  }
-  RELEX(documentation_break_inhibited);
+lexer_resume_state lexer::get_pending_token_resume_state() const {
+  return pending_token_resume_state;
 }
 
-void lexer::after_documentation_break_ended_by_carriage_return(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case '\n':
-    ACCUMULATE_TO_STATE(after_documentation_break_ended_by_newline);
-  case '\t':
-    ACCUMULATE_TO_STATE(in_indentation_after_documentation_break);
-  }
-  FLUSH_AND_ACCUMULATE(false, documentation_break, 2);
+unsigned lexer::get_pending_codepoint_count(lexer_resume_state resume_state) {
+  assert(resume_state != UNKNOWN_LEXER_RESUME_STATE);
+  return resume_state >> RESUME_STATE_PENDING_SHIFT;
 }
 
-void lexer::after_documentation_break_ended_by_line_feed(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case '\r':
-    ACCUMULATE_TO_STATE(after_documentation_break_ended_by_newline);
-  case '\t':
-    ACCUMULATE_TO_STATE(in_indentation_after_documentation_break);
+lexer_resume_state lexer::add_pending_codepoints(lexer_resume_state resume_state, unsigned count) {
+  if (resume_state == UNKNOWN_LEXER_RESUME_STATE) {
+    return resume_state;
   }
-  FLUSH_AND_ACCUMULATE(false, documentation_break, 2);
+  return pack_resume_state(static_cast<unsigned char>(resume_state), get_pending_codepoint_count(resume_state) + count);
 }
 
-void lexer::after_documentation_break_ended_by_newline(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case '\t':
-    ACCUMULATE_TO_STATE(in_indentation_after_documentation_break);
-  }
-  FLUSH_AND_ACCUMULATE(false, documentation_break, 2);
+// Matching resume states for the pending tokens also means that the two will
+// record the same resume states from here on.
+bool lexer::is_synchronized_with(const lexer&other) const {
+  return state == other.state && accumulator == other.accumulator && pending_token_resume_state == other.pending_token_resume_state;
 }
 
-void lexer::in_indentation_after_documentation_break(i7_codepoint codepoint) {
-  switch (codepoint) {
-  case '\t':
-    ACCUMULATE();
-  }
-  FLUSH_AND_ACCUMULATE(false, documentation_break_followed_by_indentation, 2);
+const vector<token>&lexer::get_results() const {
+  return results;
 }
@@ -7,41 +7,62 @@
 #include "lexer_monoid.hpp"
 #include "token.hpp"
 
+// The lexer is a deterministic finite automaton compiled into a dense table
+// indexed by state and codepoint class (see lexer.cpp).  ASCII codepoints are
+// classified by a lookup in a 128-entry map, and only other codepoints go
+// through the general classification functions in codepoints.hpp.  Flushing
+// accumulated codepoints as tokens is an action attached to a transition.
+//
+// The one thing the table cannot express is backtracking: if what looked like
+// the beginning of a documentation break turns out not to be one, the lexer
+// flushes the accumulated codepoints as tokens worked out in advance for each
+// point where the match can fail, so nothing is ever lexed twice.
+//
+// Every token records the lexer's resume state from just before its first
+// codepoint, so that the relexer can put a lexer back there with resume and
+// lex an edit without starting over or guessing how far back to start.
 class lexer {
 protected:
-  using codepoint_handler = void (lexer::*)(i7_codepoint);
-  codepoint_handler			state;
-  bool					documentation_break_inhibited;
-  // The match count is only meaningful when the state is
-  // in_documentation_break.
-  unsigned				documentation_break_match_count;
-  i7_string_stream			accumulator;
+  // A row of the transition table in lexer.cpp.
+  unsigned char				state;
+  i7_string				accumulator;
   std::vector<token>			results;
+  // The resume state to record for the token being accumulated.
+  lexer_resume_state			pending_token_resume_state;
+
+  void step(i7_codepoint codepoint);
+  void take_unusual_transition(i7_codepoint codepoint);
+  void abandon_documentation_break(i7_codepoint codepoint);
+  void emit(unsigned char token_kind, const i7_string_view&text);
+  void flush(unsigned char token_kind, lexer_resume_state next_resume_state);
+  void flush(unsigned char token_kind, const i7_codepoint*beginning, const i7_codepoint*end, lexer_resume_state next_resume_state);
 
 public:
   lexer();
+  // Returns the lexer to its initial state, but keeps its storage, so that one
+  // lexer can be reused for many edits without reallocating its results.
+  void reset();
+  // Like reset, but then puts the lexer where it stood just before the first
+  // codepoint of a token recorded with resume_state.  The pending codepoints
+  // are the ones that the resume state counts, and pending_token_resume_state
+  // is what the token that they begin recorded; if there are none, it should
+  // be resume_state itself.
+  void resume(lexer_resume_state resume_state, const i7_string&pending_codepoints, lexer_resume_state pending_token_resume_state);
   void operator <<(i7_codepoint codepoint);
-  bool most_recent_codepoint_did_not_combine() const;
+  void operator <<(const i7_string_view&codepoints);
+  // What a token beginning with the next codepoint would record.
+  lexer_resume_state get_resume_state() const;
+  lexer_resume_state get_pending_token_resume_state() const;
+  // The number of codepoints that a lexer resuming from resume_state must be
+  // given as pending.
+  static unsigned get_pending_codepoint_count(lexer_resume_state resume_state);
+  // The same resume state with count more codepoints pending, as when a word
+  // that was pending is lengthened without being relexed.
+  static lexer_resume_state add_pending_codepoints(lexer_resume_state resume_state, unsigned count);
+  // True if the two lexers will produce the same tokens from here on, whatever
+  // codepoints they are fed.
+  bool is_synchronized_with(const lexer&other) const;
   const std::vector<token>&get_results() const;
-
-protected:
-  void undecided(i7_codepoint codepoint);
-  void after_single_quote(i7_codepoint codepoint);
-  void after_two_single_quotes(i7_codepoint codepoint);
-  void in_whitespace(i7_codepoint codepoint);
-  void after_carriage_return(i7_codepoint codepoint);
-  void after_line_feed(i7_codepoint codepoint);
-  void after_newline(i7_codepoint codepoint);
-  void in_indentation(i7_codepoint codepoint);
-  void in_word(i7_codepoint codepoint);
-  void after_open_parenthesis(i7_codepoint codepoint);
-  void after_hyphen(i7_codepoint codepoint);
-  void after_plus(i7_codepoint codepoint);
-  void in_documentation_break(i7_codepoint codepoint);
-  void after_documentation_break_ended_by_carriage_return(i7_codepoint codepoint);
-  void after_documentation_break_ended_by_line_feed(i7_codepoint codepoint);
-  void after_documentation_break_ended_by_newline(i7_codepoint codepoint);
-  void in_indentation_after_documentation_break(i7_codepoint codepoint);
 };
 
 #endif
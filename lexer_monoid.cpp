@@ -1,6 +1,18 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
-#include <cstring> // For memcpy.
+#include <cstring> // For memcpy and memcmp.
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
+#include "internalizer.hpp"
 #include "lexer_monoid.hpp"
 
 using namespace std;
@@ -148,11 +160,67 @@ ostream&operator <<(ostream&out, lexical_state state) {
   return out;
 }
 
-// Set composition_comment_images (which should be empty on entry) to the
-// comment images for superstate in a composition of the two lexer monoid
-// elements this and other, where, as a convenience, own_comment_images and
-// other_comment_images already reference their comment images.
-void lexer_monoid::compose(vector<lexical_state>&composition_comment_images, lexical_superstate superstate, const vector<lexical_state>&own_comment_images, const lexer_monoid&other, const vector<lexical_state>&other_comment_images) const {
+static_assert(std::is_trivially_copyable<lexer_monoid_function>::value, "Lexer monoid functions should copy as plain bytes.");
+static_assert(INLINE_COMMENT_IMAGE_CAPACITY * sizeof(lexical_state) >= sizeof(const lexical_state*), "Inline comment images should have room for a pointer to interned ones.");
+
+namespace std {
+  template<>struct hash<vector<lexical_state>> {
+    size_t operator ()(const vector<lexical_state>&comment_images) const {
+      size_t result = static_cast<size_t>(14695981039346656037ULL);
+      for (lexical_state state : comment_images) {
+	result = (result ^ (state.get_superstate() << 8 | state.get_comment_depth())) * static_cast<size_t>(1099511628211ULL);
+      }
+      return result;
+    }
+  };
+}
+
+// Comment images too numerous to store inline are interned here.  They are
+// never released, since lexer_monoid_functions are copied as plain bytes and so cannot
+// count their references, but they only arise from comments left open several
+// deep, and each distinct set is kept once.
+static internalizer<vector<lexical_state>>deep_comment_images;
+
+// The most depths that can be special-cased for any one superstate; deeper
+// preimages would not fit in a lexical_state.
+static const unsigned MAXIMUM_COMMENT_IMAGE_COUNT = UINT8_MAX;
+
+unsigned lexer_monoid_function::get_comment_image_count() const {
+  unsigned result = 0;
+  for (unsigned i = COUNT_OF_LEXICAL_SUPERSTATES_WITH_I7_COMMENT_LEVELS; i--;) {
+    result += comment_image_counts[i];
+  }
+  return result;
+}
+
+const lexical_state*lexer_monoid_function::get_comment_images() const {
+  if (get_comment_image_count() <= INLINE_COMMENT_IMAGE_CAPACITY) {
+    return inline_comment_images;
+  }
+  const lexical_state*result;
+  memcpy(&result, inline_comment_images, sizeof(result));
+  return result;
+}
+
+// Store count comment images, laid out as described in lexer_monoid.hpp, given
+// that comment_image_counts is already set to match.
+void lexer_monoid_function::set_comment_images(const lexical_state*beginning, unsigned count) {
+  assert(count == get_comment_image_count());
+  fill(begin(inline_comment_images), end(inline_comment_images), lexical_state{I7});
+  if (count <= INLINE_COMMENT_IMAGE_CAPACITY) {
+    copy(beginning, beginning + count, inline_comment_images);
+  } else {
+    const lexical_state*interned = deep_comment_images.acquire(vector<lexical_state>{beginning, beginning + count}).data();
+    memcpy(static_cast<void*>(inline_comment_images), &interned, sizeof(interned));
+  }
+}
+
+// Write to composition_comment_images, and return the count of, the comment
+// images for superstate in a composition of the two lexer monoid elements this
+// and other, where, as a convenience, own_comment_images and
+// other_comment_images already point to their comment images for superstate.
+unsigned lexer_monoid_function::compose(lexical_state*composition_comment_images, lexical_superstate superstate, const lexical_state*own_comment_images, unsigned own_comment_image_count, const lexer_monoid_function&other, const lexical_state*other_comment_images, unsigned other_comment_image_count) const {
+  unsigned count = 0;
   // A element in the preimage should be special-cased if 1) it is already
   // special-cased by own_comment_images, 2) its comment depth plus the
   // comment_depth_change brings it to an uncommented state, or 3) its comment
@@ -160,32 +228,40 @@ void lexer_monoid::compose(vector<lexical_state>&composition_comment_images, lex
   // of other_comment_images.
   //
   // Case 1:
-  for (const lexical_state&state : own_comment_images) {
-    composition_comment_images.push_back(other(state));
+  for (unsigned index = 0; index < own_comment_image_count; ++index) {
+    composition_comment_images[count++] = other(own_comment_images[index]);
   }
   // Case 2:
   //
   // Note that negative comment depths should be impossible.
-  if (comment_depth_change + own_comment_images.size() + 1 == 0) {
-    composition_comment_images.push_back(other(superstate));
+  if (comment_depth_change + own_comment_image_count + 1 == 0 && count < MAXIMUM_COMMENT_IMAGE_COUNT) {
+    composition_comment_images[count++] = other(superstate);
   }
   // Case 3:
   //
-  // I was tempted to use insert here, but a loop just read better.  Note that
+  // I was tempted to use copy here, but a loop just read better.  Note that
   // index is the index into other_comment_images; the loop bounds are confusing
-  // if you try to read them without knowing that.
-  for (unsigned index = own_comment_images.size() + comment_depth_change; index < other_comment_images.size(); ++index) {
-    composition_comment_images.push_back(other_comment_images[index]);
+  // if you try to read them without knowing that.  In particular, the first
+  // index is minus one exactly when case 2 applied, in which case the next
+  // depth starts at index zero.
+  int first_index = static_cast<int>(own_comment_image_count) + comment_depth_change;
+  for (unsigned index = first_index < 0 ? 0 : first_index; index < other_comment_image_count && count < MAXIMUM_COMMENT_IMAGE_COUNT; ++index) {
+    composition_comment_images[count++] = other_comment_images[index];
   }
-  // Finally, clean up any redundancies:
-  while (composition_comment_images.size() && composition_comment_images.back() == other({superstate, static_cast<unsigned>(composition_comment_images.size())})) {
-    composition_comment_images.pop_back();
+  // Finally, clean up any redundancies, special cases that agree with what
+  // operator () would compute for the composition without them:
+  int composition_comment_depth_change = comment_depth_change + other.comment_depth_change;
+  while (count && composition_comment_images[count - 1] == lexical_state{superstate, static_cast<unsigned>(static_cast<int>(count) + composition_comment_depth_change)}) {
+    --count;
   }
+  return count;
 }
 
-lexer_monoid::lexer_monoid(int8_t comment_depth_change) :
+lexer_monoid_function::lexer_monoid_function(int8_t comment_depth_change) :
   images{LEXICAL_SUPERSTATE_LIST},
-  comment_depth_change{comment_depth_change} {
+  comment_depth_change{comment_depth_change},
+  comment_image_counts{},
+  inline_comment_images{} {
   assert (comment_depth_change == -1 || comment_depth_change == 0 || comment_depth_change == 1);
   if (comment_depth_change == 1) {
     for (unsigned i = COUNT_OF_LEXICAL_SUPERSTATES_WITH_I7_COMMENT_LEVELS; i--;) {
@@ -194,273 +270,527 @@ lexer_monoid::lexer_monoid(int8_t comment_depth_change) :
   }
 }
 
-lexer_monoid::lexer_monoid(lexical_superstate from, lexical_superstate to, bool also_in_reverse) :
+lexer_monoid_function::lexer_monoid_function(lexical_superstate from, lexical_superstate to, bool also_in_reverse) :
   images{LEXICAL_SUPERSTATE_LIST},
-  comment_depth_change{0} {
+  comment_depth_change{0},
+  comment_image_counts{},
+  inline_comment_images{} {
   images[from] = to;
   if (also_in_reverse) {
     images[to] = from;
   }
 }
 
-lexer_monoid::lexer_monoid(const lexer_monoid&copy) :
-  images{copy.images[0], copy.images[1], copy.images[2], copy.images[3], copy.images[4], copy.images[5], copy.images[6], copy.images[7], copy.images[8], copy.images[9], copy.images[10], copy.images[11], copy.images[12], copy.images[13], copy.images[14], copy.images[15], copy.images[16], copy.images[17], copy.images[18], copy.images[19], copy.images[20], copy.images[21], copy.images[22], copy.images[23], copy.images[24], copy.images[25], copy.images[26], copy.images[27], copy.images[28], copy.images[29], copy.images[30], copy.images[31], copy.images[32], copy.images[33], copy.images[34], copy.images[35], copy.images[36], copy.images[37], copy.images[38], copy.images[39], copy.images[40], copy.images[41], copy.images[42], copy.images[43], copy.images[44], copy.images[45], copy.images[46]},
-  comment_depth_change{copy.comment_depth_change} {
-  for (unsigned i = COUNT_OF_LEXICAL_SUPERSTATES_WITH_I7_COMMENT_LEVELS; i--;) {
-    comment_images[i] = copy.comment_images[i];
-  }
-}
-
-lexer_monoid&lexer_monoid::operator =(const lexer_monoid&other) {
-  memcpy(&images, &other.images, sizeof(images));
-  comment_depth_change = other.comment_depth_change;
-  for (unsigned i = COUNT_OF_LEXICAL_SUPERSTATES_WITH_I7_COMMENT_LEVELS; i--;) {
-    comment_images[i] = other.comment_images[i];
-  }
-  return *this;
-}
-
-lexical_state lexer_monoid::operator ()(lexical_state state) const {
+lexical_state lexer_monoid_function::operator ()(lexical_state state) const {
   lexical_superstate superstate = state.get_superstate();
   unsigned comment_depth = state.get_comment_depth();
   if (!comment_depth) {
     return images[superstate];
   }
-  const vector<lexical_state>&comment_images_for_superstate = comment_images[commentable_index_map[superstate]];
-  if (comment_depth <= comment_images_for_superstate.size()) {
+  unsigned index = commentable_index_map[superstate];
+  if (comment_depth <= comment_image_counts[index]) {
+    const lexical_state*comment_images_for_superstate = get_comment_images();
+    for (unsigned i = index; i--;) {
+      comment_images_for_superstate += comment_image_counts[i];
+    }
     return comment_images_for_superstate[comment_depth - 1];
   }
   return {superstate, comment_depth + comment_depth_change};
 }
 
-lexer_monoid lexer_monoid::operator +(const lexer_monoid&other) const {
-  lexer_monoid result{0};
-  for (lexical_state preimage = LEXICAL_SUPERSTATE_COUNT; (preimage--).get_superstate();) {
-    result.images[preimage.get_superstate()] = other((*this)(preimage));
+// Composing the images at comment depth zero is mostly a gather: a superstate
+// whose own image is still at depth zero goes to the other function's image of
+// that image.  Images that are inside comments are fixed up one at a time.
+// Each of the following kernels writes the composition of own_images and other
+// (whose images are passed as other_images) to composition_images, relying on a
+// lexical_state being its superstate byte followed by its comment depth byte.
+using images_kernel = void (*)(const lexical_state*own_images, const lexer_monoid_function&other, const lexical_state*other_images, lexical_state*composition_images);
+
+static_assert(sizeof(lexical_state) == 2, "Lexical states should be two bytes, as the composition kernels expect.");
+
+static const size_t IMAGES_SIZE = LEXICAL_SUPERSTATE_COUNT * sizeof(lexical_state);
+
+static void compose_images_one_by_one(const lexical_state*own_images, const lexer_monoid_function&other, const lexical_state*, lexical_state*composition_images) {
+  for (unsigned i = LEXICAL_SUPERSTATE_COUNT; i--;) {
+    composition_images[i] = other(own_images[i]);
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// With SSSE3, the images are gathered sixteen bytes at a time from the six
+// sixteen-byte slices of the other function's images.  Each slice is shuffled
+// by the byte indices less sixteen times its number, which pshufb reads as zero
+// once negative, and the slices are XORed with their predecessors beforehand,
+// so that XORing the shuffles together leaves just the byte from the right one.
+// The images are 94 bytes long, so the last slice is loaded and stored two
+// bytes early and shifted into place.
+static const unsigned SLICE_COUNT = (IMAGES_SIZE + 15) / 16;
+static const unsigned LAST_SLICE_SHIFT = 16 * SLICE_COUNT - IMAGES_SIZE;
+
+__attribute__((target("ssse3"))) static void compose_images_with_shuffles(const lexical_state*own_images, const lexer_monoid_function&other, const lexical_state*other_images, lexical_state*composition_images) {
+  const __m128i*own_bytes = reinterpret_cast<const __m128i*>(own_images);
+  const __m128i*other_bytes = reinterpret_cast<const __m128i*>(other_images);
+  __m128i*composition_bytes = reinterpret_cast<__m128i*>(composition_images);
+  const __m128i superstate_bytes = _mm_setr_epi8(0, 0, 2, 2, 4, 4, 6, 6, 8, 8, 10, 10, 12, 12, 14, 14);
+  const __m128i depth_offsets = _mm_set1_epi16(0x0100);
+  const __m128i depth_bytes = _mm_set1_epi16(static_cast<short>(0xFF00));
+  const __m128i slice_size = _mm_set1_epi8(16);
+  __m128i own[SLICE_COUNT], slices[SLICE_COUNT], gathered[SLICE_COUNT];
+  for (unsigned slice = 0; slice < SLICE_COUNT - 1; ++slice) {
+    own[slice] = _mm_loadu_si128(own_bytes + slice);
+    slices[slice] = _mm_loadu_si128(other_bytes + slice);
+  }
+  const unsigned char*last_own_bytes = reinterpret_cast<const unsigned char*>(own_images) + IMAGES_SIZE - 16;
+  const unsigned char*last_other_bytes = reinterpret_cast<const unsigned char*>(other_images) + IMAGES_SIZE - 16;
+  own[SLICE_COUNT - 1] = _mm_srli_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(last_own_bytes)), LAST_SLICE_SHIFT);
+  slices[SLICE_COUNT - 1] = _mm_srli_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(last_other_bytes)), LAST_SLICE_SHIFT);
+  for (unsigned slice = SLICE_COUNT; --slice;) {
+    slices[slice] = _mm_xor_si128(slices[slice], slices[slice - 1]);
+  }
+  unsigned commented[SLICE_COUNT];
+  for (unsigned chunk = 0; chunk < SLICE_COUNT; ++chunk) {
+    __m128i superstates = _mm_shuffle_epi8(own[chunk], superstate_bytes);
+    __m128i indices = _mm_add_epi8(_mm_add_epi8(superstates, superstates), depth_offsets);
+    gathered[chunk] = _mm_setzero_si128();
+    for (unsigned slice = 0; slice < SLICE_COUNT; ++slice) {
+      gathered[chunk] = _mm_xor_si128(gathered[chunk], _mm_shuffle_epi8(slices[slice], indices));
+      indices = _mm_sub_epi8(indices, slice_size);
+    }
+    commented[chunk] = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(own[chunk], depth_bytes), _mm_setzero_si128())) & (0xFFFF >> (chunk == SLICE_COUNT - 1 ? LAST_SLICE_SHIFT : 0));
   }
+  // The last slice goes first, since its shift clobbers the end of the one
+  // before it.
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(reinterpret_cast<unsigned char*>(composition_images) + IMAGES_SIZE - 16), _mm_slli_si128(gathered[SLICE_COUNT - 1], LAST_SLICE_SHIFT));
+  for (unsigned chunk = 0; chunk < SLICE_COUNT - 1; ++chunk) {
+    _mm_storeu_si128(composition_bytes + chunk, gathered[chunk]);
+  }
+  for (unsigned chunk = 0; chunk < SLICE_COUNT; ++chunk) {
+    for (; commented[chunk]; commented[chunk] &= commented[chunk] - 1) {
+      unsigned i = 8 * chunk + __builtin_ctz(commented[chunk]) / 2;
+      composition_images[i] = other(own_images[i]);
+    }
+  }
+}
+
+// With AVX-512 VBMI, both functions' images fit in two registers each, and one
+// two-table permute gathers each register's worth.
+__attribute__((target("avx512f,avx512bw,avx512vbmi"))) static void compose_images_with_permutes(const lexical_state*own_images, const lexer_monoid_function&other, const lexical_state*other_images, lexical_state*composition_images) {
+  const __mmask64 tail = (static_cast<__mmask64>(1) << (IMAGES_SIZE - 64)) - 1;
+  const unsigned char*own_bytes = reinterpret_cast<const unsigned char*>(own_images);
+  const unsigned char*other_bytes = reinterpret_cast<const unsigned char*>(other_images);
+  unsigned char*composition_bytes = reinterpret_cast<unsigned char*>(composition_images);
+  const __m512i superstate_bytes = _mm512_set_epi64(0x3E3E3C3C3A3A3838, 0x3636343432323030, 0x2E2E2C2C2A2A2828, 0x2626242422222020, 0x1E1E1C1C1A1A1818, 0x1616141412121010, 0x0E0E0C0C0A0A0808, 0x0606040402020000);
+  const __m512i depth_offsets = _mm512_set1_epi16(0x0100);
+  const __m512i depth_bytes = _mm512_set1_epi16(static_cast<short>(0xFF00));
+  __m512i own[2] = {_mm512_loadu_si512(own_bytes), _mm512_maskz_loadu_epi8(tail, own_bytes + 64)};
+  __m512i low_table = _mm512_loadu_si512(other_bytes), high_table = _mm512_maskz_loadu_epi8(tail, other_bytes + 64);
+  __m512i gathered[2];
+  for (unsigned half = 0; half < 2; ++half) {
+    __m512i superstates = _mm512_permutex2var_epi8(own[half], superstate_bytes, own[half]);
+    __m512i indices = _mm512_add_epi8(_mm512_add_epi8(superstates, superstates), depth_offsets);
+    gathered[half] = _mm512_permutex2var_epi8(low_table, indices, high_table);
+  }
+  _mm512_storeu_si512(composition_bytes, gathered[0]);
+  _mm512_mask_storeu_epi8(composition_bytes + 64, tail, gathered[1]);
+  for (unsigned half = 0; half < 2; ++half) {
+    for (uint64_t commented = _mm512_test_epi8_mask(own[half], depth_bytes); commented; commented &= commented - 1) {
+      unsigned i = 32 * half + __builtin_ctzll(commented) / 2;
+      composition_images[i] = other(own_images[i]);
+    }
+  }
+}
+#endif
+
+static images_kernel choose_images_kernel() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512vbmi") && __builtin_cpu_supports("avx512bw")) {
+    return compose_images_with_permutes;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return compose_images_with_shuffles;
+  }
+#endif
+  return compose_images_one_by_one;
+}
+
+lexer_monoid_function lexer_monoid_function::operator +(const lexer_monoid_function&other) const {
+  static const images_kernel compose_images = choose_images_kernel();
+  lexer_monoid_function result{0};
+  compose_images(images, other, other.images, result.images);
   result.comment_depth_change = comment_depth_change + other.comment_depth_change;
-  for (unsigned i = COUNT_OF_LEXICAL_SUPERSTATES_WITH_I7_COMMENT_LEVELS; i--;) {
+  lexical_state composition_comment_images[COUNT_OF_LEXICAL_SUPERSTATES_WITH_I7_COMMENT_LEVELS * MAXIMUM_COMMENT_IMAGE_COUNT];
+  const lexical_state*own_comment_images = get_comment_images(), *other_comment_images = other.get_comment_images();
+  unsigned count = 0;
+  for (unsigned i = 0; i < COUNT_OF_LEXICAL_SUPERSTATES_WITH_I7_COMMENT_LEVELS; ++i) {
     lexical_superstate superstate = commentable_superstate_map[i];
-    compose(result.comment_images[i], superstate, comment_images[i], other, other.comment_images[i]);
+    result.comment_image_counts[i] = compose(composition_comment_images + count, superstate, own_comment_images, comment_image_counts[i], other, other_comment_images, other.comment_image_counts[i]);
+    count += result.comment_image_counts[i];
+    own_comment_images += comment_image_counts[i];
+    other_comment_images += other.comment_image_counts[i];
+  }
+  if (count) {
+    result.set_comment_images(composition_comment_images, count);
   }
   return result;
 }
 
-lexer_monoid&lexer_monoid::operator +=(const lexer_monoid&other) {
-  return (*this) = (*this) + other;
+// Because equal functions are equal byte for byte, they can be compared and
+// hashed as bytes.
+bool lexer_monoid_function::operator ==(const lexer_monoid_function&other) const {
+  return !memcmp(this, &other, sizeof(lexer_monoid_function));
 }
 
-ostream&operator <<(ostream&out, const lexer_monoid&element) {
+// FNV-1a, a byte at a time.
+size_t lexer_monoid_function::hash() const {
+  size_t result = static_cast<size_t>(14695981039346656037ULL);
+  const unsigned char*bytes = reinterpret_cast<const unsigned char*>(this);
+  for (size_t index = 0; index < sizeof(lexer_monoid_function); ++index) {
+    result = (result ^ bytes[index]) * static_cast<size_t>(1099511628211ULL);
+  }
+  return result;
+}
+
+ostream&operator <<(ostream&out, const lexer_monoid_function&function) {
   out << "{ ";
   for (lexical_state preimage = static_cast<lexical_superstate>(0); preimage.get_superstate() < LEXICAL_SUPERSTATE_COUNT; ++preimage) {
-    lexical_state postimage = element(preimage);
+    lexical_state postimage = function(preimage);
     if (preimage != postimage) {
       out << preimage << " to " << postimage << ", ";
     }
   }
   for (unsigned i = COUNT_OF_LEXICAL_SUPERSTATES_WITH_I7_COMMENT_LEVELS; i--;) {
-    for (unsigned comment_depth = 1; comment_depth <= element.comment_images[i].size(); ++comment_depth) {
+    for (unsigned comment_depth = 1; comment_depth <= function.comment_image_counts[i]; ++comment_depth) {
       lexical_state preimage = {commentable_superstate_map[i], comment_depth};
-      lexical_state postimage = element(preimage);
+      lexical_state postimage = function(preimage);
       if (preimage != postimage) {
 	out << preimage << " to " << postimage << ", ";
       }
     }
   }
-  return out << "redepth by " << static_cast<int>(element.comment_depth_change) << " }";
+  return out << "redepth by " << static_cast<int>(function.comment_depth_change) << " }";
+}
+
+// Interned functions are stored in segments that double in size, the highest
+// set bit of an id plus one choosing the segment, so that they never move and
+// can be read without locking while others are added.  Segments are allocated
+// as needed and never freed.
+static const unsigned FUNCTION_SEGMENT_COUNT = 32;
+static atomic<lexer_monoid_function*>function_segments[FUNCTION_SEGMENT_COUNT];
+
+namespace {
+  struct function_hash {
+    size_t operator ()(const lexer_monoid_function&function) const {
+      return function.hash();
+    }
+  };
+
+  // The interning table proper.  It is constructed on first use, so that it is
+  // ready for the constants below whatever the order of static
+  // initialization, and it interns the identity first, as id zero.
+  class function_table {
+  protected:
+    unordered_map<lexer_monoid_function, lexer_monoid_id, function_hash>ids;
+    // Large buffers are lexed on several threads (see parallel_lexer.hpp), all
+    // of which compose lexer_monoids.
+    mutex				table_mutex;
+
+  public:
+    function_table() {
+      acquire(lexer_monoid_function{0});
+    }
+
+    lexer_monoid_id acquire(const lexer_monoid_function&function) {
+      lock_guard<mutex>lock{table_mutex};
+      auto iterator = ids.find(function);
+      if (iterator != ids.end()) {
+	return iterator->second;
+      }
+      lexer_monoid_id id = static_cast<lexer_monoid_id>(ids.size());
+      assert(id + 1);
+      unsigned segment = 31 - __builtin_clz(id + 1);
+      lexer_monoid_function*storage = function_segments[segment].load(memory_order_relaxed);
+      if (!storage) {
+	storage = static_cast<lexer_monoid_function*>(::operator new(sizeof(lexer_monoid_function) << segment));
+	function_segments[segment].store(storage, memory_order_release);
+      }
+      new(storage + (id + 1 - (1U << segment))) lexer_monoid_function{function};
+      ids.emplace(function, id);
+      return id;
+    }
+
+    size_t size() {
+      lock_guard<mutex>lock{table_mutex};
+      return ids.size();
+    }
+  };
+}
+
+static function_table&get_function_table() {
+  static function_table table;
+  return table;
+}
+
+// Each thread keeps its own direct-mapped cache of compositions, so that hits
+// need no locking.  The entries start zeroed, which is correct as it stands,
+// since id zero is the identity.
+namespace {
+  struct composition_cache_entry {
+    lexer_monoid_id			left;
+    lexer_monoid_id			right;
+    lexer_monoid_id			sum;
+  };
+}
+
+static const unsigned COMPOSITION_CACHE_BITS = 12;
+static thread_local composition_cache_entry composition_cache[1 << COMPOSITION_CACHE_BITS];
+
+static composition_cache_entry&get_composition_cache_entry(lexer_monoid_id left, lexer_monoid_id right) {
+  uint32_t mixed = left * 0x9E3779B1U + right * 0x85EBCA6BU;
+  return composition_cache[mixed >> (32 - COMPOSITION_CACHE_BITS)];
+}
+
+lexer_monoid lexer_monoid::from_id(lexer_monoid_id id) {
+  lexer_monoid result;
+  result.id = id;
+  return result;
+}
+
+lexer_monoid::lexer_monoid(int8_t comment_depth_change) :
+  id{comment_depth_change ? get_function_table().acquire(lexer_monoid_function{comment_depth_change}) : 0} {}
+
+lexer_monoid::lexer_monoid(lexical_superstate from, lexical_superstate to, bool also_in_reverse) :
+  id{get_function_table().acquire(lexer_monoid_function{from, to, also_in_reverse})} {}
+
+lexer_monoid::lexer_monoid(const lexer_monoid_function&function) :
+  id{get_function_table().acquire(function)} {}
+
+const lexer_monoid_function&lexer_monoid::get_function() const {
+  unsigned segment = 31 - __builtin_clz(id + 1);
+  return function_segments[segment].load(memory_order_acquire)[id + 1 - (1U << segment)];
+}
+
+lexical_state lexer_monoid::operator ()(lexical_state state) const {
+  return get_function()(state);
+}
+
+lexer_monoid lexer_monoid::operator +(const lexer_monoid&other) const {
+  if (!other.id) {
+    return *this;
+  }
+  if (!id) {
+    return other;
+  }
+  composition_cache_entry&entry = get_composition_cache_entry(id, other.id);
+  if (entry.left != id || entry.right != other.id) {
+    entry = {id, other.id, get_function_table().acquire(get_function() + other.get_function())};
+  }
+  return from_id(entry.sum);
+}
+
+lexer_monoid&lexer_monoid::operator +=(const lexer_monoid&other) {
+  return (*this) = (*this) + other;
+}
+
+size_t lexer_monoid::get_function_count() {
+  return get_function_table().size();
+}
+
+ostream&operator <<(ostream&out, const lexer_monoid&element) {
+  return out << element.get_function();
 }
 
 const lexical_state INITIAL_LEXICAL_STATE = {I7};
 
 const lexer_monoid plain_text =
-  lexer_monoid{0};
+  lexer_monoid_function{0};
 
 const lexer_monoid double_quote =
-  lexer_monoid{I7, I7_STRING, true} +
-  lexer_monoid{I7_SUBSTITUTION, I7} +
-  lexer_monoid{I6, I6_STRING, true} +
-  lexer_monoid{I6_IN_ROUTINE, I6_STRING_IN_ROUTINE, true} +
-  lexer_monoid{I7_IN_I6, I7_STRING_IN_I6, true} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6, I7_IN_I6} +
-  lexer_monoid{I7_IN_I6_COMMENT, I7_STRING_IN_I6_COMMENT, true} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT, I7_IN_I6_COMMENT} +
-  lexer_monoid{I7_IN_I6_IN_ROUTINE, I7_STRING_IN_I6_IN_ROUTINE, true} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_IN_ROUTINE, I7_IN_I6_IN_ROUTINE} +
-  lexer_monoid{I7_IN_I6_COMMENT_IN_ROUTINE, I7_STRING_IN_I6_COMMENT_IN_ROUTINE, true} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE, I7_IN_I6_COMMENT_IN_ROUTINE} +
-  lexer_monoid{I7_IN_EXTRACT, I7_STRING_IN_EXTRACT, true} +
-  lexer_monoid{I7_SUBSTITUTION_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I6_IN_EXTRACT, I6_STRING_IN_EXTRACT, true} +
-  lexer_monoid{I6_IN_ROUTINE_IN_EXTRACT, I6_STRING_IN_ROUTINE_IN_EXTRACT, true} +
-  lexer_monoid{I7_IN_I6_IN_EXTRACT, I7_STRING_IN_I6_IN_EXTRACT, true} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_IN_EXTRACT, I7_IN_I6_IN_EXTRACT} +
-  lexer_monoid{I7_IN_I6_COMMENT_IN_EXTRACT, I7_STRING_IN_I6_COMMENT_IN_EXTRACT, true} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT_IN_EXTRACT, I7_IN_I6_COMMENT_IN_EXTRACT} +
-  lexer_monoid{I7_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_STRING_IN_I6_IN_ROUTINE_IN_EXTRACT, true} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_IN_I6_IN_ROUTINE_IN_EXTRACT} +
-  lexer_monoid{I7_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_STRING_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, true} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT};
+  lexer_monoid_function{I7, I7_STRING, true} +
+  lexer_monoid_function{I7_SUBSTITUTION, I7} +
+  lexer_monoid_function{I6, I6_STRING, true} +
+  lexer_monoid_function{I6_IN_ROUTINE, I6_STRING_IN_ROUTINE, true} +
+  lexer_monoid_function{I7_IN_I6, I7_STRING_IN_I6, true} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6, I7_IN_I6} +
+  lexer_monoid_function{I7_IN_I6_COMMENT, I7_STRING_IN_I6_COMMENT, true} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT, I7_IN_I6_COMMENT} +
+  lexer_monoid_function{I7_IN_I6_IN_ROUTINE, I7_STRING_IN_I6_IN_ROUTINE, true} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_IN_ROUTINE, I7_IN_I6_IN_ROUTINE} +
+  lexer_monoid_function{I7_IN_I6_COMMENT_IN_ROUTINE, I7_STRING_IN_I6_COMMENT_IN_ROUTINE, true} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE, I7_IN_I6_COMMENT_IN_ROUTINE} +
+  lexer_monoid_function{I7_IN_EXTRACT, I7_STRING_IN_EXTRACT, true} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I6_IN_EXTRACT, I6_STRING_IN_EXTRACT, true} +
+  lexer_monoid_function{I6_IN_ROUTINE_IN_EXTRACT, I6_STRING_IN_ROUTINE_IN_EXTRACT, true} +
+  lexer_monoid_function{I7_IN_I6_IN_EXTRACT, I7_STRING_IN_I6_IN_EXTRACT, true} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_IN_EXTRACT, I7_IN_I6_IN_EXTRACT} +
+  lexer_monoid_function{I7_IN_I6_COMMENT_IN_EXTRACT, I7_STRING_IN_I6_COMMENT_IN_EXTRACT, true} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT_IN_EXTRACT, I7_IN_I6_COMMENT_IN_EXTRACT} +
+  lexer_monoid_function{I7_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_STRING_IN_I6_IN_ROUTINE_IN_EXTRACT, true} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_IN_I6_IN_ROUTINE_IN_EXTRACT} +
+  lexer_monoid_function{I7_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_STRING_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, true} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT};
 
 const lexer_monoid left_bracket =
-  lexer_monoid{I7_STRING, I7_SUBSTITUTION} +
-  lexer_monoid{I6, I6_IN_ROUTINE} +
-  lexer_monoid{I7_STRING_IN_I6, I7_SUBSTITUTION_IN_I6} +
-  lexer_monoid{I7_STRING_IN_I6_COMMENT, I7_SUBSTITUTION_IN_I6_COMMENT} +
-  lexer_monoid{I7_STRING_IN_I6_IN_ROUTINE, I7_SUBSTITUTION_IN_I6_IN_ROUTINE} +
-  lexer_monoid{I7_STRING_IN_I6_COMMENT_IN_ROUTINE, I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE} +
-  lexer_monoid{I7_STRING_IN_EXTRACT, I7_SUBSTITUTION_IN_EXTRACT} +
-  lexer_monoid{I6_IN_EXTRACT, I6_IN_ROUTINE_IN_EXTRACT} +
-  lexer_monoid{I7_STRING_IN_I6_IN_EXTRACT, I7_SUBSTITUTION_IN_I6_IN_EXTRACT} +
-  lexer_monoid{I7_STRING_IN_I6_COMMENT_IN_EXTRACT, I7_SUBSTITUTION_IN_I6_COMMENT_IN_EXTRACT} +
-  lexer_monoid{I7_STRING_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_SUBSTITUTION_IN_I6_IN_ROUTINE_IN_EXTRACT} +
-  lexer_monoid{I7_STRING_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT} +
-  lexer_monoid{1};
+  lexer_monoid_function{I7_STRING, I7_SUBSTITUTION} +
+  lexer_monoid_function{I6, I6_IN_ROUTINE} +
+  lexer_monoid_function{I7_STRING_IN_I6, I7_SUBSTITUTION_IN_I6} +
+  lexer_monoid_function{I7_STRING_IN_I6_COMMENT, I7_SUBSTITUTION_IN_I6_COMMENT} +
+  lexer_monoid_function{I7_STRING_IN_I6_IN_ROUTINE, I7_SUBSTITUTION_IN_I6_IN_ROUTINE} +
+  lexer_monoid_function{I7_STRING_IN_I6_COMMENT_IN_ROUTINE, I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE} +
+  lexer_monoid_function{I7_STRING_IN_EXTRACT, I7_SUBSTITUTION_IN_EXTRACT} +
+  lexer_monoid_function{I6_IN_EXTRACT, I6_IN_ROUTINE_IN_EXTRACT} +
+  lexer_monoid_function{I7_STRING_IN_I6_IN_EXTRACT, I7_SUBSTITUTION_IN_I6_IN_EXTRACT} +
+  lexer_monoid_function{I7_STRING_IN_I6_COMMENT_IN_EXTRACT, I7_SUBSTITUTION_IN_I6_COMMENT_IN_EXTRACT} +
+  lexer_monoid_function{I7_STRING_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_SUBSTITUTION_IN_I6_IN_ROUTINE_IN_EXTRACT} +
+  lexer_monoid_function{I7_STRING_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT} +
+  lexer_monoid_function{1};
 
 const lexer_monoid right_bracket =
-  lexer_monoid{I7_SUBSTITUTION, I7_STRING} +
-  lexer_monoid{I6_IN_ROUTINE, I6} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6, I7_STRING_IN_I6} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT, I7_STRING_IN_I6_COMMENT} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_IN_ROUTINE, I7_STRING_IN_I6_IN_ROUTINE} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE, I7_STRING_IN_I6_COMMENT_IN_ROUTINE} +
-  lexer_monoid{I7_SUBSTITUTION_IN_EXTRACT, I7_STRING_IN_EXTRACT} +
-  lexer_monoid{I6_IN_ROUTINE_IN_EXTRACT, I6_IN_EXTRACT} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_IN_EXTRACT, I7_STRING_IN_I6_IN_EXTRACT} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT_IN_EXTRACT, I7_STRING_IN_I6_COMMENT_IN_EXTRACT} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_STRING_IN_I6_IN_ROUTINE_IN_EXTRACT} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_STRING_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT} +
-  lexer_monoid{-1};
+  lexer_monoid_function{I7_SUBSTITUTION, I7_STRING} +
+  lexer_monoid_function{I6_IN_ROUTINE, I6} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6, I7_STRING_IN_I6} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT, I7_STRING_IN_I6_COMMENT} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_IN_ROUTINE, I7_STRING_IN_I6_IN_ROUTINE} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE, I7_STRING_IN_I6_COMMENT_IN_ROUTINE} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_EXTRACT, I7_STRING_IN_EXTRACT} +
+  lexer_monoid_function{I6_IN_ROUTINE_IN_EXTRACT, I6_IN_EXTRACT} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_IN_EXTRACT, I7_STRING_IN_I6_IN_EXTRACT} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT_IN_EXTRACT, I7_STRING_IN_I6_COMMENT_IN_EXTRACT} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_STRING_IN_I6_IN_ROUTINE_IN_EXTRACT} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_STRING_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT} +
+  lexer_monoid_function{-1};
 
 const lexer_monoid documentation_break =
-  lexer_monoid{I7, I7_EXTENSION_DOCUMENTATION};
+  lexer_monoid_function{I7, I7_EXTENSION_DOCUMENTATION};
 
 const lexer_monoid documentation_break_followed_by_indentation =
-  lexer_monoid{I7, I7_IN_EXTRACT};
+  lexer_monoid_function{I7, I7_IN_EXTRACT};
 
 const lexer_monoid indentation =
-  lexer_monoid{I7_EXTENSION_DOCUMENTATION, I7_IN_EXTRACT} +
-  lexer_monoid{I6_COMMENT, I6} +
-  lexer_monoid{I6_COMMENT_IN_ROUTINE, I6_IN_ROUTINE} +
-  lexer_monoid{I6_COMMENT_IN_EXTRACT, I6_IN_EXTRACT} +
-  lexer_monoid{I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I6_IN_ROUTINE_IN_EXTRACT};
+  lexer_monoid_function{I7_EXTENSION_DOCUMENTATION, I7_IN_EXTRACT} +
+  lexer_monoid_function{I6_COMMENT, I6} +
+  lexer_monoid_function{I6_COMMENT_IN_ROUTINE, I6_IN_ROUTINE} +
+  lexer_monoid_function{I6_COMMENT_IN_EXTRACT, I6_IN_EXTRACT} +
+  lexer_monoid_function{I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I6_IN_ROUTINE_IN_EXTRACT};
 
 const lexer_monoid bare_newline =
-  lexer_monoid{I6_COMMENT, I6} +
-  lexer_monoid{I6_COMMENT_IN_ROUTINE, I6_IN_ROUTINE} +
-  lexer_monoid{I7_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I7_STRING_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I7_SUBSTITUTION_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I6_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I6_CHARACTER_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I6_STRING_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I6_COMMENT_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I6_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I6_CHARACTER_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I6_STRING_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I7_IN_I6_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I7_STRING_IN_I6_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I7_IN_I6_COMMENT_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I7_STRING_IN_I6_COMMENT_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I7_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I7_STRING_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I7_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I7_STRING_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION};
+  lexer_monoid_function{I6_COMMENT, I6} +
+  lexer_monoid_function{I6_COMMENT_IN_ROUTINE, I6_IN_ROUTINE} +
+  lexer_monoid_function{I7_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I7_STRING_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I6_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I6_CHARACTER_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I6_STRING_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I6_COMMENT_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I6_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I6_CHARACTER_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I6_STRING_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I7_IN_I6_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I7_STRING_IN_I6_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I7_IN_I6_COMMENT_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I7_STRING_IN_I6_COMMENT_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I7_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I7_STRING_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I7_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I7_STRING_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_EXTENSION_DOCUMENTATION};
 
 const lexer_monoid left_cyclops =
-  lexer_monoid{I7, I6} +
-  lexer_monoid{I7_IN_EXTRACT, I6_IN_EXTRACT};
+  lexer_monoid_function{I7, I6} +
+  lexer_monoid_function{I7_IN_EXTRACT, I6_IN_EXTRACT};
 
 const lexer_monoid right_cyclops =
-  lexer_monoid{I6, I7} +
-  lexer_monoid{I6_CHARACTER, I7} +
-  lexer_monoid{I6_STRING, I7} +
-  lexer_monoid{I6_COMMENT, I7} +
-  lexer_monoid{I7_IN_I6, I7} +
-  lexer_monoid{I7_STRING_IN_I6, I7} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6, I7} +
-  lexer_monoid{I7_IN_I6_COMMENT, I7} +
-  lexer_monoid{I7_STRING_IN_I6_COMMENT, I7} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT, I7} +
-  lexer_monoid{I6_IN_ROUTINE, I7} +
-  lexer_monoid{I6_CHARACTER_IN_ROUTINE, I7} +
-  lexer_monoid{I6_STRING_IN_ROUTINE, I7} +
-  lexer_monoid{I6_COMMENT_IN_ROUTINE, I7} +
-  lexer_monoid{I7_IN_I6_IN_ROUTINE, I7} +
-  lexer_monoid{I7_STRING_IN_I6_IN_ROUTINE, I7} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_IN_ROUTINE, I7} +
-  lexer_monoid{I7_IN_I6_COMMENT_IN_ROUTINE, I7} +
-  lexer_monoid{I7_STRING_IN_I6_COMMENT_IN_ROUTINE, I7} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE, I7} +
-  lexer_monoid{I6_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I6_CHARACTER_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I6_STRING_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I6_COMMENT_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I7_IN_I6_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I7_STRING_IN_I6_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I7_IN_I6_COMMENT_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I7_STRING_IN_I6_COMMENT_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I6_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I6_CHARACTER_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I6_STRING_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I7_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I7_STRING_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I7_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I7_STRING_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT};
+  lexer_monoid_function{I6, I7} +
+  lexer_monoid_function{I6_CHARACTER, I7} +
+  lexer_monoid_function{I6_STRING, I7} +
+  lexer_monoid_function{I6_COMMENT, I7} +
+  lexer_monoid_function{I7_IN_I6, I7} +
+  lexer_monoid_function{I7_STRING_IN_I6, I7} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6, I7} +
+  lexer_monoid_function{I7_IN_I6_COMMENT, I7} +
+  lexer_monoid_function{I7_STRING_IN_I6_COMMENT, I7} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT, I7} +
+  lexer_monoid_function{I6_IN_ROUTINE, I7} +
+  lexer_monoid_function{I6_CHARACTER_IN_ROUTINE, I7} +
+  lexer_monoid_function{I6_STRING_IN_ROUTINE, I7} +
+  lexer_monoid_function{I6_COMMENT_IN_ROUTINE, I7} +
+  lexer_monoid_function{I7_IN_I6_IN_ROUTINE, I7} +
+  lexer_monoid_function{I7_STRING_IN_I6_IN_ROUTINE, I7} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_IN_ROUTINE, I7} +
+  lexer_monoid_function{I7_IN_I6_COMMENT_IN_ROUTINE, I7} +
+  lexer_monoid_function{I7_STRING_IN_I6_COMMENT_IN_ROUTINE, I7} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE, I7} +
+  lexer_monoid_function{I6_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I6_CHARACTER_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I6_STRING_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I6_COMMENT_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I7_IN_I6_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I7_STRING_IN_I6_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I7_IN_I6_COMMENT_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I7_STRING_IN_I6_COMMENT_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I6_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I6_CHARACTER_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I6_STRING_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I7_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I7_STRING_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I7_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I7_STRING_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_IN_EXTRACT};
 
 const lexer_monoid single_quote =
-  lexer_monoid{I6, I6_CHARACTER, true} +
-  lexer_monoid{I6_IN_ROUTINE, I6_CHARACTER_IN_ROUTINE, true} +
-  lexer_monoid{I6_IN_EXTRACT, I6_CHARACTER_IN_EXTRACT, true} +
-  lexer_monoid{I6_IN_ROUTINE_IN_EXTRACT, I6_CHARACTER_IN_ROUTINE_IN_EXTRACT, true};
+  lexer_monoid_function{I6, I6_CHARACTER, true} +
+  lexer_monoid_function{I6_IN_ROUTINE, I6_CHARACTER_IN_ROUTINE, true} +
+  lexer_monoid_function{I6_IN_EXTRACT, I6_CHARACTER_IN_EXTRACT, true} +
+  lexer_monoid_function{I6_IN_ROUTINE_IN_EXTRACT, I6_CHARACTER_IN_ROUTINE_IN_EXTRACT, true};
 
 const lexer_monoid bang =
-  lexer_monoid{I6, I6_COMMENT} +
-  lexer_monoid{I6_IN_ROUTINE, I6_COMMENT_IN_ROUTINE} +
-  lexer_monoid{I6_IN_EXTRACT, I6_COMMENT_IN_EXTRACT} +
-  lexer_monoid{I6_IN_ROUTINE_IN_EXTRACT, I6_COMMENT_IN_ROUTINE_IN_EXTRACT};
+  lexer_monoid_function{I6, I6_COMMENT} +
+  lexer_monoid_function{I6_IN_ROUTINE, I6_COMMENT_IN_ROUTINE} +
+  lexer_monoid_function{I6_IN_EXTRACT, I6_COMMENT_IN_EXTRACT} +
+  lexer_monoid_function{I6_IN_ROUTINE_IN_EXTRACT, I6_COMMENT_IN_ROUTINE_IN_EXTRACT};
 
 const lexer_monoid left_crosseyed_cyclops =
-  lexer_monoid{I6, I7_IN_I6} +
-  lexer_monoid{I6_COMMENT, I7_IN_I6_COMMENT} +
-  lexer_monoid{I6_IN_ROUTINE, I7_IN_I6_IN_ROUTINE} +
-  lexer_monoid{I6_COMMENT_IN_ROUTINE, I7_IN_I6_COMMENT_IN_ROUTINE} +
-  lexer_monoid{I6_IN_EXTRACT, I7_IN_I6_IN_EXTRACT} +
-  lexer_monoid{I6_COMMENT_IN_EXTRACT, I7_IN_I6_COMMENT_IN_EXTRACT} +
-  lexer_monoid{I6_IN_ROUTINE_IN_EXTRACT, I7_IN_I6_IN_ROUTINE_IN_EXTRACT} +
-  lexer_monoid{I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT};
+  lexer_monoid_function{I6, I7_IN_I6} +
+  lexer_monoid_function{I6_COMMENT, I7_IN_I6_COMMENT} +
+  lexer_monoid_function{I6_IN_ROUTINE, I7_IN_I6_IN_ROUTINE} +
+  lexer_monoid_function{I6_COMMENT_IN_ROUTINE, I7_IN_I6_COMMENT_IN_ROUTINE} +
+  lexer_monoid_function{I6_IN_EXTRACT, I7_IN_I6_IN_EXTRACT} +
+  lexer_monoid_function{I6_COMMENT_IN_EXTRACT, I7_IN_I6_COMMENT_IN_EXTRACT} +
+  lexer_monoid_function{I6_IN_ROUTINE_IN_EXTRACT, I7_IN_I6_IN_ROUTINE_IN_EXTRACT} +
+  lexer_monoid_function{I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I7_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT};
 
 const lexer_monoid right_crosseyed_cyclops =
-  lexer_monoid{I7_IN_I6, I6} +
-  lexer_monoid{I7_STRING_IN_I6, I6} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6, I6} +
-  lexer_monoid{I7_IN_I6_COMMENT, I6_COMMENT} +
-  lexer_monoid{I7_STRING_IN_I6_COMMENT, I6_COMMENT} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT, I6_COMMENT} +
-  lexer_monoid{I7_IN_I6_IN_ROUTINE, I6_IN_ROUTINE} +
-  lexer_monoid{I7_STRING_IN_I6_IN_ROUTINE, I6_IN_ROUTINE} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_IN_ROUTINE, I6_IN_ROUTINE} +
-  lexer_monoid{I7_IN_I6_COMMENT_IN_ROUTINE, I6_COMMENT_IN_ROUTINE} +
-  lexer_monoid{I7_STRING_IN_I6_COMMENT_IN_ROUTINE, I6_COMMENT_IN_ROUTINE} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE, I6_COMMENT_IN_ROUTINE} +
-  lexer_monoid{I7_IN_I6_IN_EXTRACT, I6_IN_EXTRACT} +
-  lexer_monoid{I7_STRING_IN_I6_IN_EXTRACT, I6_IN_EXTRACT} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_IN_EXTRACT, I6_IN_EXTRACT} +
-  lexer_monoid{I7_IN_I6_COMMENT_IN_EXTRACT, I6_COMMENT_IN_EXTRACT} +
-  lexer_monoid{I7_STRING_IN_I6_COMMENT_IN_EXTRACT, I6_COMMENT_IN_EXTRACT} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT_IN_EXTRACT, I6_COMMENT_IN_EXTRACT} +
-  lexer_monoid{I7_IN_I6_IN_ROUTINE_IN_EXTRACT, I6_IN_ROUTINE_IN_EXTRACT} +
-  lexer_monoid{I7_STRING_IN_I6_IN_ROUTINE_IN_EXTRACT, I6_IN_ROUTINE_IN_EXTRACT} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_IN_ROUTINE_IN_EXTRACT, I6_IN_ROUTINE_IN_EXTRACT} +
-  lexer_monoid{I7_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I6_COMMENT_IN_ROUTINE_IN_EXTRACT} +
-  lexer_monoid{I7_STRING_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I6_COMMENT_IN_ROUTINE_IN_EXTRACT} +
-  lexer_monoid{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I6_COMMENT_IN_ROUTINE_IN_EXTRACT};
+  lexer_monoid_function{I7_IN_I6, I6} +
+  lexer_monoid_function{I7_STRING_IN_I6, I6} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6, I6} +
+  lexer_monoid_function{I7_IN_I6_COMMENT, I6_COMMENT} +
+  lexer_monoid_function{I7_STRING_IN_I6_COMMENT, I6_COMMENT} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT, I6_COMMENT} +
+  lexer_monoid_function{I7_IN_I6_IN_ROUTINE, I6_IN_ROUTINE} +
+  lexer_monoid_function{I7_STRING_IN_I6_IN_ROUTINE, I6_IN_ROUTINE} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_IN_ROUTINE, I6_IN_ROUTINE} +
+  lexer_monoid_function{I7_IN_I6_COMMENT_IN_ROUTINE, I6_COMMENT_IN_ROUTINE} +
+  lexer_monoid_function{I7_STRING_IN_I6_COMMENT_IN_ROUTINE, I6_COMMENT_IN_ROUTINE} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE, I6_COMMENT_IN_ROUTINE} +
+  lexer_monoid_function{I7_IN_I6_IN_EXTRACT, I6_IN_EXTRACT} +
+  lexer_monoid_function{I7_STRING_IN_I6_IN_EXTRACT, I6_IN_EXTRACT} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_IN_EXTRACT, I6_IN_EXTRACT} +
+  lexer_monoid_function{I7_IN_I6_COMMENT_IN_EXTRACT, I6_COMMENT_IN_EXTRACT} +
+  lexer_monoid_function{I7_STRING_IN_I6_COMMENT_IN_EXTRACT, I6_COMMENT_IN_EXTRACT} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT_IN_EXTRACT, I6_COMMENT_IN_EXTRACT} +
+  lexer_monoid_function{I7_IN_I6_IN_ROUTINE_IN_EXTRACT, I6_IN_ROUTINE_IN_EXTRACT} +
+  lexer_monoid_function{I7_STRING_IN_I6_IN_ROUTINE_IN_EXTRACT, I6_IN_ROUTINE_IN_EXTRACT} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_IN_ROUTINE_IN_EXTRACT, I6_IN_ROUTINE_IN_EXTRACT} +
+  lexer_monoid_function{I7_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I6_COMMENT_IN_ROUTINE_IN_EXTRACT} +
+  lexer_monoid_function{I7_STRING_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I6_COMMENT_IN_ROUTINE_IN_EXTRACT} +
+  lexer_monoid_function{I7_SUBSTITUTION_IN_I6_COMMENT_IN_ROUTINE_IN_EXTRACT, I6_COMMENT_IN_ROUTINE_IN_EXTRACT};
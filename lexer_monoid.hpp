@@ -2,7 +2,6 @@
 #define LEXER_MONOID_HEADER
 
 #include <cstdint>
-#include <vector>
 #include <iostream>
 
 /* A lexical superstate partially charactizes a point between two codepoints: it
@@ -98,6 +97,8 @@ protected:
   uint8_t				superstate;
   uint8_t				comment_depth;
 public:
+  // Leaves the state indeterminate, for arrays that are filled in afterward.
+  lexical_state() = default;
   lexical_state(lexical_superstate superstate) :
     superstate{superstate},
     comment_depth{0} {}
@@ -119,10 +120,16 @@ std::ostream&operator <<(std::ostream&out, lexical_state state);
 /* Just as all groups can be modeled as a set of permutations on a common set,
  * all monoids can be modeled as a set of endomorphisms.  In this particular
  * monoid, the elements are functions on objects of type lexical_state.  Or,
- * from the pushdown automaton perspective, each element of this type describes
- * the automaton's transitions under some input string.
+ * from the pushdown automaton perspective, each element describes the
+ * automaton's transitions under some input string.
+ *
+ * A lexer_monoid_function spells such a function out.  They are kept small and
+ * trivially copyable, and composing two of them allocates nothing except in
+ * the pathological case described below.
  */
-class lexer_monoid {
+static const unsigned INLINE_COMMENT_IMAGE_CAPACITY = 11;
+
+class lexer_monoid_function {
 protected:
   // The images array maps each superstate to the lexical_state that will be
   // reached after applying this element at a comment depth of zero.
@@ -130,26 +137,67 @@ protected:
   // The comment_depth_change tells how much the element will change a
   // lexical_state's comment depth provided that the depth starts high enough.
   int8_t				comment_depth_change;
-  // The comment_images vectors describe what lexical_states are reached from
-  // lower comment depths.  The array is indexed by occurrence numbers among the
-  // superstates that can take comments, while the vectors are indexed by
-  // comment depth minus one.
-  std::vector<lexical_state>		comment_images[COUNT_OF_LEXICAL_SUPERSTATES_WITH_I7_COMMENT_LEVELS];
+  // The comment images describe what lexical_states are reached from lower
+  // comment depths.  The comment_image_counts array is indexed by occurrence
+  // numbers among the superstates that can take comments, and it tells how
+  // many depths, counting up from one, are special-cased for each.  The images
+  // themselves are laid out superstate after superstate, each run indexed by
+  // comment depth minus one, in inline_comment_images if they fit.  If they do
+  // not, which takes comments left open several deep, they are interned in a
+  // shared pool, and inline_comment_images instead holds a pointer to them.
+  // Unused entries are cleared, so equal elements are equal byte for byte.
+  uint8_t				comment_image_counts[COUNT_OF_LEXICAL_SUPERSTATES_WITH_I7_COMMENT_LEVELS];
+  lexical_state				inline_comment_images[INLINE_COMMENT_IMAGE_CAPACITY];
 
 protected:
+  unsigned get_comment_image_count() const;
+  const lexical_state*get_comment_images() const;
+  void set_comment_images(const lexical_state*beginning, unsigned count);
   // A helper function abstracting repeated code in the () operator.
-  void compose(std::vector<lexical_state>&composition_comment_images, lexical_superstate superstate, const std::vector<lexical_state>&own_comment_images, const lexer_monoid&other, const std::vector<lexical_state>&other_comment_images) const;
+  unsigned compose(lexical_state*composition_comment_images, lexical_superstate superstate, const lexical_state*own_comment_images, unsigned own_comment_image_count, const lexer_monoid_function&other, const lexical_state*other_comment_images, unsigned other_comment_image_count) const;
+
+public:
+  lexer_monoid_function(int8_t comment_depth_change);
+  lexer_monoid_function(lexical_superstate from, lexical_superstate to, bool also_in_reverse = false);
+  lexical_state operator ()(lexical_state state) const;
+  // Compose two lexer_monoid_functions.  ``f + g'' is interpreted as ``g of f'', since that works best with the monoid sequence data structure.
+  lexer_monoid_function operator +(const lexer_monoid_function&other) const;
+  bool operator ==(const lexer_monoid_function&other) const;
+  size_t hash() const;
+  friend std::ostream&operator <<(std::ostream&out, const lexer_monoid_function&function);
+};
+
+std::ostream&operator <<(std::ostream&out, const lexer_monoid_function&function);
+
+/* The functions that a text's tokens and their sums actually take are few, so a
+ * lexer_monoid, the element stored in every token and every vertex of the token
+ * tree, is a lexer_monoid_function hash-consed: each distinct function is
+ * interned once in a global table, never to be released, and elements refer to
+ * it by id.  Composition is memoized by pairs of ids, so that it usually costs
+ * a cache lookup.
+ */
+using lexer_monoid_id = uint32_t;
+
+class lexer_monoid {
+protected:
+  lexer_monoid_id			id;
+
+  lexer_monoid() = default;
+  static lexer_monoid from_id(lexer_monoid_id id);
 
 public:
   lexer_monoid(int8_t comment_depth_change);
   lexer_monoid(lexical_superstate from, lexical_superstate to, bool also_in_reverse = false);
-  lexer_monoid(const lexer_monoid&copy);
-  lexer_monoid&operator =(const lexer_monoid&other);
+  lexer_monoid(const lexer_monoid_function&function);
+  const lexer_monoid_function&get_function() const;
   lexical_state operator ()(lexical_state state) const;
-  // Compose two lexer_monoids.  ``f + g'' is interpreted as ``g of f'', since that works best with the monoid sequence data structure.
+  bool operator ==(const lexer_monoid&other) const { return id == other.id; }
+  bool operator !=(const lexer_monoid&other) const { return id != other.id; }
+  // Compose two lexer_monoids, in the same order as lexer_monoid_functions.
   lexer_monoid operator +(const lexer_monoid&other) const;
   lexer_monoid&operator +=(const lexer_monoid&other);
-  friend std::ostream&operator <<(std::ostream&out, const lexer_monoid&element);
+  // The number of distinct functions interned so far.
+  static size_t get_function_count();
 };
 
 std::ostream&operator <<(std::ostream&out, const lexer_monoid&element);
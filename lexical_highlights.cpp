@@ -213,3 +213,34 @@ highlight_code get_highlight_code(lexical_state before, lexical_state after) {
   }
   return HIGHLIGHT_ORDINARY_I7;
 }
+
+const highlight_code ALL_HIGHLIGHT_CODES[] = {
+  HIGHLIGHT_ORDINARY_I7,
+  HIGHLIGHT_I7_DELIMITER,
+  HIGHLIGHT_ORDINARY_I6,
+  HIGHLIGHT_I6_DELIMITER,
+  HIGHLIGHT_I6_DIRECTIVE,
+  HIGHLIGHT_I6_KEYWORD,
+  HIGHLIGHT_I6_FUNCTION,
+  HIGHLIGHT_I6_FUNCTION_DELIMITER,
+  HIGHLIGHT_I6_PROPERTY_LIKE,
+  HIGHLIGHT_I6_PROPERTY_LIKE_DELIMITER,
+  HIGHLIGHT_VM_ASSEMBLY,
+  HIGHLIGHT_VM_ASSEMBLY_DELIMITER,
+  HIGHLIGHT_COMMENT,
+  HIGHLIGHT_COMMENT_DELIMITER,
+  HIGHLIGHT_DOCUMENTATION,
+  HIGHLIGHT_DOCUMENTATION_DELIMITER,
+  HIGHLIGHT_PASTE_MARKER,
+  HIGHLIGHT_CHARACTER_LITERAL,
+  HIGHLIGHT_CHARACTER_LITERAL_DELIMITER,
+  HIGHLIGHT_STRING_LITERAL,
+  HIGHLIGHT_STRING_LITERAL_DELIMITER,
+  HIGHLIGHT_CHARACTER_ESCAPE,
+  HIGHLIGHT_CHARACTER_ESCAPE_DELIMITER,
+  HIGHLIGHT_SUBSTITUTION,
+  HIGHLIGHT_SUBSTITUTION_DELIMITER,
+  HIGHLIGHT_SEGMENTED_SUBSTITUTION,
+  HIGHLIGHT_SEGMENTED_SUBSTITUTION_DELIMITER,
+};
+const unsigned ALL_HIGHLIGHT_CODE_COUNT = sizeof(ALL_HIGHLIGHT_CODES) / sizeof(ALL_HIGHLIGHT_CODES[0]);
@@ -8,6 +8,19 @@
 // highlight codes need to have the same width as codepoints.
 using highlight_code = i7_codepoint;
 
+// Codepoints [beginning_codepoint_index, end_codepoint_index) of a buffer, all
+// highlighted alike.
+struct highlight_run {
+  unsigned				beginning_codepoint_index;
+  unsigned				end_codepoint_index;
+  ::highlight_code			highlight_code;
+};
+
 highlight_code get_highlight_code(lexical_state before, lexical_state after);
 
+// Every highlight code in protocol.hpp, for tools that stand in for an editor
+// and so must declare the codes that they support.
+extern const highlight_code ALL_HIGHLIGHT_CODES[];
+extern const unsigned ALL_HIGHLIGHT_CODE_COUNT;
+
 #endif
@@ -1,26 +1,30 @@
-#include "session.hpp"
-#include "io.hpp"
-
-// Placeholders
-
-void support_highlight_code(::highlight_code highlight_code) {}
-
-void mark_buffer_undecided(unsigned buffer_number) {}
-void mark_buffer_as_story(unsigned buffer_number) {}
-void mark_buffer_as_extension(unsigned buffer_number, const i7_string&includable_file_name) {}
+#include <cstdio>
+#include <cstring>
 
-void discard_view(unsigned view_number) {}
-void introduce_view(unsigned view_number, unsigned buffer_number) {}
-
-void move_view(unsigned view_number, unsigned beginning, unsigned end) {}
-
-void clear_cursor(unsigned view_number) {}
-void set_cursor(unsigned view_number, unsigned beginning, unsigned end) {}
-
-// End placeholders
+#include "grammar.hpp"
+#include "io.hpp"
 
-int main() {
-  session = new typename ::session{};
-  startup_io();
+int main(int argc, char**argv) {
+  const char*trace_path = nullptr;
+  const char*socket_path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 < argc && !strcmp(argv[i], "--record")) {
+      trace_path = argv[++i];
+    } else if (i + 1 < argc && !strcmp(argv[i], "--listen")) {
+      socket_path = argv[++i];
+    } else {
+      fprintf(stderr, "Usage: %s [--record TRACE_PATH] [--listen SOCKET_PATH]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (trace_path) {
+    record_trace(trace_path);
+  }
+  const grammar*grammar = new typename ::grammar{};
+  if (socket_path) {
+    startup_io(*grammar, socket_path);
+  } else {
+    startup_io(*grammar);
+  }
   return 0;
 }
@@ -98,6 +98,19 @@ protected:
       }
     }
 
+    // This constructor creates a new non-leaf over two complete subtrees, as
+    // when a whole tree is built at once.  Argument left_sum is the total
+    // contribution of the left subtree.
+    vertex(vertex*left, vertex*right, const T&left_sum) :
+      difference{left_sum},
+      parent{nullptr},
+      left{left},
+      right{right},
+      size_of_subtree{1 + left->size_of_subtree + right->size_of_subtree} {
+      left->parent = this;
+      right->parent = this;
+    }
+
   public:
     // This constructor creates a new leaf, which should be attached either by
     // making it the root or by passing it to the constructor above.
@@ -382,6 +395,22 @@ protected:
       return const_cast<vertex*>(this)->get_leftmost_strictly_to_right(target);
     }
 
+    // Builds a balanced tree with leaves for the elements from first to last,
+    // which must not be empty, and stores their total contribution in sum.
+    template<typename I>static vertex*build(I first, I last, T&sum) {
+      if (last - first == 1) {
+	vertex*result = new vertex{*first};
+	sum = result->difference;
+	return result;
+      }
+      I middle = first + (last - first) / 2;
+      T left_sum = 0, right_sum = 0;
+      vertex*left = build(first, middle, left_sum);
+      vertex*right = build(middle, last, right_sum);
+      sum = left_sum + right_sum;
+      return new vertex{left, right, left_sum};
+    }
+
     // The monoid sequence is passed by reference first so that its root can be
     // updated if the root is replaced and second so that we can construct the
     // return value.
@@ -402,6 +431,16 @@ protected:
       return {&sequence, result};
     }
 
+    // Replaces a leaf's contribution in place, where addend is the amount by
+    // which the new contribution exceeds the old and commutes with everything
+    // to its right, so that the partial sums above can be patched by adding it
+    // rather than recomputed.
+    void replace(const T&replacement, const T&addend) {
+      assert(is_leaf());
+      difference = replacement;
+      increase_ancestor_differences_and_recompute_subtree_sizes(addend);
+    }
+
     // The monoid sequence is passed by reference first so that its root can be
     // updated if the root is replaced and second so that we can construct the
     // return value.
@@ -574,6 +613,36 @@ public:
     return {this, root = new vertex{difference}};
   }
 
+  // Inserts the elements from first to last before position.  Into an empty
+  // sequence they are built straight into a balanced tree, in linear rather
+  // than O(n ln(n)^2) time; otherwise they are inserted one by one.
+  template<typename I>iterator insert(const iterator&position, I first, I last) {
+    assert(position.sequence == this);
+    if (first == last) {
+      return position;
+    }
+    if (root) {
+      iterator result = insert(position, *first);
+      for (++first; first != last; ++first) {
+	insert(position, *first);
+      }
+      return result;
+    }
+    T sum = 0;
+    root = vertex::build(first, last, sum);
+    return begin();
+  }
+
+  // Replaces the element at position with replacement, which must equal the
+  // old element plus addend, where addend commutes with every element.  The
+  // vertex survives, along with anything attached to it, and only O(ln(n))
+  // partial sums need adjusting, even in the non-abelian case.
+  void replace(const iterator&position, const T&replacement, const T&addend) {
+    assert(position.sequence == this);
+    assert(position.position);
+    position.position->replace(replacement, addend);
+  }
+
   iterator erase(const iterator&position) {
     assert(position.sequence == this);
     assert(position.position);
@@ -0,0 +1,106 @@
+#include <thread>
+
+#include "parallel_lexer.hpp"
+
+using namespace std;
+
+// Indicates that a seam never synchronized.
+static const size_t UNSYNCHRONIZED = static_cast<size_t>(-1);
+
+unsigned get_lexing_thread_count(size_t codepoint_count) {
+  size_t result = thread::hardware_concurrency();
+  result = min(result, codepoint_count / MINIMUM_CODEPOINTS_PER_LEXING_CHUNK);
+  return result ? static_cast<unsigned>(result) : 1;
+}
+
+// Calls task with every index below count, each on a thread of its own except
+// for index zero, which runs on the calling thread.
+template<typename F>static void run_in_parallel(unsigned count, F task) {
+  vector<thread>workers;
+  for (unsigned index = 1; index < count; ++index) {
+    workers.emplace_back(task, index);
+  }
+  task(0);
+  for (thread&worker : workers) {
+    worker.join();
+  }
+}
+
+// Continues lexing into the next chunk until the lexer is synchronized with one
+// that begins there and returns the number of tokens that the latter has
+// produced by then, or UNSYNCHRONIZED if that never happens within the chunk.
+// Runs under the chunk's vocabulary, like the lexer that it continues.
+static size_t relex_seam(lexer&continuing_lexer, const i7_string_view&next_chunk) {
+  lexer fresh_lexer;
+  for (const i7_codepoint*position = next_chunk.begin(), *end = next_chunk.end(); !continuing_lexer.is_synchronized_with(fresh_lexer); ++position) {
+    if (position == end) {
+      return UNSYNCHRONIZED;
+    }
+    continuing_lexer << *position;
+    fresh_lexer << *position;
+  }
+  return fresh_lexer.get_results().size();
+}
+
+void parallel_lexer::release_chunks() {
+  if (chunk_lexers.empty()) {
+    return;
+  }
+  run_in_parallel(static_cast<unsigned>(chunk_lexers.size()), [this](unsigned index) {
+      vocabulary_scope scope{chunk_vocabularies[index]};
+      chunk_lexers[index].reset();
+    });
+}
+
+parallel_lexer::~parallel_lexer() {
+  release_chunks();
+}
+
+void parallel_lexer::lex(const i7_string_view&codepoints, unsigned thread_count) {
+  // Chunk boundaries fall just after line feeds, roughly evenly spaced.
+  vector<const i7_codepoint*>boundaries{codepoints.begin()};
+  for (unsigned index = 1; index < thread_count; ++index) {
+    const i7_codepoint*boundary = max(codepoints.begin() + codepoints.size() * index / thread_count, boundaries.back());
+    for (; boundary != codepoints.end() && *boundary != '\n'; ++boundary);
+    if (boundary == codepoints.end()) {
+      break;
+    }
+    boundaries.push_back(boundary + 1);
+  }
+  boundaries.push_back(codepoints.end());
+  unsigned chunk_count = static_cast<unsigned>(boundaries.size() - 1);
+  release_chunks();
+  chunk_lexers.assign(chunk_count, lexer{});
+  chunk_vocabularies.resize(chunk_count);
+  superseded_result_counts.assign(chunk_count, 0);
+  run_in_parallel(chunk_count, [this, &boundaries, chunk_count](unsigned index) {
+      vocabulary_scope scope{chunk_vocabularies[index]};
+      lexer&chunk_lexer = chunk_lexers[index];
+      chunk_lexer << i7_string_view{boundaries[index], static_cast<size_t>(boundaries[index + 1] - boundaries[index])};
+      if (index + 1 < chunk_count) {
+	superseded_result_counts[index + 1] = relex_seam(chunk_lexer, i7_string_view{boundaries[index + 1], static_cast<size_t>(boundaries[index + 2] - boundaries[index + 1])});
+      } else {
+	chunk_lexer << TERMINATOR_CODEPOINT;
+      }
+    });
+  for (size_t count : superseded_result_counts) {
+    if (count == UNSYNCHRONIZED) {
+      release_chunks();
+      chunk_lexers.assign(1, lexer{});
+      superseded_result_counts.assign(1, 0);
+      vocabulary_scope scope{chunk_vocabularies[0]};
+      chunk_lexers[0] << codepoints;
+      chunk_lexers[0] << TERMINATOR_CODEPOINT;
+      return;
+    }
+  }
+}
+
+vector<reference_wrapper<const token>>parallel_lexer::get_results() const {
+  vector<reference_wrapper<const token>>results;
+  for (size_t index = 0; index < chunk_lexers.size(); ++index) {
+    const vector<token>&chunk_results = chunk_lexers[index].get_results();
+    results.insert(results.end(), chunk_results.begin() + superseded_result_counts[index], chunk_results.end());
+  }
+  return results;
+}
@@ -0,0 +1,59 @@
+#ifndef PARALLEL_LEXER_HEADER
+#define PARALLEL_LEXER_HEADER
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include "codepoints.hpp"
+#include "lexer.hpp"
+
+// Texts shorter than this many codepoints per thread are lexed on one thread.
+static const std::size_t MINIMUM_CODEPOINTS_PER_LEXING_CHUNK = 1 << 16;
+
+// Returns how many threads are worth using to lex a text of the given length,
+// which is one if it is not worth lexing in parallel at all.
+unsigned get_lexing_thread_count(std::size_t codepoint_count);
+
+// Lexes a long text, such as a whole file being loaded, on several threads.
+//
+// The text is cut into chunks just after line breaks, and each chunk is lexed
+// by a lexer of its own, starting from the initial state.  Every chunk but the
+// first may therefore begin with tokens that a single lexer would not have
+// produced, so each chunk's lexer goes on to relex the beginning of the next
+// chunk alongside a fresh lexer until the two are synchronized, which, after a
+// line break, almost always happens within a codepoint or two.  From there on,
+// the next chunk's tokens are the ones that a single lexer would produce, and
+// the tokens before that point are superseded by the ones that the previous
+// chunk's lexer produced on its way.  A seam that never synchronizes makes the
+// whole text fall back to being lexed on one thread.
+//
+// Each chunk's tokens intern their text in a vocabulary of the chunk's own, so
+// that the threads never share one.  The results are interned in the shared
+// vocabulary only when they are copied out, on the thread that called lex.
+class parallel_lexer {
+protected:
+  std::vector<lexer>			chunk_lexers;
+  // Parallel to chunk_lexers, and only used under a vocabulary_scope.
+  std::vector<internalizer<i7_string>>	chunk_vocabularies;
+  // The number of results at the beginning of each chunk superseded by the
+  // previous chunk's results.
+  std::vector<std::size_t>		superseded_result_counts;
+
+  // Discards the chunks' tokens, each under its chunk's vocabulary.
+  void release_chunks();
+
+public:
+  // Releases the chunks' tokens on as many threads as lexed them.
+  ~parallel_lexer();
+
+  // Lexes the codepoints followed by the terminator, like feeding both to a
+  // fresh lexer, on up to thread_count threads.
+  void lex(const i7_string_view&codepoints, unsigned thread_count);
+  // Every token that a single lexer would have produced, in order.  Their text
+  // belongs to the chunks' vocabularies, so the tokens should be copied before
+  // their text is compared by address.
+  std::vector<std::reference_wrapper<const token>>get_results() const;
+};
+
+#endif
@@ -112,7 +112,7 @@ static void begin_matches_with_match(vector<fact*>&results, const unordered_set<
 static void begin_matches_with_match(vector<fact*>&results, typename ::session&session, const match&partial_match, token_iterator position) {
   unordered_set<const production*>candidates;
   for (const parseme*alternative : partial_match.get_continuing_alternatives()) {
-    const unordered_set<const production*>&additional_candidates = session.get_productions_resulting_in(alternative);
+    const unordered_set<const production*>&additional_candidates = session.get_grammar().get_productions_resulting_in(alternative);
     candidates.insert(additional_candidates.begin(), additional_candidates.end());
   }
   begin_matches_with_match(results, candidates, position);
@@ -209,7 +209,7 @@ std::vector<fact*>token_available::get_immediate_consequences() const {
       // (next) handled by the call to ::previous and the check on its return value.
       // (sentence/passage --> production) handled by the call to get_sentence_beginnings() below.
       // (token available) is the trigger.
-      begin_matches_with_token(results, session, session.get_sentence_beginnings(), buffer, self);
+      begin_matches_with_token(results, session, session.get_grammar().get_sentence_beginnings(), buffer, self);
     }
     if (previous.can_increment()) {
       // Case IIa: Beginning of a continuing match with a token.
@@ -217,7 +217,7 @@ std::vector<fact*>token_available::get_immediate_consequences() const {
       // (next) handled by the call to ::previous and the check on its return value.
       // (need --> production) handled by the call to get_continuing_beginnings(...) below.
       // (token available) is the trigger.
-      begin_matches_with_token(results, session, session.get_continuing_beginnings(previous), buffer, self);      
+      begin_matches_with_token(results, session, session.get_grammar().get_continuing_beginnings(previous), buffer, self);      
       // Case IIIa: Continuation of a match with a token.
       // (end of partial match) handled by the call to continue_matches_with_token(...) below.
       // (next) handled by the call to ::previous and the check on its return value.
@@ -285,13 +285,13 @@ vector<fact*>next_token::get_immediate_consequences() const {
       // (next) is the trigger.
       // (sentence/passage --> production) handled by the call to get_sentence_beginnings() below.
       // (token available) handled by the outer conditional.
-      begin_matches_with_token(results, session, session.get_sentence_beginnings(), buffer, next);
+      begin_matches_with_token(results, session, session.get_grammar().get_sentence_beginnings(), buffer, next);
       // Case Ib: Beginning of a match at the beginning of a sentence with a match already made.
       // (sentence ending) handled by the conditional just above.
       // (next) is the trigger.
       // (sentence/passage --> production) handled by the call to get_sentence_beginnings() below.
       // (complete match) handled in begin_matches_with_match(...).
-      begin_matches_with_match(results, session.get_sentence_beginnings(), next);
+      begin_matches_with_match(results, session.get_grammar().get_sentence_beginnings(), next);
     }
     if (self.can_increment()) {
       // Case IIa: Beginning of a continuing match with a token.
@@ -299,13 +299,13 @@ vector<fact*>next_token::get_immediate_consequences() const {
       // (next) is the trigger.
       // (need --> production) handled by the call to get_continuing_beginnings(...) below.
       // (token available) handled by the outer conditional.
-      begin_matches_with_token(results, session, session.get_continuing_beginnings(self), buffer, next);
+      begin_matches_with_token(results, session, session.get_grammar().get_continuing_beginnings(self), buffer, next);
       // Case IIb:  Beginning of a continuing match with a match already made.
       // (end of partial match) handled by the call to get_continuing_beginnings(...) below.
       // (next) is the trigger.
       // (need --> production) handled by the call to get_continuing_beginnings(...) below.
       // (complete match) handled in begin_matches_with_match(...).
-      begin_matches_with_match(results, session.get_continuing_beginnings(self), next);
+      begin_matches_with_match(results, session.get_grammar().get_continuing_beginnings(self), next);
       // Case IIIa: Continuation of a match with a token.
       // (end of partial match) handled by the call to continue_matches_with_token(...) below.
       // (next) is the trigger.
@@ -441,13 +441,13 @@ std::vector<fact*>end_of_sentence::get_immediate_consequences() const {
       // (next) handled by the call to ::next and the check on its return value.
       // (sentence/passage --> production) handled by the call to get_sentence_beginnings() below.
       // (token available) handled by the conditional just above.
-      begin_matches_with_token(results, session, session.get_sentence_beginnings(), buffer, next);
+      begin_matches_with_token(results, session, session.get_grammar().get_sentence_beginnings(), buffer, next);
       // Case Ib: Beginning of a match at the beginning of a sentence with a match already made.
       // (sentence ending) is the trigger.
       // (next) handled by the call to ::next and the check on its return value.
       // (sentence/passage --> production) handled by the call to get_sentence_beginnings() below.
       // (complete match) handled in begin_matches_with_match(...).
-      begin_matches_with_match(results, session.get_sentence_beginnings(), next);
+      begin_matches_with_match(results, session.get_grammar().get_sentence_beginnings(), next);
     }
   }
   // Case IV: Conditions 0 and 1 are enforced by guards calling can_reach_slot_count_at(...).
@@ -592,15 +592,15 @@ size_t nonterminal::hash() const {
   return reinterpret_cast<size_t>(kind_name) + tier;
 }
 
-production::production(typename ::session&session, const nonterminal&result, bool internal) :
-  fact{session},
+production::production(typename ::grammar&grammar, const nonterminal&result, bool internal) :
+  fact{grammar},
   result{dynamic_cast<const nonterminal*>(&parseme_bank.acquire(result))},
   epsilon_prefix_length{0},
   hash_value{0},
   internal{internal} {}
 
 production::production(const production&copy) :
-  fact{dynamic_cast<typename ::session&>(copy.context)},
+  fact{dynamic_cast<typename ::grammar&>(copy.context)},
   result{dynamic_cast<const nonterminal*>(&parseme_bank.acquire(*copy.result))},
   alternatives_sequence{copy.alternatives_sequence},
   epsilon_prefix_length{copy.epsilon_prefix_length},
@@ -633,51 +633,56 @@ bool production::is_equal_to_instance_of_like_class(const base_class&other) cons
     (alternatives_sequence == cast.alternatives_sequence);
 }
 
+// In practice, productions only change while the grammar is being built, when
+// no session is parsing with it yet.
 std::vector<fact*>production::get_immediate_consequences() const {
-  typename ::session&session = dynamic_cast<typename ::session&>(context);
+  typename ::grammar&grammar = dynamic_cast<typename ::grammar&>(context);
   bool can_begin_sentence = this->can_begin_sentence();
   vector<fact*>results;
-  for (const auto&i : session.get_buffers()) {
-    ::buffer*buffer = i.second;
-    if (can_begin_sentence) {
-      unordered_set<const production*>affected_sentence_beginnings = session.get_sentence_beginnings_relying_on(*this);
-      for (token_iterator previous : buffer->get_sentence_endings()) {
+  for (typename ::session*session_pointer : grammar.get_sessions()) {
+    typename ::session&session = *session_pointer;
+    for (const auto&i : session.get_buffers()) {
+      ::buffer*buffer = i.second;
+      if (can_begin_sentence) {
+	unordered_set<const production*>affected_sentence_beginnings = grammar.get_sentence_beginnings_relying_on(*this);
+	for (token_iterator previous : buffer->get_sentence_endings()) {
+	  token_iterator next = ::next(previous);
+	  if (next.can_increment() && next != previous && token_available{session, next}) {
+	    // Case Ia: Beginning of a match at the beginning of a sentence with a token.
+	    // (sentence ending) handled by the two surrounding loops.
+	    // (next) handled by the call to ::next and the check on its return value.
+	    // (sentence/passage --> production) is the trigger, with the various subcases covered by get_sentence_beginnings_relying_on(...).
+	    // (token available) handled by the conditional just above.
+	    begin_matches_with_token(results, session, affected_sentence_beginnings, buffer, next);
+	    // Case Ib: Beginning of a match at the beginning of a sentence with a match already made.
+	    // (sentence ending) handled by the two surrounding loops.
+	    // (next) handled by the call to ::next and the check on its return value.
+	    // (sentence/passage --> production) is the trigger, with the various subcases covered by get_sentence_beginnings_relying_on(...).
+	    // (complete match) handled in begin_matches_with_match(...).
+	    begin_matches_with_match(results, affected_sentence_beginnings, next);
+	  }
+	}
+      }
+      unordered_set<const production*>affected_result_beginnings = grammar.get_result_beginnings_relying_on(*this);
+      for (const match*prefix : buffer->get_partial_matches_needing(result)) {
+	token_iterator previous = prefix->get_inclusive_end();
 	token_iterator next = ::next(previous);
 	if (next.can_increment() && next != previous && token_available{session, next}) {
-	  // Case Ia: Beginning of a match at the beginning of a sentence with a token.
-	  // (sentence ending) handled by the two surrounding loops.
+	  // Case IIa: Beginning of a continuing match with a token.
+	  // (end of partial match) handled by get_partial_matches_needing(...).  (It only needs to be called on the topmost result.)
 	  // (next) handled by the call to ::next and the check on its return value.
-	  // (sentence/passage --> production) is the trigger, with the various subcases covered by get_sentence_beginnings_relying_on(...).
+	  // (need --> production) is the trigger, with the various subcases covered by get_result_beginnings_relying_on(...).
 	  // (token available) handled by the conditional just above.
-	  begin_matches_with_token(results, session, affected_sentence_beginnings, buffer, next);
-	  // Case Ib: Beginning of a match at the beginning of a sentence with a match already made.
-	  // (sentence ending) handled by the two surrounding loops.
+	  begin_matches_with_token(results, session, affected_result_beginnings, buffer, next);
+	  // Case IIb:  Beginning of a continuing match with a match already made.
+	  // (end of partial match) handled by get_partial_matches_needing(...).  (It only needs to be called on the topmost result.)
 	  // (next) handled by the call to ::next and the check on its return value.
-	  // (sentence/passage --> production) is the trigger, with the various subcases covered by get_sentence_beginnings_relying_on(...).
+	  // (need --> production) is the trigger, with the various subcases covered by get_result_beginnings_relying_on(...).
 	  // (complete match) handled in begin_matches_with_match(...).
-	  begin_matches_with_match(results, affected_sentence_beginnings, next);
+	  begin_matches_with_match(results, affected_result_beginnings, next);
 	}
       }
     }
-    unordered_set<const production*>affected_result_beginnings = session.get_result_beginnings_relying_on(*this);
-    for (const match*prefix : buffer->get_partial_matches_needing(result)) {
-      token_iterator previous = prefix->get_inclusive_end();
-      token_iterator next = ::next(previous);
-      if (next.can_increment() && next != previous && token_available{session, next}) {
-	// Case IIa: Beginning of a continuing match with a token.
-	// (end of partial match) handled by get_partial_matches_needing(...).  (It only needs to be called on the topmost result.)
-	// (next) handled by the call to ::next and the check on its return value.
-	// (need --> production) is the trigger, with the various subcases covered by get_result_beginnings_relying_on(...).
-	// (token available) handled by the conditional just above.
-	begin_matches_with_token(results, session, affected_result_beginnings, buffer, next);
-	// Case IIb:  Beginning of a continuing match with a match already made.
-	// (end of partial match) handled by get_partial_matches_needing(...).  (It only needs to be called on the topmost result.)
-	// (next) handled by the call to ::next and the check on its return value.
-	// (need --> production) is the trigger, with the various subcases covered by get_result_beginnings_relying_on(...).
-	// (complete match) handled in begin_matches_with_match(...).
-	begin_matches_with_match(results, affected_result_beginnings, next);
-      }
-    }
   }
   return results;
 }
@@ -758,31 +763,30 @@ std::vector<unsigned>production::can_begin_with(const ::parseme&parseme) const {
   return results;
 }
 
-bool production::can_reach_slot_count_at(unsigned slot_count, token_iterator position) const {
-  return can_reach_slot_count_at(slot_count, position, !position.can_increment() || end_of_sentence{dynamic_cast<typename ::session&>(context), position, true});
+bool production::can_reach_slot_count_at(typename ::session&session, unsigned slot_count, token_iterator position) const {
+  return can_reach_slot_count_at(slot_count, position, !position.can_increment() || end_of_sentence{session, position, true});
 }
 
 size_t production::hash() const {
   return hash_value;
 }
 
-subsentence::subsentence(typename ::session&session, const nonterminal&result, bool internal) :
-  production{session, result, internal} {}
+subsentence::subsentence(typename ::grammar&grammar, const nonterminal&result, bool internal) :
+  production{grammar, result, internal} {}
 
 subsentence::subsentence(const subsentence&copy) :
   production{copy} {}
 
 bool subsentence::can_begin_sentence() const {
-  typename ::session&session = dynamic_cast<typename ::session&>(context);
-  return session.can_begin_sentence_with(this);
+  return dynamic_cast<typename ::grammar&>(context).can_begin_sentence_with(this);
 }
 
 void subsentence::justification_hook() const {
-  dynamic_cast<typename ::session&>(context).add_subsentence(*this);
+  dynamic_cast<typename ::grammar&>(context).add_subsentence(*this);
 }
 
 void subsentence::unjustification_hook() const {
-  dynamic_cast<typename ::session&>(context).remove_subsentence(*this);
+  dynamic_cast<typename ::grammar&>(context).remove_subsentence(*this);
 }
 
 ostream&subsentence::print(ostream&out) const {
@@ -790,7 +794,7 @@ ostream&subsentence::print(ostream&out) const {
 }
 
 subsentence::operator bool() const {
-  const unordered_set<const subsentence*>&subsentences = dynamic_cast<typename ::session&>(context).get_subsentences();
+  const unordered_set<const subsentence*>&subsentences = dynamic_cast<typename ::grammar&>(context).get_subsentences();
   return subsentences.find(dynamic_cast<const subsentence*>(production_bank.lookup(*this))) != subsentences.end();
 }
 
@@ -802,23 +806,22 @@ const base_class*subsentence::clone() const {
   return new subsentence{*this};
 }
 
-wording::wording(typename ::session&session, const nonterminal&result, bool internal) :
-  production{session, result, internal} {}
+wording::wording(typename ::grammar&grammar, const nonterminal&result, bool internal) :
+  production{grammar, result, internal} {}
 
 wording::wording(const wording&copy) :
   production{copy} {}
 
 bool wording::can_begin_sentence() const {
-  typename ::session&session = dynamic_cast<typename ::session&>(context);
-  return session.can_begin_sentence_with(this);
+  return dynamic_cast<typename ::grammar&>(context).can_begin_sentence_with(this);
 }
 
 void wording::justification_hook() const {
-  dynamic_cast<typename ::session&>(context).add_wording(*this);
+  dynamic_cast<typename ::grammar&>(context).add_wording(*this);
 }
 
 void wording::unjustification_hook() const {
-  dynamic_cast<typename ::session&>(context).remove_wording(*this);
+  dynamic_cast<typename ::grammar&>(context).remove_wording(*this);
 }
 
 ostream&wording::print(ostream&out) const {
@@ -826,7 +829,7 @@ ostream&wording::print(ostream&out) const {
 }
 
 wording::operator bool() const {
-  const unordered_set<const wording*>&wordings = dynamic_cast<typename ::session&>(context).get_wordings();
+  const unordered_set<const wording*>&wordings = dynamic_cast<typename ::grammar&>(context).get_wordings();
   return wordings.find(dynamic_cast<const wording*>(production_bank.lookup(*this))) != wordings.end();
 }
 
@@ -842,8 +845,8 @@ const base_class*wording::clone() const {
   return new wording{*this};
 }
 
-sentence::sentence(typename ::session&session, const nonterminal&result, bool internal) :
-  production{session, result, internal} {}
+sentence::sentence(typename ::grammar&grammar, const nonterminal&result, bool internal) :
+  production{grammar, result, internal} {}
 
 sentence::sentence(const sentence&copy) :
   production{copy} {}
@@ -853,11 +856,11 @@ bool sentence::can_begin_sentence() const {
 }
 
 void sentence::justification_hook() const {
-  dynamic_cast<typename ::session&>(context).add_sentence(*this);
+  dynamic_cast<typename ::grammar&>(context).add_sentence(*this);
 }
 
 void sentence::unjustification_hook() const {
-  dynamic_cast<typename ::session&>(context).remove_sentence(*this);
+  dynamic_cast<typename ::grammar&>(context).remove_sentence(*this);
 }
 
 ostream&sentence::print(ostream&out) const {
@@ -865,7 +868,7 @@ ostream&sentence::print(ostream&out) const {
 }
 
 sentence::operator bool() const {
-  const unordered_set<const sentence*>&sentences = dynamic_cast<typename ::session&>(context).get_sentences();
+  const unordered_set<const sentence*>&sentences = dynamic_cast<typename ::grammar&>(context).get_sentences();
   return sentences.find(dynamic_cast<const sentence*>(production_bank.lookup(*this))) != sentences.end();
 }
 
@@ -881,8 +884,8 @@ const base_class*sentence::clone() const {
   return new sentence{*this};
 }
 
-passage::passage(typename ::session&session, const nonterminal&result, bool internal) :
-  production{session, result, internal} {}
+passage::passage(typename ::grammar&grammar, const nonterminal&result, bool internal) :
+  production{grammar, result, internal} {}
 
 passage::passage(const passage&copy) :
   production{copy} {}
@@ -892,11 +895,11 @@ bool passage::can_begin_sentence() const {
 }
 
 void passage::justification_hook() const {
-  dynamic_cast<typename ::session&>(context).add_passage(*this);
+  dynamic_cast<typename ::grammar&>(context).add_passage(*this);
 }
 
 void passage::unjustification_hook() const {
-  dynamic_cast<typename ::session&>(context).remove_passage(*this);
+  dynamic_cast<typename ::grammar&>(context).remove_passage(*this);
 }
 
 ostream&passage::print(ostream&out) const {
@@ -904,7 +907,7 @@ ostream&passage::print(ostream&out) const {
 }
 
 passage::operator bool() const {
-  const unordered_set<const passage*>&passages = dynamic_cast<typename ::session&>(context).get_passages();
+  const unordered_set<const passage*>&passages = dynamic_cast<typename ::grammar&>(context).get_passages();
   return passages.find(dynamic_cast<const passage*>(production_bank.lookup(*this))) != passages.end();
 }
 
@@ -1009,7 +1012,7 @@ vector<const fact_annotatable*>potential_match::get_annotatables() const {
 
 vector<fact*>potential_match::get_immediate_consequences() const {
   vector<fact*>results;
-  if (production->can_reach_slot_count_at(slots_filled, inclusive_end)) {
+  if (production->can_reach_slot_count_at(dynamic_cast<typename ::session&>(context), slots_filled, inclusive_end)) {
     // Case IV: Conditions 0 and 1 are enforced by guards calling can_reach_slot_count_at(...).
     results.push_back(new match{*this});
   }
@@ -1130,7 +1133,7 @@ vector<fact*>match::get_immediate_consequences() const {
   vector<fact*>results;
   if (is_filled()) {
     if (previous != beginning && (!previous.can_increment() || end_of_sentence{session, previous, true})) {
-      intersection<const ::production*>candidates{session.get_sentence_beginnings(), session.get_productions_beginning_with(&get_result())};
+      intersection<const ::production*>candidates{session.get_grammar().get_sentence_beginnings(), session.get_grammar().get_productions_beginning_with(&get_result())};
       // Case Ib: Beginning of a match at the beginning of a sentence with a match already made.
       // (sentence ending) handled by the conditional just above.
       // (next) handled by the call to ::previous and the check on its return value.
@@ -1144,7 +1147,7 @@ vector<fact*>match::get_immediate_consequences() const {
       // (next) handled by the call to ::previous and the check on its return value.
       // (need --> production) handled by the call to get_continuing_beginnings(...) below.
       // (complete match) is the trigger.
-      begin_matches_with_match(results, session.get_continuing_beginnings(previous), *this);
+      begin_matches_with_match(results, session.get_grammar().get_continuing_beginnings(previous), *this);
       // Case IIIb: Continuation of a match with another match.
       // (end of partial match) handled by the call to continue_matches_with_match(...) below.
       // (next) handled by the call to ::previous and the check on its return value.
@@ -1159,7 +1162,7 @@ vector<fact*>match::get_immediate_consequences() const {
       // (next) handled by the call to ::next and the check on its return value.
       // (need --> production) handled by the call to get_continuing_beginnings(...) below.
       // (token available) handled by the conditional just above.
-      begin_matches_with_token(results, session, session.get_continuing_beginnings(*this), buffer, end);
+      begin_matches_with_token(results, session, session.get_grammar().get_continuing_beginnings(*this), buffer, end);
       // Case IIb:  Beginning of a continuing match with a match already made.
       // (end of partial match) is the trigger.
       // (next) handled by the call to ::next and the check on its return value.
@@ -234,7 +234,7 @@ protected:
   const bool				internal;
 
 public:
-  production(typename ::session&session, const nonterminal&result, bool internal = false);
+  production(typename ::grammar&grammar, const nonterminal&result, bool internal = false);
   production(const production&copy);
   virtual ~production();
 
@@ -269,7 +269,7 @@ public:
 
   // For checking extra constraints like positions relative to end-of-sentence
   // markers.
-  bool can_reach_slot_count_at(unsigned slot_count, token_iterator position) const;
+  bool can_reach_slot_count_at(typename ::session&session, unsigned slot_count, token_iterator position) const;
   virtual bool can_reach_slot_count_at(unsigned slot_count, token_iterator position, bool assumed_end_of_sentence_state) const = 0;
   virtual size_t hash() const override;
 };
@@ -278,7 +278,7 @@ public:
 // boundary.
 class subsentence : public production {
 public:
-  subsentence(typename ::session&session, const nonterminal&result, bool internal = false);
+  subsentence(typename ::grammar&grammar, const nonterminal&result, bool internal = false);
   subsentence(const subsentence&copy);
 
 protected:
@@ -302,7 +302,7 @@ public:
  */
 class wording : public production {
 public:
-  wording(typename ::session&session, const nonterminal&result, bool internal = false);
+  wording(typename ::grammar&grammar, const nonterminal&result, bool internal = false);
   wording(const wording&copy);
 
 protected:
@@ -330,7 +330,7 @@ public:
  */
 class sentence : public production {
 public:
-  sentence(typename ::session&session, const nonterminal&result, bool internal = false);
+  sentence(typename ::grammar&grammar, const nonterminal&result, bool internal = false);
   sentence(const sentence&copy);
 
 protected:
@@ -361,7 +361,7 @@ public:
  */
 class passage : public production {
 public:
-  passage(typename ::session&session, const nonterminal&result, bool internal = false);
+  passage(typename ::grammar&grammar, const nonterminal&result, bool internal = false);
   passage(const passage&copy);
 
 protected:
@@ -0,0 +1,10 @@
+#include "io.hpp"
+
+// Client messages that the session does not act on yet.
+
+void mark_buffer_undecided(unsigned buffer_number) {}
+void mark_buffer_as_story(unsigned buffer_number) {}
+void mark_buffer_as_extension(unsigned buffer_number, const i7_string&includable_file_name) {}
+
+void clear_cursor(unsigned view_number) {}
+void set_cursor(unsigned view_number, unsigned beginning, unsigned end) {}
@@ -20,15 +20,40 @@
  * always count length as a message is read in, whereas the sender might have
  * situations where precomputing length is a hassle.)
  *
+ * That is the framing of protocol version 0, which is what both sides speak
+ * unless the client negotiates otherwise by sending
+ * CLIENT_REQUEST_PROTOCOL_VERSION.  From version 1 on, messages are framed:
+ * every message's purpose codepoint is followed by a [length] word counting
+ * the words in the rest of the message, so that a receiver can preallocate,
+ * skip messages that it does not recognize, and ignore trailing fields added by
+ * later versions.  Strings are length-prefixed too: in version 1,
+ * [UPPERCASE] stands for a [length] word followed by exactly that many
+ * codepoints, with no terminator.  The server treats a client message longer
+ * than 2^26 words, or a string that runs past the end of its message, as
+ * malformed.
+ *
+ * Independently of the protocol version, the client may negotiate a more
+ * compact wire encoding with CLIENT_REQUEST_WIRE_ENCODING.  The default,
+ * WIRE_ENCODING_UCS_4, sends every word and codepoint as 32 bits, big- or
+ * little-endian as detected from the first codepoint the client sends.  Under
+ * WIRE_ENCODING_UTF_8, each [lowercase] word is an unsigned LEB128 varint
+ * (seven bits per byte, least significant first, high bit set on all bytes but
+ * the last), strings are UTF-8, a null terminator is a single zero byte, and
+ * all lengths, both of messages and of strings, count bytes.  Ill-formed UTF-8
+ * is decoded as one U+FFFD per offending byte.
+ *
  * A ``buffer'' is a piece of source text, usually a file.  However, some
  * buffers, notably those that have never been saved, may not exist on the file
  * system.
  *
  * A ``view'' is a portion of a buffer displayed.  The highlighter will only
- * update highlighting for codepoints that appear in one or more views.
+ * promptly update highlighting for codepoints that appear in one or more views;
+ * updates elsewhere are sent once the client has been quiet for a while or when
+ * a view moves onto them.  (Buffers that have never had a view are updated
+ * promptly throughout.)
  */
 
-#define PROTOCOL_VERSION_NUMBER		0x00000000
+#define PROTOCOL_VERSION_NUMBER		0x00000001
 
 /* Messages sent by the client (the editor) */
 
@@ -36,12 +61,34 @@
 #define CLIENT_END_SESSION		0x00000000
 // Sent to signal the end of support messages and the beginning of highlighting.
 #define CLIENT_BEGIN_SESSION		0x00000001
+// Optionally sent as the very first message, always in version 0 framing, to
+// ask for the newest protocol version that both sides support.  (Anywhere else,
+// it is rejected as an unrecognized command.)  The server answers with
+// SERVER_ACCEPT_PROTOCOL_VERSION, and all later messages in either direction
+// use the accepted version's framing.  The client should wait for that answer
+// before sending anything else; servers that predate versioning will instead
+// reject the message and exit, in which case the client may restart them and
+// speak version 0.
+#define CLIENT_REQUEST_PROTOCOL_VERSION	0x00000002 // [newest protocol version number the client supports]
+// Optionally sent before CLIENT_BEGIN_SESSION (and after any protocol version
+// negotiation) to ask that all further traffic use another wire encoding.  The
+// server answers with SERVER_ACCEPT_WIRE_ENCODING in the current encoding,
+// naming the encoding that will actually be used, which is UCS-4 if the request
+// cannot be honored.  Client messages after the request and server messages
+// after the answer use that encoding, so the client should wait for the
+// answer before sending anything else.
+#define CLIENT_REQUEST_WIRE_ENCODING	0x00000003 // [wire encoding]
 
 // Sent before CLIENT_BEGIN_SESSION to indicate client support for a highlight
 // code.  The server will only send highlights that both it and the client
 // support.
 // See below for the possibled highlight codes.
 #define CLIENT_SUPPORT_HIGHLIGHT_CODE	0x00000101 // [highlight code]
+// Sent before CLIENT_BEGIN_SESSION to indicate client support for one of the
+// server messages below that are marked optional.  The server will only send
+// those messages to clients that support them, and otherwise uses messages that
+// every client understands.
+#define CLIENT_SUPPORT_SERVER_MESSAGE	0x00000102 // [server message purpose]
 
 // Sent when a buffer is no longer relevant to the highlighting process.
 #define CLIENT_DISCARD_BUFFER		0x00010000 // [buffer number]
@@ -67,6 +114,17 @@
 #define CLIENT_REMOVE_CODEPOINTS	0x00010200 // [buffer number] [inclusive lower bound] [exclusive upper bound]
 // Sent to signal an edit that has added codepoints to a buffer.
 #define CLIENT_ADD_CODEPOINTS		0x00010201 // [buffer number] [beginning codepoint index] [INSERTION]
+// Sent in place of CLIENT_ADD_CODEPOINTS when the codepoints to add are exactly
+// the contents of a file that the server can read for itself, usually when an
+// unmodified buffer visiting that file is introduced, so that they need not be
+// sent over the wire.  The file is decoded as UTF-8, ill-formed bytes as in the
+// UTF-8 wire encoding, and with no conversion of line endings.  The server
+// answers with SERVER_FILE_LOADED or, leaving the buffer unchanged,
+// SERVER_FILE_NOT_LOADED.  Since the path is resolved by the server, it should
+// be absolute.  The server only reads files for the editor on its standard
+// input and for editors connected to its socket as the same user that it runs
+// as; anyone else always gets SERVER_FILE_NOT_LOADED.
+#define CLIENT_LOAD_FILE		0x00010202 // [buffer number] [beginning codepoint index] [FILE PATH]
 
 // Sent when a view no longer exists.
 #define CLIENT_DISCARD_VIEW		0x00020000 // [view number]
@@ -91,11 +149,35 @@
 
 /* Messages sent by the server (the highlighter) */
 
+// Sent in reply to CLIENT_REQUEST_PROTOCOL_VERSION, always in version 0
+// framing.
+#define SERVER_ACCEPT_PROTOCOL_VERSION	0x00000002 // [protocol version number]
+// Sent in reply to CLIENT_REQUEST_WIRE_ENCODING.
+#define SERVER_ACCEPT_WIRE_ENCODING	0x00000003 // [wire encoding]
+
+// Sent in reply to CLIENT_LOAD_FILE once the file's codepoints have been added
+// to the buffer.  The checksum is Adler-32 taken over codepoints rather than
+// bytes: starting from a = 1 and b = 0, each codepoint c sets a to (a + c) mod
+// 65521 and then b to (b + a) mod 65521, and the checksum is b * 65536 + a.  An
+// editor that finds a different count or checksum for its own copy of the text
+// should remove the added codepoints and send them with CLIENT_ADD_CODEPOINTS.
+#define SERVER_FILE_LOADED		0x00010200 // [buffer number] [codepoint count] [checksum]
+// Sent in reply to CLIENT_LOAD_FILE if the file could not be read.
+#define SERVER_FILE_NOT_LOADED		0x00010201 // [buffer number]
+
 // Sent to instruct the client to remove all highlighting in the given range.
 #define SERVER_REMOVE_HIGHLIGHTS	0x00010000 // [buffer number] [inclusive lower bound] [exclusive upper bound]
 // Sent to instruct the client to highlight the given range per the given code.
 // See below for the possibled highlight codes.
 #define SERVER_ADD_HIGHLIGHT		0x00010001 // [buffer number] [inclusive lower bound] [exclusive upper bound] [highlight code]
+// Optional.  Sent to instruct the client to remove all highlighting in a range
+// and then highlight it as a series of consecutive runs, each given by its
+// length in codepoints and its highlight code.  The range begins at the given
+// codepoint index and ends where the last run does.  Equivalent to a
+// SERVER_REMOVE_HIGHLIGHTS followed by a SERVER_ADD_HIGHLIGHT per run, but
+// smaller: six words instead of nine for one run, and nearing two fifths the
+// size as runs are added.
+#define SERVER_REPLACE_HIGHLIGHT_RUNS	0x00010010 // [buffer number] [beginning codepoint index] [run count] [run length] [highlight code] [run length] [highlight code] ...
 // Sent to instruct the client to remove all warnings in the given range.
 #define SERVER_REMOVE_WARNINGS		0x00010002 // [buffer number] [inclusive lower bound] [exclusive upper bound]
 // Sent to instruct the client to add warning formatting to the given range.
@@ -128,6 +210,11 @@
 // if there are multiple suggestions.
 #define SERVER_MAKE_SUGGESTION		0x00020101 // [view number] [SUGGESTION]
 
+/* Wire encodings */
+
+#define WIRE_ENCODING_UCS_4		0x00000000
+#define WIRE_ENCODING_UTF_8		0x00000001
+
 /* Highlight codes (partly based on the Inform Technical Manual) */
 
 #define HIGHLIGHT_ORDINARY_I7		0x00000000
@@ -0,0 +1,51 @@
+#ifndef REFERENCE_LEXER_HEADER
+#define REFERENCE_LEXER_HEADER
+
+#include <vector>
+
+#include "codepoints.hpp"
+#include "lexer_monoid.hpp"
+#include "token.hpp"
+
+// The lexer as it was before it was compiled into a transition table (see
+// lexer.hpp): one member function per state, called through a pointer for every
+// codepoint.  It is kept only for i7-benchmark, which times the two against
+// each other and checks that they produce the same tokens.
+class reference_lexer {
+protected:
+  using codepoint_handler = void (reference_lexer::*)(i7_codepoint);
+  codepoint_handler			state;
+  bool					documentation_break_inhibited;
+  // The match count is only meaningful when the state is
+  // in_documentation_break.
+  unsigned				documentation_break_match_count;
+  i7_string_stream			accumulator;
+  std::vector<token>			results;
+
+public:
+  reference_lexer();
+  void operator <<(i7_codepoint codepoint);
+  bool most_recent_codepoint_did_not_combine() const;
+  const std::vector<token>&get_results() const;
+
+protected:
+  void undecided(i7_codepoint codepoint);
+  void after_single_quote(i7_codepoint codepoint);
+  void after_two_single_quotes(i7_codepoint codepoint);
+  void in_whitespace(i7_codepoint codepoint);
+  void after_carriage_return(i7_codepoint codepoint);
+  void after_line_feed(i7_codepoint codepoint);
+  void after_newline(i7_codepoint codepoint);
+  void in_indentation(i7_codepoint codepoint);
+  void in_word(i7_codepoint codepoint);
+  void after_open_parenthesis(i7_codepoint codepoint);
+  void after_hyphen(i7_codepoint codepoint);
+  void after_plus(i7_codepoint codepoint);
+  void in_documentation_break(i7_codepoint codepoint);
+  void after_documentation_break_ended_by_carriage_return(i7_codepoint codepoint);
+  void after_documentation_break_ended_by_line_feed(i7_codepoint codepoint);
+  void after_documentation_break_ended_by_newline(i7_codepoint codepoint);
+  void in_indentation_after_documentation_break(i7_codepoint codepoint);
+};
+
+#endif
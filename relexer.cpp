@@ -1,124 +1,8 @@
 #include <cassert>
+#include <vector>
 
 #include "relexer.hpp"
-
-#define BACKUP_OVER(string) \
-  if (iterator->get_text() != string) return; \
-  --iterator;
-
-static void backup_to_look_for_documentation_break(token_iterator&iterator, i7_codepoint first_codepoint_of_altered_text, bool have_already_effectively_backed_up_once) {
-  static const i7_string*HYPHEN = &vocabulary.acquire(ENCODE("-"));
-  static const i7_string*SPACE = &vocabulary.acquire(ENCODE(" "));
-  static const i7_string*DOCUMENTATION = &vocabulary.acquire(ENCODE("DOCUMENTATION"));
-  // While this function is called to look for documentation breaks, it is
-  // always possible that the codepoint will combine in some more mundane way,
-  // and checking for that requires at least one backup.  We get it out of the
-  // way.
-  --iterator;
-  // Now, typing in the middle of a token can only form a documentation break
-  // with earlier codepoints if it inserts letters to form DOCUMENTATION in the
-  // middle.  In that case, we've already backed up past the other letters, so
-  // we can fall through and pretend that the insertion wasn't in the middle.
-  // Otherwise we're done.
-  if (have_already_effectively_backed_up_once && !is_i7_lexical_delimiter_letter(first_codepoint_of_altered_text)) {
-    return;
-  }
-  // For insertions not in the middle of a token, there are four cases.
-  if (is_i7_lexical_delimiter_letter(first_codepoint_of_altered_text)) {
-    // First, suppose the insertion begins with letters, which might be
-    // DOCUMENTATION.  Then we still need to rewind past the prior space and the
-    // four hyphens and get to the newline.
-    goto from_documentation;
-  }
-  switch (first_codepoint_of_altered_text) {
-  case '\n':
-    // Newlines are similar, except that we have more tokens to cross.
-    goto from_newline;
-  case ' ':
-    // Now we get into more complicated cases.  If we have a space, we don't
-    // know which one it might be, so we have to consider both possibilities.
-    if (iterator->get_text() == DOCUMENTATION) {
-      goto from_second_space;
-    }
-    goto from_first_space;
-  case '-':
-    // And finally, if we have a hyphen, it could be in any of eight positions.
-    // We backup over up to three prior hyphens, which will either be enough or
-    // will get us to the second space, depending on which hyphen group we're
-    // in.
-    if (iterator->get_text() == HYPHEN) {
-      --iterator;
-      if (iterator->get_text() == HYPHEN) {
-	--iterator;
-	if (iterator->get_text() == HYPHEN) {
-	  --iterator;
-	}
-      }
-    }
-    goto from_hyphens;
-  }
-  assert(false);
- from_newline:
-  BACKUP_OVER(HYPHEN);
-  BACKUP_OVER(HYPHEN);
-  BACKUP_OVER(HYPHEN);
-  BACKUP_OVER(HYPHEN);
- from_hyphens:
-  BACKUP_OVER(SPACE);
- from_second_space:
-  BACKUP_OVER(DOCUMENTATION);
- from_documentation:
-  BACKUP_OVER(SPACE);
- from_first_space:
-  BACKUP_OVER(HYPHEN);
-  BACKUP_OVER(HYPHEN);
-  BACKUP_OVER(HYPHEN);
-  BACKUP_OVER(HYPHEN);
-}
-
-static void backup_to_relexing_point(token_iterator&iterator, i7_codepoint first_codepoint_of_altered_text, bool have_already_effectively_backed_up_once) {
-  static const i7_string*SINGLE_QUOTE = &vocabulary.acquire(ENCODE("'"));
-  // First we deal with anything that might combine to form a documentation break; this is the most complicated.
-  if (first_codepoint_of_altered_text == ' ' || first_codepoint_of_altered_text == '-' || first_codepoint_of_altered_text == '\n' || is_i7_lexical_delimiter_letter(first_codepoint_of_altered_text)) {
-    backup_to_look_for_documentation_break(iterator, first_codepoint_of_altered_text, have_already_effectively_backed_up_once);
-    return;
-  }
-  // Then we dispatch other combining punctuation.
-  switch (first_codepoint_of_altered_text) {
-  case '+':  // We need to decide between + and (+.
-  case ')':  // We need to decide between ) and -) and +).
-    // Backup once to look for a preceding parenthesis, hyphen, or plus.
-    if (!have_already_effectively_backed_up_once) {
-      --iterator;
-    }
-    return;
-  case '\'':
-    // Single quotes do not combine, but, because of the I6 parsing rule for a
-    // single quote character literal (written '''), they do change lexical
-    // effect depending on the number of immediately preceding occurrences.  So
-    // we need to backup accoss any earlier single quotes to make sure that we
-    // count correctly.
-    //
-    // The have_already_effectively_backed_up_once flag means that we began in
-    // the middle of a multicodepoint token, which means that there aren't any
-    // preceding single quotes because they're always lexed into one-codepoint
-    // tokens.  Thereore, we only look behind when the flag is cleared.
-    if (!have_already_effectively_backed_up_once) {
-      while (iterator.can_decrement()) {
-	token_iterator probe = iterator;
-	if ((--probe)->get_text() != SINGLE_QUOTE) {
-	  break;
-	}
-	--iterator;
-      }
-    }
-    return;
-  }
-  // And everything else can combine at most once, unless it's punctuation, in which case it can't combine at all.
-  if (!have_already_effectively_backed_up_once && !is_i7_punctuation(first_codepoint_of_altered_text)) {
-    --iterator;
-  }
-}
+#include "parallel_lexer.hpp"
 
 static lexical_reference_points_from_edit no_reference_points_from_edit(token_sequence&source_text) {
   // The use of INITIAL_LEXICAL_STATE here may well be a lie.  However, because
@@ -127,73 +11,126 @@ static lexical_reference_points_from_edit no_reference_points_from_edit(token_se
   return { INITIAL_LEXICAL_STATE, source_text.end(), source_text.end(), INITIAL_LEXICAL_STATE };
 }
 
-static lexical_reference_points_from_edit add_codepoints(token_sequence&source_text, token_iterator insertion_point, unsigned insertion_offset, const i7_string&insertion, lexical_state old_post_relex_state) {
-  assert(insertion.size());
-  lexer insertion_lexer;
-  token_iterator relexing_point = insertion_point;
-  if (!source_text.empty()) {
-    backup_to_relexing_point(relexing_point, insertion[0], insertion_offset);
-  }
-  token prior_sum = source_text.sum_over_interval(source_text.begin(), relexing_point);
-  lexical_state pre_relex_state = prior_sum.get_lexical_effect()(INITIAL_LEXICAL_STATE);
-  for (; relexing_point != insertion_point; relexing_point = source_text.erase(relexing_point)) {
-    for (i7_codepoint codepoint : *relexing_point->get_text()) {
-      insertion_lexer << codepoint;
-    }
-  }
-  if (insertion_offset) {
-    const i7_string&surrounding_text = *insertion_point->get_text();
-    for (unsigned index = 0; index < insertion_offset; ++index) {
-      insertion_lexer << surrounding_text[index];
-    }
-    for (i7_codepoint codepoint : insertion) {
-      insertion_lexer << codepoint;
+// Fills an empty token sequence with the lexed insertion, as when a file is
+// loaded, lexing on several threads.  The sequence is built on this thread,
+// which is where the tokens' text is interned in the shared vocabulary.
+static lexical_reference_points_from_edit load_codepoints(token_sequence&source_text, const i7_string&insertion, unsigned thread_count) {
+  assert(source_text.empty());
+  parallel_lexer loading_lexer;
+  loading_lexer.lex(insertion, thread_count);
+  std::vector<std::reference_wrapper<const token>>results = loading_lexer.get_results();
+  token_iterator first_change = source_text.insert(source_text.end(), results.begin(), results.end());
+  return { INITIAL_LEXICAL_STATE, first_change, source_text.end(), INITIAL_LEXICAL_STATE };
+}
+
+// Relexes after the text of the tokens from first_edited up to end_edited has
+// been replaced by edited_text.  Lexing resumes from the resume state recorded
+// by the first edited token, or, if that token could not record one, by the
+// nearest earlier token that did, with the codepoints that were then pending
+// taken from the tokens before.  After the edit, it stops at the first old
+// token that recorded the lexer's current resume state, as long as the pending
+// codepoints come after the edit, since from then on the lexer must produce
+// what it did before.
+static lexical_reference_points_from_edit relex(token_sequence&source_text, token_iterator first_edited, token_iterator end_edited, const i7_string&edited_text) {
+  // Reused across edits so that its results keep their storage.
+  static lexer relexing_lexer;
+  // An edit at the very end resumes from the last token, because the lexer's
+  // state at the end of the text is not recorded anywhere.
+  token_iterator resumption_point = first_edited;
+  if (!resumption_point.can_increment()) {
+    --resumption_point;
+  }
+  while (resumption_point.can_increment() && resumption_point->get_resume_state() == UNKNOWN_LEXER_RESUME_STATE && resumption_point.can_decrement()) {
+    --resumption_point;
+  }
+  token_iterator beginning = resumption_point;
+  if (resumption_point.can_increment() && resumption_point->get_resume_state() != UNKNOWN_LEXER_RESUME_STATE) {
+    lexer_resume_state resume_state = resumption_point->get_resume_state();
+    std::vector<token_iterator>pending_tokens;
+    for (unsigned pending_codepoint_count = lexer::get_pending_codepoint_count(resume_state); pending_codepoint_count;) {
+      --beginning;
+      assert(beginning->get_codepoint_count() <= pending_codepoint_count);
+      pending_codepoint_count -= beginning->get_codepoint_count();
+      pending_tokens.push_back(beginning);
     }
-    for (unsigned index = insertion_offset, end = surrounding_text.size(); index < end; ++index) {
-      insertion_lexer << surrounding_text[index];
+    i7_string pending_codepoints;
+    for (auto pending_token = pending_tokens.rbegin(); pending_token != pending_tokens.rend(); ++pending_token) {
+      pending_codepoints += *(*pending_token)->get_text();
     }
-    old_post_relex_state = insertion_point->get_lexical_effect()(old_post_relex_state);
-    insertion_point = source_text.erase(insertion_point);
+    relexing_lexer.resume(resume_state, pending_codepoints, beginning->get_resume_state());
   } else {
-    for (i7_codepoint codepoint : insertion) {
-      insertion_lexer << codepoint;
-    }
+    // The first token always records the initial state, so this can only be
+    // the beginning of the text.
+    assert(!beginning.can_decrement() || !beginning.can_increment());
+    relexing_lexer.reset();
   }
-  bool needs_terminator = true;
-  while (insertion_point.can_increment()) {
-    const i7_string&suffix = *insertion_point->get_text();
-    assert(suffix.size());
-    insertion_lexer << suffix[0];
-    if (insertion_lexer.most_recent_codepoint_did_not_combine()) {
-      needs_terminator = false;
-      break;
+  token prior_sum = source_text.sum_over_interval(source_text.begin(), beginning);
+  lexical_state pre_relex_state = prior_sum.get_lexical_effect()(INITIAL_LEXICAL_STATE);
+  lexical_state old_post_relex_state = pre_relex_state;
+  token_iterator position = beginning;
+  for (; position != resumption_point; position = source_text.erase(position)) {
+    old_post_relex_state = position->get_lexical_effect()(old_post_relex_state);
+  }
+  for (; position != first_edited; position = source_text.erase(position)) {
+    relexing_lexer << *position->get_text();
+    old_post_relex_state = position->get_lexical_effect()(old_post_relex_state);
+  }
+  for (; position != end_edited; position = source_text.erase(position)) {
+    old_post_relex_state = position->get_lexical_effect()(old_post_relex_state);
+  }
+  relexing_lexer << edited_text;
+  // Old tokens lexed again since the edit, any of which may turn out to be
+  // pending when the lexer catches up with its old self, and so be kept.
+  std::vector<token_iterator>relexed_tokens;
+  unsigned relexed_codepoint_count = 0;
+  bool synchronized = false;
+  for (; position.can_increment(); ++position) {
+    lexer_resume_state resume_state = position->get_resume_state();
+    if (resume_state != UNKNOWN_LEXER_RESUME_STATE && resume_state == relexing_lexer.get_resume_state() && lexer::get_pending_codepoint_count(resume_state) <= relexed_codepoint_count) {
+      size_t kept_count = 0;
+      for (unsigned pending_codepoint_count = lexer::get_pending_codepoint_count(resume_state); pending_codepoint_count;) {
+	++kept_count;
+	pending_codepoint_count -= relexed_tokens[relexed_tokens.size() - kept_count]->get_codepoint_count();
+      }
+      token_iterator first_kept = kept_count ? relexed_tokens[relexed_tokens.size() - kept_count] : position;
+      if (first_kept->get_resume_state() == relexing_lexer.get_pending_token_resume_state()) {
+	relexed_tokens.erase(relexed_tokens.end() - kept_count, relexed_tokens.end());
+	position = first_kept;
+	synchronized = true;
+	break;
+      }
     }
-    old_post_relex_state = insertion_point->get_lexical_effect()(old_post_relex_state);
-    for (unsigned index = 1, end = suffix.size(); index < end; ++index) {
-      insertion_lexer << suffix[index];
-    }    
-    insertion_point = source_text.erase(insertion_point);
+    relexing_lexer << *position->get_text();
+    relexed_tokens.push_back(position);
+    relexed_codepoint_count += position->get_codepoint_count();
+  }
+  if (!synchronized) {
+    relexing_lexer << TERMINATOR_CODEPOINT;
   }
-  if (needs_terminator) {
-    insertion_lexer << TERMINATOR_CODEPOINT;
+  for (token_iterator relexed_token : relexed_tokens) {
+    old_post_relex_state = relexed_token->get_lexical_effect()(old_post_relex_state);
+    source_text.erase(relexed_token);
   }
+  token_iterator first_change = position;
   bool is_first_change = true;
-  token_iterator first_change = source_text.end();
-  for (const token&result : insertion_lexer.get_results()) {
+  for (const token&result : relexing_lexer.get_results()) {
+    token_iterator insertion = source_text.insert(position, result);
     if (is_first_change) {
-      first_change = source_text.insert(insertion_point, result);
+      first_change = insertion;
       is_first_change = false;
-    } else {
-      source_text.insert(insertion_point, result);
     }
   }
-  return { pre_relex_state, first_change, insertion_point, old_post_relex_state };
+  return { pre_relex_state, first_change, position, old_post_relex_state };
 }
 
 lexical_reference_points_from_edit remove_codepoints(token_sequence&source_text, unsigned beginning_codepoint_index, unsigned end_codepoint_index) {
+  return replace_codepoints(source_text, beginning_codepoint_index, end_codepoint_index, i7_string{});
+}
+
+lexical_reference_points_from_edit replace_codepoints(token_sequence&source_text, unsigned beginning_codepoint_index, unsigned end_codepoint_index, const i7_string&replacement) {
   assert(beginning_codepoint_index <= end_codepoint_index);
   if (beginning_codepoint_index == end_codepoint_index) {
-    return no_reference_points_from_edit(source_text);
+    return add_codepoints(source_text, beginning_codepoint_index, replacement);
   }
   token_iterator beginning_removal_point = source_text.find(token{beginning_codepoint_index});
   assert(beginning_removal_point != source_text.end());
@@ -201,20 +138,71 @@ lexical_reference_points_from_edit remove_codepoints(token_sequence&source_text,
   token_iterator end_removal_point = source_text.find(token{end_codepoint_index});
   unsigned end_removal_offset = end_codepoint_index - source_text.sum_over_interval(source_text.begin(), end_removal_point).get_codepoint_count();
   i7_string remaining_text = beginning_removal_point->get_text()->substr(0, beginning_removal_offset);
+  remaining_text += replacement;
   if (end_removal_point != source_text.end()) {
     remaining_text += end_removal_point->get_text()->substr(end_removal_offset);
   }
   token_iterator reinsertion_point = end_removal_point;
   ++reinsertion_point;
-  token prior_sum = source_text.sum_over_interval(source_text.begin(), reinsertion_point);
-  lexical_state old_post_relex_state = prior_sum.get_lexical_effect()(INITIAL_LEXICAL_STATE);
-  for (token_iterator removal_point = beginning_removal_point; removal_point != reinsertion_point; removal_point = source_text.erase(removal_point));
-  if (remaining_text.size()) {
-    return add_codepoints(source_text, reinsertion_point, 0, remaining_text, old_post_relex_state);
+  return relex(source_text, beginning_removal_point, reinsertion_point, remaining_text);
+}
+
+// Typing a letter into a word, or onto its end, leaves every token boundary
+// where it was, as long as the letter cannot help spell out a documentation
+// break, so the word can be patched in place instead of relexed.  The end of a
+// word is before a codepoint that is not a letter, or else the two would have
+// been lexed together, but the following token is checked anyway.
+//
+// The word must also have been lexed on its own, and not as part of what might
+// have been a documentation break, so that the resume state recorded by the
+// following token counts only the word's codepoints as pending.
+static bool can_patch_word(token_iterator word, unsigned offset, i7_codepoint codepoint) {
+  if (!offset || offset > word->get_codepoint_count()) {
+    return false;
+  }
+  if (!is_i7_letter(codepoint) || is_i7_lexical_delimiter_letter(codepoint)) {
+    return false;
+  }
+  for (i7_codepoint letter : *word->get_text()) {
+    if (!is_i7_letter(letter)) {
+      return false;
+    }
   }
-  prior_sum = source_text.sum_over_interval(source_text.begin(), reinsertion_point);
-  lexical_state pre_relex_state = prior_sum.get_lexical_effect()(INITIAL_LEXICAL_STATE);
-  return { pre_relex_state, reinsertion_point, reinsertion_point, old_post_relex_state };
+  if (word->get_resume_state() == UNKNOWN_LEXER_RESUME_STATE) {
+    return false;
+  }
+  unsigned word_length = word->get_codepoint_count();
+  bool is_at_end = offset == word_length;
+  ++word;
+  if (!word.can_increment()) {
+    return true;
+  }
+  if (word->get_resume_state() == UNKNOWN_LEXER_RESUME_STATE || lexer::get_pending_codepoint_count(word->get_resume_state()) != word_length) {
+    return false;
+  }
+  return !is_at_end || !is_i7_letter((*word->get_text())[0]);
+}
+
+// The patched token keeps its leaf, and only the codepoint counts of its
+// ancestors change.  A word's lexical effect is plain text, the identity, so
+// the lexical state is the same on either side.  The following token now has
+// one more codepoint pending before it.
+//
+// What the parser observed about the old word no longer holds, so it is
+// retracted, as it would have been had the leaf been erased, leaving the
+// rehighlight to observe the new word afresh.  That has to happen before the
+// text changes, because the buffer files terminal beginnings under the text.
+static lexical_reference_points_from_edit patch_word(token_sequence&source_text, token_iterator word, unsigned offset, i7_codepoint codepoint, lexical_state state) {
+  word->retract();
+  i7_string text = *word->get_text();
+  text.insert(offset, 1, codepoint);
+  source_text.replace(word, token{text, word->is_only_whitespace(), word->get_lexical_effect(), word->get_line_count(), word->get_resume_state()}, token{1});
+  token_iterator end_of_relexed_text = word;
+  ++end_of_relexed_text;
+  if (end_of_relexed_text.can_increment()) {
+    end_of_relexed_text->set_resume_state(lexer::add_pending_codepoints(end_of_relexed_text->get_resume_state(), 1));
+  }
+  return { state, word, end_of_relexed_text, state };
 }
 
 lexical_reference_points_from_edit add_codepoints(token_sequence&source_text, unsigned beginning_codepoint_index, const i7_string&insertion) {
@@ -222,9 +210,35 @@ lexical_reference_points_from_edit add_codepoints(token_sequence&source_text, un
     return no_reference_points_from_edit(source_text);
   }
   token_iterator insertion_point = source_text.find(token{beginning_codepoint_index});
-  unsigned insertion_offset = beginning_codepoint_index - source_text.sum_over_interval(source_text.begin(), insertion_point).get_codepoint_count();
-  assert(insertion_point != source_text.end() || !insertion_offset);
   token prior_sum = source_text.sum_over_interval(source_text.begin(), insertion_point);
-  lexical_state old_post_relex_state = prior_sum.get_lexical_effect()(INITIAL_LEXICAL_STATE);
-  return add_codepoints(source_text, insertion_point, insertion_offset, insertion, old_post_relex_state);
+  unsigned insertion_offset = beginning_codepoint_index - prior_sum.get_codepoint_count();
+  assert(insertion_point != source_text.end() || !insertion_offset);
+  if (source_text.empty()) {
+    unsigned thread_count = get_lexing_thread_count(insertion.size());
+    if (thread_count > 1) {
+      return load_codepoints(source_text, insertion, thread_count);
+    }
+  }
+  if (insertion.size() == 1) {
+    lexical_state state = prior_sum.get_lexical_effect()(INITIAL_LEXICAL_STATE);
+    token_iterator word = insertion_point;
+    unsigned offset = insertion_offset;
+    if (!offset && word.can_decrement()) {
+      --word;
+      offset = word->get_codepoint_count();
+    }
+    if (can_patch_word(word, offset, insertion[0])) {
+      return patch_word(source_text, word, offset, insertion[0], state);
+    }
+  }
+  if (!insertion_offset) {
+    return relex(source_text, insertion_point, insertion_point, insertion);
+  }
+  const i7_string&surrounding_text = *insertion_point->get_text();
+  i7_string edited_text = surrounding_text.substr(0, insertion_offset);
+  edited_text += insertion;
+  edited_text.append(surrounding_text, insertion_offset, i7_string::npos);
+  token_iterator end_edited = insertion_point;
+  ++end_edited;
+  return relex(source_text, insertion_point, end_edited, edited_text);
 }
@@ -19,5 +19,8 @@ struct lexical_reference_points_from_edit {
 
 lexical_reference_points_from_edit remove_codepoints(token_sequence&source_text, unsigned beginning_codepoint_index, unsigned end_codepoint_index);
 lexical_reference_points_from_edit add_codepoints(token_sequence&source_text, unsigned beginning_codepoint_index, const i7_string&insertion);
+// Relexes once for what would otherwise be a removal followed by an insertion
+// at the same place.
+lexical_reference_points_from_edit replace_codepoints(token_sequence&source_text, unsigned beginning_codepoint_index, unsigned end_codepoint_index, const i7_string&replacement);
 
 #endif
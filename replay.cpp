@@ -0,0 +1,337 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "io.hpp"
+#include "protocol.hpp"
+#include "session.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+// i7-replay feeds a trace recorded with --record (see trace.hpp) to fresh
+// sessions in place of io.cpp and reports, for each kind of client message, how
+// long it took from the message's arrival until the sessions had written their
+// last reply to it, along with the overall throughput.
+//
+// By default, messages are fed as fast as possible, and the sessions go idle
+// exactly where the recorded ones did, so that every run does the same work.
+// With --real-time, they are instead fed at the recorded pace, and the sessions
+// go idle whenever they catch up, as a live server would; latencies then
+// include any time that a message spent waiting behind earlier work.
+
+using replay_clock = chrono::steady_clock;
+
+static vector<trace_record> records;
+// The index of the next record to dispatch.
+static size_t next_record_index = 0;
+static bool real_time = false;
+static replay_clock::time_point replay_beginning;
+
+// What the session has written since it last went idle.
+static bool wrote_since_idle = false;
+static replay_clock::time_point last_write_time;
+static unsigned long long written_message_count = 0;
+
+// The messages since the session last went idle, waiting for their latencies
+// to be known.
+struct arrival {
+  uint32_t				command;
+  replay_clock::time_point		time;
+};
+static vector<arrival> burst;
+static map<uint32_t, vector<double>> latencies_by_command;
+
+static replay_clock::time_point get_arrival_time(const trace_record&record) {
+  return replay_beginning + chrono::microseconds{record.arrival_microseconds};
+}
+
+// As in io.cpp, every connection in the trace gets a session of its own, all
+// parsing with the one grammar.
+static const grammar*shared_grammar = nullptr;
+static map<uint32_t, typename ::session*> sessions;
+
+static typename ::session&get_session(const trace_record&record) {
+  typename ::session*&result = sessions[record.connection_number];
+  if (!result) {
+    result = new typename ::session{*shared_grammar};
+  }
+  return *result;
+}
+
+static void forget_connection(uint32_t connection_number) {
+  map<uint32_t, typename ::session*>::iterator i = sessions.find(connection_number);
+  if (i != sessions.end()) {
+    delete i->second;
+    sessions.erase(i);
+  }
+}
+
+static void dispatch(const trace_record&record) {
+  const uint32_t*arguments = record.arguments;
+  typename ::session&session = get_session(record);
+  switch (record.command) {
+  case CLIENT_SUPPORT_HIGHLIGHT_CODE:
+    session.support_highlight_code(static_cast< ::highlight_code>(arguments[0]));
+    break;
+  case CLIENT_DISCARD_BUFFER:
+    session.discard_buffer(arguments[0]);
+    break;
+  case CLIENT_INTRODUCE_BUFFER:
+    session.introduce_buffer(arguments[0]);
+    break;
+  case CLIENT_MARK_BUFFER_UNDECIDED:
+    mark_buffer_undecided(arguments[0]);
+    break;
+  case CLIENT_MARK_BUFFER_AS_STORY:
+    mark_buffer_as_story(arguments[0]);
+    break;
+  case CLIENT_MARK_BUFFER_AS_EXTENSION:
+    mark_buffer_as_extension(arguments[0], record.text);
+    break;
+  case CLIENT_REMOVE_CODEPOINTS:
+    session.remove_codepoints(arguments[0], arguments[1], arguments[2]);
+    break;
+  case CLIENT_ADD_CODEPOINTS:
+    session.add_codepoints(arguments[0], arguments[1], i7_string{record.text});
+    break;
+  case CLIENT_LOAD_FILE:
+    // The trace holds the file's contents as they were when it was recorded.
+    if (arguments[2]) {
+      session.add_codepoints(arguments[0], arguments[1], i7_string{record.text});
+    }
+    break;
+  case CLIENT_DISCARD_VIEW:
+    session.discard_view(arguments[0]);
+    break;
+  case CLIENT_INTRODUCE_VIEW:
+    session.introduce_view(arguments[0], arguments[1]);
+    break;
+  case CLIENT_CLEAR_VIEW:
+    session.move_view(arguments[0], 0, 0);
+    break;
+  case CLIENT_MOVE_VIEW:
+    session.move_view(arguments[0], arguments[1], arguments[2]);
+    break;
+  case CLIENT_CLEAR_CURSOR:
+    clear_cursor(arguments[0]);
+    break;
+  case CLIENT_SET_CURSOR:
+    set_cursor(arguments[0], arguments[1], arguments[2]);
+    break;
+  }
+}
+
+// Lets the sessions go idle and settles the latencies of the messages that
+// they handled since the last time.
+static void finish_burst() {
+  for (const auto&session_mapping : sessions) {
+    session_mapping.second->idle();
+  }
+  replay_clock::time_point end = wrote_since_idle ? last_write_time : replay_clock::now();
+  for (const arrival&message : burst) {
+    latencies_by_command[message.command].push_back(chrono::duration<double, milli>(end - message.time).count());
+  }
+  burst.clear();
+  wrote_since_idle = false;
+}
+
+static double get_percentile(const vector<double>&sorted_values, double fraction) {
+  size_t rank = static_cast<size_t>(ceil(fraction * sorted_values.size()));
+  return sorted_values[rank ? rank - 1 : 0];
+}
+
+static const char*get_command_name(uint32_t command) {
+  switch (command) {
+  case CLIENT_END_SESSION:
+    return "CLIENT_END_SESSION";
+  case CLIENT_BEGIN_SESSION:
+    return "CLIENT_BEGIN_SESSION";
+  case CLIENT_REQUEST_PROTOCOL_VERSION:
+    return "CLIENT_REQUEST_PROTOCOL_VERSION";
+  case CLIENT_REQUEST_WIRE_ENCODING:
+    return "CLIENT_REQUEST_WIRE_ENCODING";
+  case CLIENT_SUPPORT_HIGHLIGHT_CODE:
+    return "CLIENT_SUPPORT_HIGHLIGHT_CODE";
+  case CLIENT_SUPPORT_SERVER_MESSAGE:
+    return "CLIENT_SUPPORT_SERVER_MESSAGE";
+  case CLIENT_DISCARD_BUFFER:
+    return "CLIENT_DISCARD_BUFFER";
+  case CLIENT_INTRODUCE_BUFFER:
+    return "CLIENT_INTRODUCE_BUFFER";
+  case CLIENT_MARK_BUFFER_UNDECIDED:
+    return "CLIENT_MARK_BUFFER_UNDECIDED";
+  case CLIENT_MARK_BUFFER_AS_STORY:
+    return "CLIENT_MARK_BUFFER_AS_STORY";
+  case CLIENT_MARK_BUFFER_AS_EXTENSION:
+    return "CLIENT_MARK_BUFFER_AS_EXTENSION";
+  case CLIENT_REMOVE_CODEPOINTS:
+    return "CLIENT_REMOVE_CODEPOINTS";
+  case CLIENT_ADD_CODEPOINTS:
+    return "CLIENT_ADD_CODEPOINTS";
+  case CLIENT_LOAD_FILE:
+    return "CLIENT_LOAD_FILE";
+  case CLIENT_DISCARD_VIEW:
+    return "CLIENT_DISCARD_VIEW";
+  case CLIENT_INTRODUCE_VIEW:
+    return "CLIENT_INTRODUCE_VIEW";
+  case CLIENT_CLEAR_VIEW:
+    return "CLIENT_CLEAR_VIEW";
+  case CLIENT_MOVE_VIEW:
+    return "CLIENT_MOVE_VIEW";
+  case CLIENT_CLEAR_CURSOR:
+    return "CLIENT_CLEAR_CURSOR";
+  case CLIENT_SET_CURSOR:
+    return "CLIENT_SET_CURSOR";
+  }
+  return "(unknown)";
+}
+
+int main(int argc, char**argv) {
+  const char*trace_path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--real-time")) {
+      real_time = true;
+    } else if (!trace_path) {
+      trace_path = argv[i];
+    } else {
+      trace_path = nullptr;
+      break;
+    }
+  }
+  if (!trace_path) {
+    fprintf(stderr, "Usage: %s [--real-time] TRACE_PATH\n", argv[0]);
+    return 1;
+  }
+  {
+    trace_reader reader{trace_path};
+    trace_record record;
+    while (reader.read_record(record)) {
+      records.push_back(record);
+    }
+  }
+  replay_clock::time_point startup_beginning = replay_clock::now();
+  shared_grammar = new typename ::grammar{};
+  replay_beginning = replay_clock::now();
+  printf("Built the grammar in %.1f ms.\n", chrono::duration<double, milli>(replay_beginning - startup_beginning).count());
+  // The trace's clock started before the recorded server built its grammar, so
+  // start ours at the first message.
+  for (const trace_record&record : records) {
+    if (record.command != TRACE_IDLE) {
+      replay_beginning -= chrono::microseconds{record.arrival_microseconds};
+      break;
+    }
+  }
+  unsigned long long dispatched_message_count = 0, added_codepoint_count = 0;
+  replay_clock::time_point first_dispatch_time = replay_clock::now();
+  while (next_record_index < records.size()) {
+    const trace_record&record = records[next_record_index];
+    if (record.command == TRACE_IDLE) {
+      ++next_record_index;
+      if (!real_time && !burst.empty()) {
+	finish_burst();
+      }
+      continue;
+    }
+    replay_clock::time_point arrival_time = replay_clock::now();
+    if (real_time) {
+      replay_clock::time_point recorded_arrival_time = get_arrival_time(record);
+      if (recorded_arrival_time > arrival_time) {
+	if (!burst.empty()) {
+	  finish_burst();
+	}
+	this_thread::sleep_until(recorded_arrival_time);
+      }
+      arrival_time = recorded_arrival_time;
+    }
+    ++next_record_index;
+    burst.push_back({record.command, arrival_time});
+    dispatch(record);
+    ++dispatched_message_count;
+    if (record.command == CLIENT_ADD_CODEPOINTS || record.command == CLIENT_LOAD_FILE) {
+      added_codepoint_count += record.text.size();
+    }
+    if (record.command == CLIENT_END_SESSION) {
+      finish_burst();
+      forget_connection(record.connection_number);
+    }
+  }
+  if (!burst.empty()) {
+    finish_burst();
+  }
+  double seconds = chrono::duration<double>(replay_clock::now() - first_dispatch_time).count();
+  printf("%-32s %8s %10s %10s %10s %10s\n", "Message", "Count", "p50 ms", "p90 ms", "p99 ms", "Max ms");
+  for (auto&command_latencies : latencies_by_command) {
+    vector<double>&latencies = command_latencies.second;
+    sort(latencies.begin(), latencies.end());
+    printf("%-32s %8zu %10.3f %10.3f %10.3f %10.3f\n", get_command_name(command_latencies.first), latencies.size(), get_percentile(latencies, 0.5), get_percentile(latencies, 0.9), get_percentile(latencies, 0.99), latencies.back());
+  }
+  printf("Replayed %llu messages adding %llu codepoints in %.3f s: %.1f messages/s, %.1f kcodepoints/s; wrote %llu messages.\n", dispatched_message_count, added_codepoint_count, seconds, dispatched_message_count / seconds, added_codepoint_count / seconds / 1e3, written_message_count);
+  return 0;
+}
+
+// Stand-ins for io.cpp's output, which only note when something was written.
+
+bool has_pending_input() {
+  if (next_record_index >= records.size()) {
+    return false;
+  }
+  if (real_time) {
+    return get_arrival_time(records[next_record_index]) <= replay_clock::now();
+  }
+  // At full speed, everything up to the next recorded idle point has arrived.
+  return records[next_record_index].command != TRACE_IDLE;
+}
+
+static void note_write() {
+  wrote_since_idle = true;
+  last_write_time = replay_clock::now();
+  ++written_message_count;
+}
+
+void remove_highlights(unsigned buffer_number, unsigned beginning, unsigned end) {
+  note_write();
+}
+void add_highlight(unsigned buffer_number, unsigned beginning, unsigned end, ::highlight_code highlight_code) {
+  note_write();
+}
+void replace_highlights(unsigned buffer_number, unsigned beginning, unsigned end, const vector<highlight_run>&runs) {
+  note_write();
+}
+void remove_warnings(unsigned buffer_number, unsigned beginning, unsigned end) {
+  note_write();
+}
+void add_warning(unsigned buffer_number, unsigned beginning, unsigned end) {
+  note_write();
+}
+void remove_errors(unsigned buffer_number, unsigned beginning, unsigned end) {
+  note_write();
+}
+void add_error(unsigned buffer_number, unsigned beginning, unsigned end) {
+  note_write();
+}
+void remove_hovertexts(unsigned buffer_number, unsigned beginning, unsigned end) {
+  note_write();
+}
+void add_hovertext(unsigned buffer_number, unsigned beginning, unsigned end, const i7_string&hovertext) {
+  note_write();
+}
+
+void remove_emphasis(unsigned view_number, unsigned beginning, unsigned end) {
+  note_write();
+}
+void add_emphasis(unsigned view_number, unsigned beginning, unsigned end) {
+  note_write();
+}
+void clear_suggestions(unsigned view_number) {
+  note_write();
+}
+void make_suggestions(unsigned view_number, const i7_string&suggestion) {
+  note_write();
+}
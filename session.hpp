@@ -2,88 +2,59 @@
 #define SESSION_HEADER
 
 #include <iostream>
-#include <functional>
 #include <unordered_set>
 #include <unordered_map>
 
-#include "custom_multimap.hpp"
 #include "buffer.hpp"
 #include "deduction.hpp"
+#include "grammar.hpp"
+#include "lexical_highlights.hpp"
 
-class parseme;
-class production;
-class subsentence;
-class wording;
-class sentence;
-class passage;
-class potential_match;
-
+// What one editor has open: its buffers and views, under the numbers that it
+// gave them, and the highlight codes that it understands.  Every session parses
+// with the same shared grammar, which none of them can change.
 class session : public context {
 protected:
   using buffer_map = std::unordered_map<unsigned, buffer*>;
-  using production_map = custom_multimap<const parseme*, const production*>;
-  using production_set = typename production_map::value_set_type;
+  const ::grammar&			grammar;
   buffer_map				buffers;
-  std::unordered_set<const subsentence*>subsentences;
-  std::unordered_set<const wording*>	wordings;
-  std::unordered_set<const sentence*>	sentences;
-  std::unordered_set<const passage*>	passages;
-  production_map			productions_by_beginnings;
-  production_map			productions_by_results;
+  // The buffer number of each view, by view number.
+  std::unordered_map<unsigned, unsigned>view_buffers;
+  // The highlight codes that the editor declared; runs with any other code are
+  // left unhighlighted rather than sent.
+  std::unordered_set< ::highlight_code>supported_highlight_codes;
 
 public:
-  session(); // Defined in language.cpp rather than session.cpp.
-  // Destructor intentionally omitted, as, at the moment, the only instance is a
-  // static global, which does not need to clean up.
-  // ~session();
+  explicit session(const ::grammar&grammar);
+  ~session();
 
 protected:
-  const production*add_production(const ::production&production);
-  const production*remove_production(const ::production&production);
+  // Parsing gives way to newer input, which is likely to make it moot.
+  virtual bool should_cancel_propagation() const override;
 
 public:
+  const ::grammar&get_grammar() const;
   const buffer_map&get_buffers() const;
 
-  const std::unordered_set<const subsentence*>&get_subsentences() const;
-  const std::unordered_set<const wording*>&get_wordings() const;
-  const std::unordered_set<const sentence*>&get_sentences() const;
-  const std::unordered_set<const passage*>&get_passages() const;
-
-  void add_subsentence(const ::subsentence&subsentence);
-  void add_wording(const ::wording&wording);
-  void add_sentence(const ::sentence&sentence);
-  void add_passage(const ::passage&passage);
-
-  void remove_subsentence(const ::subsentence&subsentence);
-  void remove_wording(const ::wording&wording);
-  void remove_sentence(const ::sentence&sentence);
-  void remove_passage(const ::passage&passage);
-
-  const production_set&get_productions_beginning_with(const parseme*beginning) const;
-  const production_set&get_productions_resulting_in(const parseme*result) const;
-
-protected:
-  bool can_begin_descendant(const production*key, const production*root, std::unordered_set<const production*>&visited) const;
-  void get_additional_beginnings(const production*root, std::unordered_set<const production*>&visited) const;
-  void get_additional_beginnings_relying_on(const production*root, std::unordered_map<const production*, unsigned>&visited, const production&crux, const std::function<bool(const production*)>&exemption) const;
-  std::unordered_set<const production*>get_beginnings_relying_on(const production&crux, const std::function<bool(const production*)>&exemption) const;
-
-public:
-  bool can_begin_sentence_with(const production*key) const;
-  std::unordered_set<const production*>get_sentence_beginnings() const;
-  std::unordered_set<const production*>get_sentence_beginnings_relying_on(const production&crux) const;
-  std::unordered_set<const production*>get_result_beginnings_relying_on(const production&crux) const;
-  std::unordered_set<const production*>get_continuing_beginnings(const potential_match&partial_match) const;
-  std::unordered_set<const production*>get_continuing_beginnings(token_iterator inclusive_end_of_matches) const;
+  bool supports_highlight_code(::highlight_code highlight_code) const;
+  void support_highlight_code(::highlight_code highlight_code);
 
   void discard_buffer(unsigned buffer_number);
   void introduce_buffer(unsigned buffer_number);
   void remove_codepoints(unsigned buffer_number, unsigned beginning, unsigned end);
-  void add_codepoints(unsigned buffer_number, unsigned beginning, const i7_string&insertion);
+  void add_codepoints(unsigned buffer_number, unsigned beginning, i7_string&&insertion);
+  void discard_view(unsigned view_number);
+  void introduce_view(unsigned view_number, unsigned buffer_number);
+  void move_view(unsigned view_number, unsigned beginning, unsigned end);
+  // Called whenever the editor has nothing more for us for the moment, so that
+  // work deferred while commands were still arriving can be finished.
+  void idle();
+  // Called when the editor has been quiet for a while after idle(), to send a
+  // piece of the output that was put off because the editor was not showing the
+  // text that it concerns.  Returns true if more remains.
+  bool send_deferred_output();
 
   friend std::ostream&operator <<(std::ostream&out, const ::session&session);
 };
 
-extern ::session*session;
-
 #endif
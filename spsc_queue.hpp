@@ -0,0 +1,137 @@
+#ifndef SPSC_QUEUE_HEADER
+#define SPSC_QUEUE_HEADER
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/*
+ * A bounded first-in-first-out queue for handing values from exactly one
+ * producer thread to exactly one consumer thread.
+ *
+ * Pushing and popping are lock free: each side owns one index into a ring of
+ * slots and only reads the other's.  The mutex and condition variable are only
+ * touched when a side finds the queue full or empty and has to sleep, and, on
+ * the other side, when it sees that its counterpart is asleep.
+ *
+ * Values are exchanged with swap rather than copied, so that a consumer that
+ * pops into the same variable every time hands the storage of the previous
+ * value back to the ring, and the producer reuses it in turn; with strings
+ * inside the values, that avoids an allocation per message.
+ */
+template<typename T>class spsc_queue {
+protected:
+  std::vector<T>			slots;
+  std::size_t				mask;
+  // The index of the next slot to pop, written only by the consumer, and of the
+  // next slot to push, written only by the producer.  Both count up without
+  // wrapping; they are kept on separate cache lines so that the two threads do
+  // not contend for one.
+  alignas(64) std::atomic<std::size_t>	head;
+  alignas(64) std::atomic<std::size_t>	tail;
+  alignas(64) std::atomic<bool>		consumer_waiting;
+  std::atomic<bool>			producer_waiting;
+  std::mutex				mutex;
+  std::condition_variable		condition;
+
+  static std::size_t round_up_to_power_of_two(std::size_t minimum) {
+    std::size_t result = 1;
+    while (result < minimum) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  // The waiting flag and the index are both sequentially consistent, so either
+  // the sleeper sees the new index or the waker sees the flag; in the latter
+  // case, taking the lock ensures that the sleeper is already waiting.
+  void wake(std::atomic<bool>&waiting) {
+    if (waiting.load()) {
+      std::lock_guard<std::mutex>lock{mutex};
+      condition.notify_all();
+    }
+  }
+
+  template<typename P>void sleep_while(std::atomic<bool>&waiting, P predicate) {
+    std::unique_lock<std::mutex>lock{mutex};
+    waiting.store(true);
+    while (predicate()) {
+      condition.wait(lock);
+    }
+    waiting.store(false);
+  }
+
+public:
+  explicit spsc_queue(std::size_t minimum_capacity) :
+    slots(round_up_to_power_of_two(minimum_capacity)),
+    mask{slots.size() - 1},
+    head{0},
+    tail{0},
+    consumer_waiting{false},
+    producer_waiting{false} {}
+
+  spsc_queue(const spsc_queue&) = delete;
+  spsc_queue&operator =(const spsc_queue&) = delete;
+
+  // For the consumer: true if a pop would have to wait.
+  bool empty() const {
+    return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+  }
+
+  // For the producer: swaps value into the queue, blocking while it is full.
+  void push(T&value) {
+    std::size_t position = tail.load(std::memory_order_relaxed);
+    if (position - head.load(std::memory_order_acquire) == slots.size()) {
+      sleep_while(producer_waiting, [this, position]() {
+	  return position - head.load() == slots.size();
+	});
+    }
+    std::swap(slots[position & mask], value);
+    tail.store(position + 1);
+    wake(consumer_waiting);
+  }
+
+  // For the consumer: swaps the oldest value out of the queue into value and
+  // returns true, or returns false if the queue is empty.
+  bool try_pop(T&value) {
+    std::size_t position = head.load(std::memory_order_relaxed);
+    if (position == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    std::swap(slots[position & mask], value);
+    head.store(position + 1);
+    wake(producer_waiting);
+    return true;
+  }
+
+  // For the consumer: like try_pop, but waits up to timeout for a value.
+  template<typename R, typename P>bool pop_for(T&value, const std::chrono::duration<R, P>&timeout) {
+    if (empty()) {
+      std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+      std::size_t position = head.load(std::memory_order_relaxed);
+      std::unique_lock<std::mutex>lock{mutex};
+      consumer_waiting.store(true);
+      while (position == tail.load() && condition.wait_until(lock, deadline) != std::cv_status::timeout);
+      consumer_waiting.store(false);
+    }
+    return try_pop(value);
+  }
+
+  // For the consumer: like try_pop, but blocks while the queue is empty.
+  void pop(T&value) {
+    if (empty()) {
+      std::size_t position = head.load(std::memory_order_relaxed);
+      sleep_while(consumer_waiting, [this, position]() {
+	  return position == tail.load();
+	});
+    }
+    bool popped = try_pop(value);
+    (void)popped;
+  }
+};
+
+#endif
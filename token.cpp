@@ -4,12 +4,25 @@ using namespace std;
 
 internalizer<i7_string>vocabulary;
 
+// The vocabulary that tokens on this thread use; see vocabulary_scope.
+static thread_local internalizer<i7_string>*thread_vocabulary = &vocabulary;
+
+vocabulary_scope::vocabulary_scope(internalizer<i7_string>&vocabulary) :
+  previous{thread_vocabulary} {
+  thread_vocabulary = &vocabulary;
+}
+
+vocabulary_scope::~vocabulary_scope() {
+  thread_vocabulary = previous;
+}
+
 // The addition constructor.
 token::token(const token&left, const token&right) :
   codepoint_count{left.codepoint_count + right.codepoint_count},
   line_count{left.line_count + right.line_count},
   text{nullptr},
   only_whitespace{left.only_whitespace && right.only_whitespace},
+  resume_state{UNKNOWN_LEXER_RESUME_STATE},
   lexical_effect{left.lexical_effect + right.lexical_effect} {}
 
 token::token() :
@@ -17,6 +30,7 @@ token::token() :
   line_count{0},
   text{nullptr},
   only_whitespace{true},
+  resume_state{UNKNOWN_LEXER_RESUME_STATE},
   lexical_effect{0} {}
 
 token::token(unsigned codepoint_count) :
@@ -24,25 +38,28 @@ token::token(unsigned codepoint_count) :
   line_count{0},
   text{nullptr},
   only_whitespace{false},
+  resume_state{UNKNOWN_LEXER_RESUME_STATE},
   lexical_effect{0} {}
 
-token::token(const i7_string&text, bool only_whitespace, const lexer_monoid&lexical_effect, unsigned line_count) :
+token::token(const i7_string_view&text, bool only_whitespace, const lexer_monoid&lexical_effect, unsigned line_count, lexer_resume_state resume_state) :
   codepoint_count{static_cast<unsigned>(text.size())},
   line_count{line_count},
-  text{&vocabulary.acquire(text)},
+  text{&thread_vocabulary->acquire(text)},
   only_whitespace{only_whitespace},
+  resume_state{resume_state},
   lexical_effect{lexical_effect} {}
 
 token::token(const token&copy) :
   codepoint_count{copy.codepoint_count},
   line_count{copy.line_count},
-  text{copy.text ? &vocabulary.acquire(*copy.text) : nullptr},
+  text{copy.text ? &thread_vocabulary->acquire(*copy.text) : nullptr},
   only_whitespace{copy.only_whitespace},
+  resume_state{copy.resume_state},
   lexical_effect{copy.lexical_effect} {}
 
 token::~token() {
   if (text) {
-    vocabulary.release(*text);
+    thread_vocabulary->release(*text);
   }
 }
 
@@ -54,15 +71,16 @@ token&token::operator =(const token&copy) {
   line_count = copy.line_count;
   if (text != copy.text) {
     if (text) {
-      vocabulary.release(*text);
+      thread_vocabulary->release(*text);
     }
     if (copy.text) {
-      text = &vocabulary.acquire(*copy.text);
+      text = &thread_vocabulary->acquire(*copy.text);
     } else {
       text = nullptr;
     }
   }
   only_whitespace = copy.only_whitespace;
+  resume_state = copy.resume_state;
   lexical_effect = copy.lexical_effect;
   return *this;
 }
@@ -83,6 +101,14 @@ bool token::is_only_whitespace() const {
   return only_whitespace;
 }
 
+lexer_resume_state token::get_resume_state() const {
+  return resume_state;
+}
+
+void token::set_resume_state(lexer_resume_state resume_state) const {
+  this->resume_state = resume_state;
+}
+
 const lexer_monoid&token::get_lexical_effect() const {
   return lexical_effect;
 }
@@ -99,9 +125,10 @@ token&token::operator +=(const token&other) {
   codepoint_count += other.codepoint_count;
   line_count += other.line_count;
   if (text) {
-    vocabulary.release(*text);
+    thread_vocabulary->release(*text);
   }
   text = nullptr;
+  resume_state = UNKNOWN_LEXER_RESUME_STATE;
   lexical_effect += other.lexical_effect;
   return *this;
 }
@@ -10,6 +10,27 @@
 
 extern internalizer<i7_string>vocabulary;
 
+// While a vocabulary_scope lives, tokens created, copied, or destroyed on its
+// thread intern their text in the given vocabulary rather than the shared one,
+// which is not safe to use from more than one thread.  A token must be
+// destroyed under the vocabulary that it was created under, but copying it
+// under another interns its text there.
+class vocabulary_scope {
+protected:
+  internalizer<i7_string>*		previous;
+
+public:
+  vocabulary_scope(internalizer<i7_string>&vocabulary);
+  ~vocabulary_scope();
+};
+
+// Where the lexer stood just before it consumed a token's first codepoint,
+// packed as in lexer.cpp, so that relexing can pick up from there.
+using lexer_resume_state = uint32_t;
+// Recorded for tokens that begin after a run of pending codepoints too long to
+// count in a resume state, and by sums.
+static const lexer_resume_state UNKNOWN_LEXER_RESUME_STATE = ~static_cast<lexer_resume_state>(0);
+
 /* The token class represents lexical tokens as elements of a product monoid for
    storage in a monoid_sequence. */
 class token : public fact_annotatable {
@@ -19,6 +40,9 @@ protected:
   // Text may be null; it is not preserved by addition.
   const i7_string*			text;
   bool					only_whitespace;
+  // Not preserved by addition, and, like annotations, considered semantically
+  // const, since it says how the token was lexed and not what it is.
+  mutable lexer_resume_state		resume_state;
   lexer_monoid				lexical_effect;
 
   // The addition constructor.
@@ -27,7 +51,8 @@ protected:
 public:
   token();
   token(unsigned codepoint_count);
-  token(const i7_string&text, bool only_whitespace, const lexer_monoid&lexical_effect, unsigned line_count);
+  // Interns the text, which therefore need not outlive the token.
+  token(const i7_string_view&text, bool only_whitespace, const lexer_monoid&lexical_effect, unsigned line_count, lexer_resume_state resume_state = UNKNOWN_LEXER_RESUME_STATE);
   token(const token&copy);
   ~token();
 
@@ -37,6 +62,8 @@ public:
   unsigned get_line_count() const;
   const i7_string*get_text() const;
   bool is_only_whitespace() const;
+  lexer_resume_state get_resume_state() const;
+  void set_resume_state(lexer_resume_state resume_state) const;
   const lexer_monoid&get_lexical_effect() const;
 
   bool operator <(const token&other) const;
@@ -0,0 +1,105 @@
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "trace.hpp"
+
+using namespace std;
+
+static void put_bytes(vector<unsigned char>&bytes, uint64_t value, unsigned count) {
+  for (unsigned i = 0; i < count; ++i) {
+    bytes.push_back(static_cast<unsigned char>(value >> (8 * i)));
+  }
+}
+
+static uint64_t get_bytes(const unsigned char*bytes, unsigned count) {
+  uint64_t result = 0;
+  for (unsigned i = count; i--;) {
+    result = (result << 8) | bytes[i];
+  }
+  return result;
+}
+
+trace_writer::trace_writer(const char*path) :
+  file{fopen(path, "wb")},
+  beginning{chrono::steady_clock::now()} {
+  if (!file) {
+    perror(path);
+    exit(1);
+  }
+  fputs(TRACE_MAGIC, file);
+}
+
+trace_writer::~trace_writer() {
+  fclose(file);
+}
+
+void trace_writer::write_record(uint64_t arrival_microseconds, uint32_t connection_number, uint32_t command, const uint32_t*arguments, const i7_string&text) {
+  vector<unsigned char>bytes;
+  bytes.reserve(32 + 4 * text.size());
+  put_bytes(bytes, arrival_microseconds, 8);
+  put_bytes(bytes, connection_number, 4);
+  put_bytes(bytes, command, 4);
+  for (unsigned i = 0; i < 3; ++i) {
+    put_bytes(bytes, arguments[i], 4);
+  }
+  put_bytes(bytes, text.size(), 4);
+  for (i7_codepoint codepoint : text) {
+    put_bytes(bytes, codepoint, 4);
+  }
+  fwrite(bytes.data(), 1, bytes.size(), file);
+}
+
+void trace_writer::write_message(uint32_t connection_number, const client_message&message) {
+  // The arrival time may predate the trace if the message was decoded while the
+  // trace was being opened.
+  chrono::steady_clock::duration arrival = max(message.arrival_time - beginning, chrono::steady_clock::duration::zero());
+  write_record(static_cast<uint64_t>(chrono::duration_cast<chrono::microseconds>(arrival).count()), connection_number, message.command, message.arguments, message.text);
+}
+
+void trace_writer::write_idle() {
+  static const uint32_t NO_ARGUMENTS[3] = {0, 0, 0};
+  chrono::steady_clock::duration now = chrono::steady_clock::now() - beginning;
+  write_record(static_cast<uint64_t>(chrono::duration_cast<chrono::microseconds>(now).count()), 0, TRACE_IDLE, NO_ARGUMENTS, {});
+  fflush(file);
+}
+
+trace_reader::trace_reader(const char*path) :
+  file{fopen(path, "rb")} {
+  if (!file) {
+    perror(path);
+    exit(1);
+  }
+  char magic[sizeof(TRACE_MAGIC) - 1];
+  if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, TRACE_MAGIC, sizeof(magic))) {
+    fprintf(stderr, "%s is not a trace.\n", path);
+    exit(1);
+  }
+}
+
+trace_reader::~trace_reader() {
+  fclose(file);
+}
+
+bool trace_reader::read_record(trace_record&record) {
+  unsigned char header[32];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header)) {
+    return false;
+  }
+  record.arrival_microseconds = get_bytes(header, 8);
+  record.connection_number = static_cast<uint32_t>(get_bytes(header + 8, 4));
+  record.command = static_cast<uint32_t>(get_bytes(header + 12, 4));
+  for (unsigned i = 0; i < 3; ++i) {
+    record.arguments[i] = static_cast<uint32_t>(get_bytes(header + 16 + 4 * i, 4));
+  }
+  size_t length = static_cast<size_t>(get_bytes(header + 28, 4));
+  vector<unsigned char>bytes(4 * length);
+  if (fread(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+    return false;
+  }
+  record.text.resize(length);
+  for (size_t i = 0; i < length; ++i) {
+    record.text[i] = static_cast<i7_codepoint>(get_bytes(&bytes[4 * i], 4));
+  }
+  return true;
+}
@@ -0,0 +1,77 @@
+#ifndef TRACE_HEADER
+#define TRACE_HEADER
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#include "client_message.hpp"
+
+// A trace is a recording of the messages that a session received from its
+// editors and of when they arrived, written by the highlighter when it is run
+// with --record and read back by i7-replay.  Each record holds one decoded
+// client message, numbered by connection, or marks a point where the session
+// ran out of input and went idle, so that a replay can reproduce the same
+// batches of work.
+//
+// Traces begin with TRACE_MAGIC, and every field after that is little-endian,
+// whatever the byte order of the machine that wrote it, so that traces can be
+// kept as benchmarks and shared.  A record is
+//
+//   [64-bit arrival time in microseconds since the trace began]
+//   [connection number] [command] [argument] [argument] [argument]
+//   [text length] [that many codepoints]
+//
+// with all but the first field 32 bits wide.
+
+#define TRACE_MAGIC			"i7trace1"
+// The command recorded when the session went idle.
+#define TRACE_IDLE			0xFFFFFFFF
+
+struct trace_record {
+  uint64_t				arrival_microseconds;
+  uint32_t				connection_number;
+  uint32_t				command;
+  uint32_t				arguments[3];
+  i7_string				text;
+};
+
+class trace_writer {
+protected:
+  FILE*					file;
+  std::chrono::steady_clock::time_point	beginning;
+
+  void write_record(uint64_t arrival_microseconds, uint32_t connection_number, uint32_t command, const uint32_t*arguments, const i7_string&text);
+
+public:
+  // Exits with a message if the file cannot be created.
+  trace_writer(const char*path);
+  ~trace_writer();
+
+  trace_writer(const trace_writer&) = delete;
+  trace_writer&operator =(const trace_writer&) = delete;
+
+  void write_message(uint32_t connection_number, const client_message&message);
+  // Also flushes, so that the trace survives a server that is killed rather
+  // than shut down.
+  void write_idle();
+};
+
+class trace_reader {
+protected:
+  FILE*					file;
+
+public:
+  // Exits with a message if the file cannot be opened or is not a trace.
+  trace_reader(const char*path);
+  ~trace_reader();
+
+  trace_reader(const trace_reader&) = delete;
+  trace_reader&operator =(const trace_reader&) = delete;
+
+  // Returns false at the end of the trace; a truncated last record, as left by
+  // a server that was killed, counts as the end.
+  bool read_record(trace_record&record);
+};
+
+#endif
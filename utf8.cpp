@@ -0,0 +1,113 @@
+#include <cstring>
+
+#include "utf8.hpp"
+
+using namespace std;
+
+static const i7_codepoint REPLACEMENT_CHARACTER = 0xFFFD;
+
+bool decode_utf8(const char*beginning, const char*end, i7_string&result) {
+  const unsigned char*input = reinterpret_cast<const unsigned char*>(beginning);
+  const unsigned char*input_end = reinterpret_cast<const unsigned char*>(end);
+  // There can be no more codepoints than bytes, so size the result once and
+  // trim it afterward.
+  result.resize(static_cast<size_t>(input_end - input));
+  i7_codepoint*output = &result[0];
+  bool valid = true;
+  while (input != input_end) {
+    // Inform source is mostly ASCII, so widen eight bytes at a time when we
+    // can.
+    while (input_end - input >= 8) {
+      uint64_t chunk;
+      memcpy(&chunk, input, sizeof(chunk));
+      if (chunk & 0x8080808080808080ULL) {
+	break;
+      }
+      for (unsigned i = 0; i < 8; ++i) {
+	output[i] = input[i];
+      }
+      input += 8;
+      output += 8;
+    }
+    if (input == input_end) {
+      break;
+    }
+    unsigned lead = *input;
+    if (lead < 0x80) {
+      *output++ = lead;
+      ++input;
+      continue;
+    }
+    unsigned length;
+    i7_codepoint codepoint;
+    i7_codepoint minimum;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+      length = 2;
+      codepoint = lead & 0x1F;
+      minimum = 0x80;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+      length = 3;
+      codepoint = lead & 0x0F;
+      minimum = 0x800;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+      length = 4;
+      codepoint = lead & 0x07;
+      minimum = 0x10000;
+    } else {
+      goto ill_formed;
+    }
+    if (static_cast<unsigned>(input_end - input) < length) {
+      goto ill_formed;
+    }
+    for (unsigned i = 1; i < length; ++i) {
+      if ((input[i] & 0xC0) != 0x80) {
+	goto ill_formed;
+      }
+      codepoint = (codepoint << 6) | (input[i] & 0x3F);
+    }
+    if (codepoint < minimum || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+      goto ill_formed;
+    }
+    *output++ = codepoint;
+    input += length;
+    continue;
+  ill_formed:
+    *output++ = REPLACEMENT_CHARACTER;
+    ++input;
+    valid = false;
+  }
+  result.resize(static_cast<size_t>(output - result.data()));
+  return valid;
+}
+
+void encode_utf8(const i7_codepoint*beginning, const i7_codepoint*end, string&result) {
+  for (; beginning != end; ++beginning) {
+    i7_codepoint codepoint = *beginning;
+    if (codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+      codepoint = REPLACEMENT_CHARACTER;
+    }
+    if (codepoint < 0x80) {
+      result.push_back(static_cast<char>(codepoint));
+    } else if (codepoint < 0x800) {
+      result.push_back(static_cast<char>(0xC0 | (codepoint >> 6)));
+      result.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    } else if (codepoint < 0x10000) {
+      result.push_back(static_cast<char>(0xE0 | (codepoint >> 12)));
+      result.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+      result.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    } else {
+      result.push_back(static_cast<char>(0xF0 | (codepoint >> 18)));
+      result.push_back(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F)));
+      result.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+      result.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    }
+  }
+}
+
+void encode_varint(uint32_t value, string&result) {
+  while (value >= 0x80) {
+    result.push_back(static_cast<char>(0x80 | (value & 0x7F)));
+    value >>= 7;
+  }
+  result.push_back(static_cast<char>(value));
+}
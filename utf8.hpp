@@ -0,0 +1,31 @@
+#ifndef UTF8_HEADER
+#define UTF8_HEADER
+
+#include <cstdint>
+#include <string>
+
+#include "codepoints.hpp"
+
+// Helpers for the UTF-8 wire encoding (see WIRE_ENCODING_UTF_8 in
+// protocol.hpp).
+//
+// Decoding is validating: overlong forms, surrogates, codepoints beyond
+// 0x10FFFF, stray continuation bytes, and truncated sequences are all rejected.
+// Rather than give up on the whole string, each byte of a rejected sequence
+// decodes to U+FFFD by itself; that way an editor that keeps undecodable bytes
+// as one character apiece still agrees with us on codepoint counts.
+
+// Replaces the contents of result with the decoding of [beginning, end),
+// returning false if any of it was ill-formed.
+bool decode_utf8(const char*beginning, const char*end, i7_string&result);
+
+// Appends the UTF-8 encoding of the codepoints to result.  Since a UCS-4 client
+// can send any word, surrogates and codepoints beyond 0x10FFFF may turn up
+// here; each is encoded as U+FFFD so that the output is always well-formed.
+void encode_utf8(const i7_codepoint*beginning, const i7_codepoint*end, std::string&result);
+
+// Appends an unsigned LEB128 varint to result: seven bits per byte, least
+// significant group first, with the high bit set on every byte but the last.
+void encode_varint(uint32_t value, std::string&result);
+
+#endif